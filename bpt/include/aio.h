@@ -0,0 +1,66 @@
+#ifndef __AIO_H__
+#define __AIO_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Number of requests kept in flight unless the caller chooses.
+#define AIO_DEPTH 32
+
+// Kinds of page requests.
+#define AIO_READ 0
+#define AIO_WRITE 1
+
+// TYPES.
+
+/* Type representing one page-sized request of a batch.
+ * A read past the end of the file fills the rest of buf with zeros.
+ */
+typedef struct aio_req {
+    char * buf;
+    int64_t offset;
+    uint32_t len;
+} aio_req;
+
+/* Type representing an asynchronous I/O context.
+ * With io_uring, up to depth requests of a batch are in flight at
+ * once and complete in any order; a batch is submitted with as few
+ * system calls as the depth allows.  Without io_uring, requests are
+ * served one after another with pread and pwrite.
+ * The ring accepts one batch at a time, guarded by lock.  A ring
+ * that fails so that it cannot be waited on is torn down, and the
+ * context serves its later batches synchronously.
+ */
+typedef struct aio {
+    bool uring;
+    int depth;
+    int ring_fd;
+    pthread_mutex_t lock;
+    void * sq_ring;
+    void * cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    void * sqes;
+    size_t sqes_size;
+    unsigned * sq_head;
+    unsigned * sq_tail;
+    unsigned * sq_mask;
+    unsigned * sq_array;
+    unsigned * cq_head;
+    unsigned * cq_tail;
+    unsigned * cq_mask;
+    void * cqes;
+} aio;
+
+// FUNCTION PROTOTYPES.
+
+aio * aio_open( int depth, bool use_uring );
+void aio_close( aio * ctx );
+int aio_submit( aio * ctx, int fd, int kind, aio_req reqs[], int num_reqs );
+
+#endif /* __AIO_H__ */
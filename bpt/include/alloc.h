@@ -0,0 +1,78 @@
+#ifndef __ALLOC_H__
+#define __ALLOC_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+// Suffix appended to the data file name to name its saved space map.
+#define SPACE_SUFFIX ".free"
+
+// Identifies a saved space map.
+#define SPACE_MAGIC 0x46524545
+
+/* Bytes the data file grows by when no page is free: an eighth of
+ * the file, at least SPACE_MIN_EXTENT and at most SPACE_MAX_EXTENT.
+ */
+#define SPACE_MIN_EXTENT (1024 * 1024)
+#define SPACE_MAX_EXTENT (64 * 1024 * 1024)
+
+// TYPES.
+
+/* Type of the header of a saved space map.  It is followed by
+ * num_extents runs of free pages, each the number of its first page
+ * and its length.  checksum covers everything after itself.
+ */
+typedef struct space_header {
+    uint32_t checksum;
+    uint32_t magic;
+    uint32_t page_size;
+    uint32_t reserved;
+    uint64_t num_pages;
+    uint64_t num_extents;
+} space_header;
+
+/* Type representing the free space of a data file of num_pages pages.
+ * Bit i of the bitmap is set while page i is free; page 0, the
+ * header page, never is.  num_free counts the free pages, and no page
+ * before the one numbered hint is free.
+ * The map lives in memory and is saved to its own file at checkpoints,
+ * as runs of free pages.  It is derived from the tree, so a map that
+ * may be stale is rebuilt from the tree instead of loaded.
+ * With preallocate set, the blocks of new pages are allocated in the
+ * file system when the file grows, so the pages lie together on disk.
+ * The map has no lock: it is changed only with the header page
+ * latched or the table held exclusively.
+ */
+typedef struct space_map {
+    int fd;
+    int data_fd;
+    int page_size;
+    bool preallocate;
+    bool dirty;
+    uint64_t * free;
+    int64_t words;
+    int64_t num_pages;
+    int64_t num_free;
+    int64_t hint;
+} space_map;
+
+// FUNCTION PROTOTYPES.
+
+space_map * space_open( const char * path, int data_fd, int page_size, bool preallocate );
+int space_close( space_map * sm );
+bool space_load( space_map * sm, int64_t num_pages );
+void space_reset( space_map * sm, int64_t num_pages );
+void space_use( space_map * sm, int64_t page );
+int64_t space_alloc( space_map * sm, int64_t near );
+void space_free( space_map * sm, int64_t page );
+void space_extend( space_map * sm, int64_t num_pages );
+bool space_is_free( space_map * sm, int64_t page );
+int64_t space_end( space_map * sm );
+void space_truncate( space_map * sm, int64_t num_pages );
+int space_sync( space_map * sm );
+
+#endif /* __ALLOC_H__ */
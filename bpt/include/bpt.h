@@ -9,6 +9,12 @@
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "buffer.h"
+#include "key.h"
+#include "alloc.h"
 
 #ifdef WINDOWS
 #define bool char
@@ -17,29 +23,13 @@
 #endif
 
 /* FOR TEST RUN ONLY
-#define INTERNAL_ORDER 4
-#define LEAF_ORDER 4
+#define INTERNAL_ORDER(page_size) 4
+#define LEAF_ORDER(page_size) 4
 */
 
-#define INTERNAL_ORDER 249
-#define LEAF_ORDER 32
-
-// Number of pages to allocate when there is no free page.
-#define NEW_PAGE 5
-
-// TYPES.
-
-/* Type representing a queue to print the B+ tree.
- * This type helps the print_tree function to print out
- * B+ tree in BFS.
+/* Space of a node after its header.
  */
-typedef struct queue {
-    int64_t page;
-    struct queue * next;
-} queue;
-
-
-// GLOBALS.
+#define NODE_SPACE(page_size) ((page_size) - 128)
 
 /* The order determines the maximum and minimum
  * number of entries (keys and pointers) in any
@@ -48,113 +38,332 @@ typedef struct queue {
  * Every leaf has as many pointers to data as keys,
  * and every internal node has one more pointer
  * to a subtree than the number of keys.
- * This global variable is initialized to the
- * default value.
+ * An internal page holds at most INTERNAL_ORDER - 1 keys and a leaf
+ * at most LEAF_ORDER - 1 records, and fewer when their keys or values
+ * fill the page first.  Both are as many as the narrowest keys allow
+ * in a page of the given size: 662 and 567 in a page of 4 KiB.
  */
-extern int order;
-extern int leaf_order;
+#define INTERNAL_ORDER(page_size) (NODE_SPACE(page_size) / 6 + 1)
+#define LEAF_ORDER(page_size) (NODE_SPACE(page_size) / 7 + 1)
+
+// Number of tables that can be open at once.
+#define MAX_TABLES 64
 
-/* The queue is used to print the tree in
- * level order, starting from the root
- * printing each entire rank on a separate
- * line, finishing with the leaves.
+// Most levels a tree can have.
+#define MAX_HEIGHT 64
+
+/* Smallest number of frames of the buffer pool of a table.
+ * Every page changed by an operation stays in the pool until it
+ * commits.  A split or merge changes a few pages on each level it
+ * reaches, and nodes keep no pointer to their parent, so no child
+ * is rewritten: the pool need not grow with the page size.
  */
-extern queue * q;
+#define MIN_BUF_NUM(page_size) (4 * MAX_HEIGHT)
+
+// Number of leaves read ahead of a scan at once.
+#define READAHEAD_PAGES 32
+
+// Percentage of each node filled by bulk loading unless given.
+#define DEFAULT_FILL_FACTOR 90
+
+// Size of the value of a record handed to bulk_load, and of the
+// values copied out by find_range and find_many.
+#define VALUE_SIZE 120
 
-/* The file stream is used to read from file and/or
- * write to file.
- * The file descriptor is used to fdatasync.
+/* Largest value stored with a key, with its terminating null.
+ * Any three records of this size fit in one leaf, so a split
+ * always leaves both halves within a page.
  */
-FILE * data_file;
-int fd;
+#define MAX_VALUE_SIZE 1024
 
-// FUNCTION PROTOTYPES.
+// Types of the operations of a batch.
+#define WRITE_INSERT 0
+#define WRITE_DELETE 1
+#define WRITE_UPDATE 2
+
+// TYPES.
+
+/* Type representing a record handed to bulk_load.
+ * The value is a string shorter than VALUE_SIZE.
+ */
+typedef struct record {
+    bpt_key key;
+    char value[VALUE_SIZE];
+} record;
+
+/* Type representing an operation of a batch given to write_batch:
+ * the insertion of key with value, the deletion of key, or the update
+ * of key to value.  result is set as insert, delete or update would
+ * return it.
+ */
+typedef struct write_op {
+    int type;
+    bpt_key key;
+    char * value;
+    int result;
+} write_op;
+
+/* Type representing the header page at offset 0.
+ * num_pages is the number of pages of the file, free or not.
+ * page_size is the size of every page of the file, chosen when
+ * the file is created.
+ * key_type is the type of the keys of the file, and key_size the
+ * bytes of its keys at full width.  A file that records neither has
+ * KEY_INT64 keys.
+ * free_page is no longer used: the free pages are tracked by the
+ * space map of the table.  Files that kept a free list in it are
+ * read all the same.
+ */
+typedef struct header_page_t {
+    int64_t free_page;
+    int64_t root_page;
+    int64_t num_pages;
+    int32_t page_size;
+    int32_t key_type;
+    int32_t key_size;
+} header_page_t;
+
+/* Type representing the fields at the start of every node, which
+ * are laid out alike whatever the type of its keys.  The rest of
+ * a node is laid out as tree.h describes for its type.
+ */
+typedef struct node_header_t {
+    int64_t parent_page;
+    int32_t is_leaf;
+    int32_t num_keys;
+} node_header_t;
+
+
+/* Type representing an open table.
+ * Every table has its own data file, buffer pool, log and
+ * version store, and the compressed page store of the data file
+ * if it keeps pages compressed.  The space map tracks its free pages.
+ * page_size is the size of the pages of the data file.
+ * ops is the tree for the type of its keys.
+ * dev and ino identify the data file, which is opened only once.
+ * Write operations hold op_lock shared; checkpoints and whole-tree
+ * operations hold it exclusively.
+ */
+typedef struct table {
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    int page_size;
+    const struct tree_ops * ops;
+    buf_pool * pool;
+    wal * log;
+    mvcc * versions;
+    zstore * store;
+    space_map * space;
+    pthread_rwlock_t op_lock;
+} table;
+
+/* Type representing a snapshot of a table.
+ * Reads through a snapshot see the tree as it was when the
+ * snapshot began, whatever has been committed since.
+ */
+typedef struct bpt_snapshot {
+    table * table;
+    mvcc_snapshot snap;
+} bpt_snapshot;
+
+/* Type representing a value read in place by find_view.
+ * The leaf holding the value stays pinned and latched shared,
+ * so value points into that page, until release_view.
+ * length counts the terminating null of the value.
+ */
+typedef struct bpt_view {
+    table * table;
+    buf_frame * frame;
+    const char * value;
+    int length;
+} bpt_view;
+
+/* Type representing the readahead of a scan along the leaves.
+ * steps counts the leaves the scan has left, and left the leaves
+ * read ahead that it has not reached yet.  The next window begins
+ * after the leaf holding next_key; done is set once the rightmost
+ * leaf has been read ahead.
+ */
+typedef struct read_ahead {
+    int steps;
+    int left;
+    bpt_key next_key;
+    bool done;
+} read_ahead;
 
-// File open.
+/* Type representing a cursor over the leaves in key order.
+ * The cursor keeps its current leaf pinned and latched shared,
+ * so the values it returns point into that page.
+ * A cursor over a snapshot instead keeps a copy of its leaf
+ * as the snapshot sees it, and holds no latch.
+ */
+typedef struct bpt_cursor {
+    table * table;
+    buf_frame * frame;
+    int index;
+    bpt_snapshot * snapshot;
+    char * page;
+    read_ahead ra;
+} bpt_cursor;
+
+/* Type representing a compaction of a table in progress.
+ * The nodes are placed group by group in key order.  A group is a
+ * parent of leaves and its leaves, after the ancestors of which it is
+ * the leftmost group.  next_key is the smallest key of the group being
+ * placed, whose first node goes to page number dest.  The first placed
+ * nodes of the group are in place, and repacked tells whether its
+ * leaves have been repacked.  placed_all is set once every group is
+ * placed, and done once the end of the file has been cut off as well.
+ * moved counts the nodes moved, freed the leaves freed by repacking,
+ * and reclaimed the bytes freed by cutting off the end of the file, in
+ * the data file or in its compressed page store.
+ */
+typedef struct bpt_compaction {
+    table * table;
+    int fill_factor;
+    bpt_key next_key;
+    int64_t dest;
+    int placed;
+    bool repacked;
+    bool placed_all;
+    bool done;
+    int64_t moved;
+    int64_t freed;
+    int64_t reclaimed;
+} bpt_compaction;
+
+/* Type representing the tree built for one type of key, which
+ * serves every table with keys of that type.  Each function takes
+ * and gives keys as bpt_key, and does on a table what the function
+ * of the same name does on a table id.  find_view takes a view of an
+ * open table, and cursor_seek positions a new cursor.  init_leaf
+ * makes the first leaf of a new file, and rebuild_space rebuilds the
+ * space map of a table from its tree.
+ */
+typedef struct tree_ops {
+    int key_type;
+    int key_size;
+    void (*init_leaf)( table * t, int64_t leaf );
+    void (*rebuild_space)( table * t );
+    void (*print_leaves)( table * t );
+    void (*print_tree)( table * t );
+    const char * (*find_view)( bpt_view * view, bpt_key key );
+    int (*find_many)( table * t, const bpt_key keys[], int num_keys,
+            char values[][VALUE_SIZE], int lengths[] );
+    void (*cursor_seek)( bpt_cursor * cursor, bpt_key lower_bound );
+    int (*cursor_next)( bpt_cursor * cursor, bpt_key keys[], char * values[], int max );
+    char * (*find_at)( bpt_snapshot * snapshot, bpt_key key );
+    int (*insert)( table * t, bpt_key key, char * value );
+    int (*delete)( table * t, bpt_key key );
+    int (*write_batch)( table * t, write_op ops[], int num_ops );
+    int64_t (*bulk_load)( table * t, record * records, int64_t num_records,
+            int fill_factor );
+    int (*compaction_step)( bpt_compaction * compaction );
+} tree_ops;
+
+
+// GLOBALS.
+
+/* Whether nodes store their keys in fewer than KEY_SIZE bytes
+ * when the keys are close enough.  Pages written with either
+ * setting can be read with the other.
+ */
+extern bool compress_keys;
+
+/* The open tables, indexed by the table ids
+ * returned by open_table.
+ */
+extern table * tables[MAX_TABLES];
+
+// The trees for each type of key, built from tree.h.
+
+extern const tree_ops tree_ops_int64;
+extern const tree_ops tree_ops_int32;
+extern const tree_ops tree_ops_uuid;
+extern const tree_ops tree_ops_str16;
+
+// FUNCTION PROTOTYPES.
 
-int open_db( char * pathname );
+// Table open.
 
-// Getters and Setters.
+int open_table( char * pathname, int buf_num, int durability, int io_mode,
+        int page_size, int key_type );
+table * get_table( int table_id );
+int sync_table( int table_id );
+int close_table( int table_id );
+int close_all_tables( void );
+int checkpoint( table * t );
 
-int64_t get_free_page( void );
-int64_t get_root( void );
-int64_t get_num_pages( void );
+// Header page.
 
-int64_t get_parent_page(int64_t page);
-int32_t get_is_leaf(int64_t page);
-int32_t get_num_keys(int64_t page);
-int64_t get_right_sibling(int64_t leaf);
-int64_t get_leaf_key_at(int64_t leaf, int index);
-char * get_leaf_value_at(int64_t leaf, int index);
-int64_t get_internal_key_at(int64_t page, int index);
-int64_t get_internal_value_at(int64_t page, int index);
-int64_t get_next_free_page(int64_t page);
+int64_t get_root( table * t );
+int64_t get_num_pages( table * t );
+void set_root( table * t, int64_t page );
+void set_num_pages( table * t, int64_t num );
+void set_page_size( table * t, int32_t size );
+void set_key_type( table * t, int32_t key_type );
 
-void set_free_page(int64_t page);
-void set_root(int64_t page);
-void set_num_pages(int64_t num);
+// Concurrency.
 
-void set_parent_page(int64_t child, int64_t parent);
-void set_is_leaf(int64_t page, int32_t bit);
-void set_num_keys(int64_t page, int32_t num);
-void set_right_sibling(int64_t leaf, int64_t page);
-void set_leaf_key_at(int64_t leaf, int index, int64_t key);
-void set_leaf_value_at(int64_t leaf, int index, char * value);
-void set_internal_key_at(int64_t page, int index, int64_t key);
-void set_internal_value_at(int64_t page, int index, int64_t offset);
-void set_next_free_page(int64_t page, int64_t next);
+void unlatch( table * t, buf_frame * f );
+int64_t load_root( buf_frame * header );
 
 // Output and utility.
 
 void license_notice( void );
-void print_license( int licence_part );
 void usage_1( void );
 void usage_2( void );
-void enqueue( int64_t new_node );
-int64_t dequeue( void );
-int height( void );
-int path_to_root( int64_t child );
-void print_leaves( void );
-void print_tree( void );
-void find_and_print(int64_t key);
-/*
-void find_and_print_range(node * root, int range1, int range2, bool verbose); 
-int find_range( node * root, int key_start, int key_end, bool verbose,
-        int returned_keys[], void * returned_pointers[]); 
-*/
-int64_t find_leaf( int64_t key );
-char * find( int64_t key );
-int cut( int length );
-
-// Insertion.
-
-int64_t make_node( void );
-int64_t make_leaf( void );
-int get_left_index(int64_t parent, int64_t left);
-void insert_into_leaf( int64_t leaf, int64_t key, char * value );
-void insert_into_leaf_after_splitting(int64_t leaf, int64_t key, char * value);
-void insert_into_node(int64_t n, int left_index, int64_t key, int64_t right);
-void insert_into_node_after_splitting(int64_t old_node, int left_index,
-                                        int64_t key, int64_t right);
-void insert_into_parent(int64_t left, int64_t key, int64_t right);
-void insert_into_new_root(int64_t left, int64_t key, int64_t right);
-void start_new_tree(int64_t key, char * value);
-int insert( int64_t key, char * value );
-
-// Deletion.
-
-int get_neighbor_index( int64_t n );
-int64_t remove_entry_from_node(int64_t n, int64_t key);
-void adjust_root( int64_t root );
-void coalesce_nodes(int64_t n, int64_t neighbor, int neighbor_index, int64_t k_prime);
-void redistribute_nodes(int64_t n, int64_t neighbor, int neighbor_index, 
-                            int k_prime_index, int64_t k_prime);
-void delete_entry( int64_t n, int64_t key );
-
-int delete( int64_t key );
-/*
-void destroy_tree_nodes(node * root);
-node * destroy_tree(node * root);
-*/
+void print_leaves( int table_id );
+void print_tree( int table_id );
+void find_and_print( int table_id, bpt_key key );
+void find_and_print_range( int table_id, bpt_key key_start, bpt_key key_end );
+
+// Search.
+
+int find_range( int table_id, bpt_key key_start, bpt_key key_end, int max,
+        bpt_key returned_keys[], char returned_values[][VALUE_SIZE] );
+char * find( int table_id, bpt_key key );
+const char * find_view( int table_id, bpt_key key, bpt_view * view );
+void release_view( bpt_view * view );
+int find_into( int table_id, bpt_key key, char * buf, int len );
+bool contains( int table_id, bpt_key key );
+int find_many( int table_id, const bpt_key keys[], int num_keys,
+        char values[][VALUE_SIZE], int lengths[] );
+
+// Range scan.
+
+bpt_cursor * bpt_cursor_open( int table_id, bpt_key lower_bound );
+int bpt_cursor_next( bpt_cursor * cursor, bpt_key keys[], char * values[], int max );
+void bpt_cursor_close( bpt_cursor * cursor );
+
+// Snapshot reads.
+
+bpt_snapshot * begin_snapshot( int table_id );
+void end_snapshot( bpt_snapshot * snapshot );
+char * find_at( bpt_snapshot * snapshot, bpt_key key );
+bpt_cursor * bpt_cursor_open_at( bpt_snapshot * snapshot, bpt_key lower_bound );
+
+// Insertion and deletion.
+
+int insert( int table_id, bpt_key key, char * value );
+int delete( int table_id, bpt_key key );
+int update( int table_id, bpt_key key, char * value );
+
+// Batched writes.
+
+int write_batch( int table_id, write_op ops[], int num_ops );
+int insert_batch( int table_id, record * records, int num_records );
+
+// Bulk loading.
+
+int64_t bulk_load( int table_id, record * records, int64_t num_records, int fill_factor );
+
+// Compaction.
+
+bpt_compaction * begin_compaction( int table_id, int fill_factor );
+int compaction_step( bpt_compaction * compaction );
+int64_t end_compaction( bpt_compaction * compaction );
+int64_t compact_table( int table_id, int fill_factor );
 
 #endif /* __BPT_H__ */
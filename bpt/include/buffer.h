@@ -0,0 +1,146 @@
+#ifndef __BUFFER_H__
+#define __BUFFER_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "wal.h"
+#include "mvcc.h"
+#include "aio.h"
+#include "zstore.h"
+
+/* Size of the pages of a new file unless another is chosen.
+ * A file is created with pages of any power of two from
+ * MIN_PAGE_SIZE to MAX_PAGE_SIZE bytes, and every frame of its
+ * buffer pool holds one page.
+ */
+#define PAGE_SIZE 0x1000
+#define MIN_PAGE_SIZE 0x1000
+#define MAX_PAGE_SIZE 0x10000
+
+// Number of frames used when the caller does not choose one.
+#define DEFAULT_BUF_NUM 4096
+
+/* Ways the buffer pool reads and writes the data file.
+ * IO_BUFFERED reads and writes pages at their offset through
+ * the page cache of the kernel.
+ * IO_MMAP maps the file and points clean frames into the mapping,
+ * copying a page only when it is first changed.
+ * IO_DIRECT opens the file with O_DIRECT, so the buffer pool is
+ * the only cache of the file.
+ */
+#define IO_BUFFERED 0
+#define IO_MMAP 1
+#define IO_DIRECT 2
+
+/* Flag added to an I/O mode to keep the pages that compress well in
+ * the compressed page store of the data file.  The store is read and
+ * written through the page cache, and IO_MMAP reads the data file
+ * as IO_BUFFERED does, since mapped pages cannot be decompressed.
+ */
+#define IO_COMPRESS 0x10
+
+// Largest number of adjacent pages read by one request of a prefetch.
+#define PREFETCH_RUN 32
+
+// Address space reserved for the mapping of a data file.
+#define MMAP_RESERVE ((size_t)1 << 36)
+
+// TYPES.
+
+/* Type representing a frame of the buffer pool.
+ * A frame caches one page of the data file.
+ * The page stays in the frame while pin_count is not 0,
+ * and is written back before eviction if is_dirty is set.
+ * A page changed by the operation in progress (in_op) stays in
+ * its frame until the operation commits, and before holds the page
+ * as it was when the operation first changed it.
+ * page_lsn is the LSN of the last log record that changed the page,
+ * and logged tells whether a full image of the page has been logged
+ * since the last checkpoint.
+ * The latch protects the page image and is only held while the frame
+ * is pinned.  The other fields are guarded by the lock of the pool.
+ * data is the page image: buffer, the memory of the frame, or the
+ * page in the mapping of the file while the frame is clean.
+ * loading is set while the page is read from the file, and writing
+ * while it is written back without the pool lock, before eviction or
+ * by buf_flush_all.
+ */
+typedef struct buf_frame {
+    char * data;
+    char * buffer;
+    int64_t page;
+    pthread_rwlock_t latch;
+    int pin_count;
+    bool is_dirty;
+    bool ref_bit;
+    bool in_op;
+    bool logged;
+    bool loading;
+    bool writing;
+    char * before;
+    uint64_t page_lsn;
+    struct buf_frame * next_hash;
+    struct buf_frame * next_op;
+} buf_frame;
+
+/* Type representing a buffer pool.
+ * Frames are looked up through a hash table keyed by
+ * page offset, and victims are chosen by the clock
+ * replacement policy.
+ * The lock guards the hash table and the clock; pages are read
+ * and written back before eviction without it, and loaded is
+ * signaled when a read or such a write completes.  Batches of
+ * pages are read and written through the I/O context aio.
+ * With a version store attached, the images that committed
+ * operations replace are offered to it.
+ * In IO_MMAP mode, map holds the first map_len bytes of the file
+ * at the start of an address range reserved for it, so the mapping
+ * grows in place and never moves.
+ * With a compressed page store attached, pages are read from and
+ * written back to the store where it keeps them.  read_bytes counts
+ * the bytes read from the files.
+ */
+typedef struct buf_pool {
+    int fd;
+    int io_mode;
+    int page_size;
+    aio * aio;
+    char * map;
+    size_t map_len;
+    wal * log;
+    mvcc * versions;
+    zstore * store;
+    uint64_t read_bytes;
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+    buf_frame * frames;
+    char * pages;
+    int num_frames;
+    int clock_hand;
+    buf_frame ** hash;
+    int hash_mask;
+} buf_pool;
+
+// FUNCTION PROTOTYPES.
+
+buf_pool * buf_init( int fd, int num_frames, int io_mode, int page_size );
+int buf_shutdown( buf_pool * pool );
+
+buf_frame * buf_get_page( buf_pool * pool, int64_t page );
+void buf_put_page( buf_pool * pool, buf_frame * frame );
+int buf_prefetch( buf_pool * pool, const int64_t pages[], int num_pages );
+void buf_mark_dirty( buf_pool * pool, buf_frame * frame );
+int buf_flush_all( buf_pool * pool );
+uint64_t buf_commit( buf_pool * pool );
+int buf_checkpoint( buf_pool * pool );
+int buf_truncate( buf_pool * pool, int64_t len );
+void buf_read_version( buf_pool * pool, int64_t page, uint64_t ts, char * out );
+
+#endif /* __BUFFER_H__ */
@@ -0,0 +1,107 @@
+#ifndef __KEY_H__
+#define __KEY_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Types of key a table can have, chosen when its file is created.
+ * KEY_INT64 and KEY_INT32 are signed integers.
+ * KEY_UUID is a 16-byte UUID and KEY_STR16 a string of at most
+ * 16 bytes, padded with nulls.  Both order as their bytes do
+ * under memcmp.
+ */
+#define KEY_INT64 0
+#define KEY_INT32 1
+#define KEY_UUID 2
+#define KEY_STR16 3
+
+// Number of types of key.
+#define NUM_KEY_TYPES 4
+
+// Longest text of a key written by key_format, with its terminating null.
+#define KEY_TEXT_SIZE 40
+
+// TYPES.
+
+/* Type representing a key of a table of any type.  Every type of key
+ * maps into it in order: an integer key is its own value, and a UUID
+ * or string key is the unsigned 128-bit integer whose big-endian bytes
+ * it is, less KEY_BIAS.  Keys of one table so compare as integers.
+ * BPT_KEY_MIN and BPT_KEY_MAX are below and above every key.
+ */
+typedef __int128 bpt_key;
+
+#define KEY_BIAS ((unsigned __int128)1 << 127)
+#define BPT_KEY_MAX ((bpt_key)(KEY_BIAS - 1))
+#define BPT_KEY_MIN (-BPT_KEY_MAX - 1)
+
+/* The tree is compiled once for each type of key, with KEY_TYPE
+ * defined, so every compare and every node layout is specialized
+ * for that key with no callback.
+ * tree_key is a key as the nodes hold it, and tree_ukey the unsigned
+ * type of the same width, in which the distances between keys are
+ * taken.  KEY_MIN and KEY_MAX are its smallest and largest keys, and
+ * KEY_SIZE the bytes of a key at full width.  The 128-bit keys are
+ * aligned to 8 bytes so that they sit in the node header where the
+ * 64-bit keys do.
+ * KEY_IN turns a bpt_key that KEY_FITS into a tree_key, and KEY_OUT
+ * turns it back.  KEYED(name) names a function of the tree for
+ * KEY_TYPE, so the trees of every type link side by side.
+ */
+#ifdef KEY_TYPE
+#if KEY_TYPE == KEY_INT64
+typedef int64_t tree_key;
+typedef uint64_t tree_ukey;
+#define KEY_SIZE 8
+#define KEY_MIN INT64_MIN
+#define KEY_MAX INT64_MAX
+#define KEY_SUFFIX int64
+#elif KEY_TYPE == KEY_INT32
+typedef int32_t tree_key;
+typedef uint32_t tree_ukey;
+#define KEY_SIZE 4
+#define KEY_MIN INT32_MIN
+#define KEY_MAX INT32_MAX
+#define KEY_SUFFIX int32
+#elif KEY_TYPE == KEY_UUID || KEY_TYPE == KEY_STR16
+typedef unsigned __int128 tree_key __attribute__((aligned(8)));
+typedef unsigned __int128 tree_ukey __attribute__((aligned(8)));
+#define KEY_SIZE 16
+#define KEY_MIN ((tree_key)0)
+#define KEY_MAX (~(tree_key)0)
+#if KEY_TYPE == KEY_UUID
+#define KEY_SUFFIX uuid
+#else
+#define KEY_SUFFIX str16
+#endif
+#else
+#error "KEY_TYPE must be KEY_INT64, KEY_INT32, KEY_UUID or KEY_STR16."
+#endif
+
+#if KEY_SIZE == 16
+#define KEY_IN(key) ((tree_key)((unsigned __int128)(key) ^ KEY_BIAS))
+#define KEY_OUT(key) ((bpt_key)((key) ^ KEY_BIAS))
+#else
+#define KEY_IN(key) ((tree_key)(key))
+#define KEY_OUT(key) ((bpt_key)(key))
+#endif
+#define KEY_FITS(key) ((key) >= KEY_OUT(KEY_MIN) && (key) <= KEY_OUT(KEY_MAX))
+
+#define KEYED(name) KEYED_NAME(name, KEY_SUFFIX)
+#define KEYED_NAME(name, suffix) KEYED_PASTE(name, suffix)
+#define KEYED_PASTE(name, suffix) name ## _ ## suffix
+#endif
+
+// FUNCTION PROTOTYPES.
+
+int key_size( int key_type );
+int key_type_parse( const char * name );
+char * key_format( int key_type, bpt_key key, char * buf );
+int key_parse( int key_type, const char * text, bpt_key * key );
+bpt_key key_from_bytes( int key_type, const unsigned char * bytes );
+void key_to_bytes( int key_type, bpt_key key, unsigned char * bytes );
+
+#endif /* __KEY_H__ */
@@ -0,0 +1,24 @@
+#ifndef __LZ_H__
+#define __LZ_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Shortest match the compressor looks for.
+#define LZ_MIN_MATCH 4
+
+// Number of bits of the hash of the next LZ_MIN_MATCH bytes.
+#define LZ_HASH_BITS 12
+
+// Largest distance back to a match.
+#define LZ_MAX_OFFSET 65535
+
+// FUNCTION PROTOTYPES.
+
+int lz_compress( const char * src, int len, char * dst, int cap );
+int lz_decompress( const char * src, int len, char * dst, int cap );
+
+#endif /* __LZ_H__ */
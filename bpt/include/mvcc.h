@@ -0,0 +1,65 @@
+#ifndef __MVCC_H__
+#define __MVCC_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+// Number of hash buckets of a version store.
+#define MVCC_HASH_SIZE 1024
+
+// TYPES.
+
+/* Type representing an older image of a page.
+ * The image was the page from the commit before it until the
+ * commit with timestamp end_ts replaced it.  Versions of a page
+ * are chained from the newest to the oldest.
+ */
+typedef struct page_version {
+    int64_t page;
+    uint64_t end_ts;
+    char * image;
+    struct page_version * older;
+    struct page_version * next_hash;
+} page_version;
+
+/* Type representing an open snapshot.
+ * A snapshot sees every operation committed with a timestamp
+ * less than or equal to ts, and nothing committed later.
+ */
+typedef struct mvcc_snapshot {
+    uint64_t ts;
+    struct mvcc_snapshot * prev;
+    struct mvcc_snapshot * next;
+} mvcc_snapshot;
+
+/* Type representing the version store of a table.
+ * Every committed operation gets the next timestamp of the clock.
+ * Older page images are kept only while a snapshot taken before
+ * they were replaced is open.  Snapshots are listed from the oldest,
+ * and the hash table maps a page to its newest kept version.
+ */
+typedef struct mvcc {
+    pthread_mutex_t lock;
+    uint64_t clock;
+    mvcc_snapshot * oldest;
+    mvcc_snapshot * newest;
+    page_version * hash[MVCC_HASH_SIZE];
+} mvcc;
+
+// FUNCTION PROTOTYPES.
+
+mvcc * mvcc_create( void );
+void mvcc_destroy( mvcc * m );
+
+uint64_t mvcc_tick( mvcc * m );
+bool mvcc_keep( mvcc * m, int64_t page, char * image, uint64_t end_ts );
+bool mvcc_read( mvcc * m, int64_t page, uint64_t ts, char * out, size_t size );
+void mvcc_begin( mvcc * m, mvcc_snapshot * snapshot );
+void mvcc_end( mvcc * m, mvcc_snapshot * snapshot );
+bool mvcc_in_use( mvcc * m );
+
+#endif /* __MVCC_H__ */
@@ -0,0 +1,307 @@
+#ifndef __TREE_H__
+#define __TREE_H__
+
+/* The tree for one type of key.  Its sources include this header
+ * and are compiled once for each type, with KEY_TYPE defined, so
+ * the tree of every type is built from the same code.  Every
+ * function shared by those sources is renamed by KEYED for its
+ * type, and the tables reach the tree of their type through
+ * its tree_ops only.
+ */
+#ifndef KEY_TYPE
+#error "tree.h is only for the sources of the tree, built with KEY_TYPE."
+#endif
+
+#include "bpt.h"
+
+// Largest slot of a leaf: a key at full width and the place of its value.
+#define MAX_SLOT_SIZE (KEY_SIZE + 4)
+
+// Names of the functions of the tree for KEY_TYPE.
+
+#define get_is_leaf KEYED(get_is_leaf)
+#define get_num_keys KEYED(get_num_keys)
+#define get_right_sibling KEYED(get_right_sibling)
+#define get_leaf_key_at KEYED(get_leaf_key_at)
+#define get_internal_key_at KEYED(get_internal_key_at)
+#define get_internal_value_at KEYED(get_internal_value_at)
+#define set_is_leaf KEYED(set_is_leaf)
+#define set_num_keys KEYED(set_num_keys)
+#define set_right_sibling KEYED(set_right_sibling)
+#define set_leaf_key_at KEYED(set_leaf_key_at)
+#define set_leaf_value_at KEYED(set_leaf_value_at)
+#define set_leaf_empty KEYED(set_leaf_empty)
+#define set_node_empty KEYED(set_node_empty)
+#define set_internal_key_at KEYED(set_internal_key_at)
+#define set_internal_value_at KEYED(set_internal_value_at)
+#define begin_op KEYED(begin_op)
+#define hold_latch KEYED(hold_latch)
+#define latch_page KEYED(latch_page)
+#define end_op KEYED(end_op)
+#define latch_path KEYED(latch_path)
+#define get_parent KEYED(get_parent)
+#define search_leaf KEYED(search_leaf)
+#define search_internal KEYED(search_internal)
+#define key_width KEYED(key_width)
+#define load_delta KEYED(load_delta)
+#define store_delta KEYED(store_delta)
+#define node_init KEYED(node_init)
+#define node_capacity KEYED(node_capacity)
+#define node_key KEYED(node_key)
+#define node_child KEYED(node_child)
+#define node_set_key KEYED(node_set_key)
+#define node_set_child KEYED(node_set_child)
+#define node_read KEYED(node_read)
+#define node_write KEYED(node_write)
+#define node_fits KEYED(node_fits)
+#define node_can_set_key KEYED(node_can_set_key)
+#define node_underflows KEYED(node_underflows)
+#define node_is_safe KEYED(node_is_safe)
+#define node_can_merge KEYED(node_can_merge)
+#define node_split KEYED(node_split)
+#define node_insert_at KEYED(node_insert_at)
+#define node_remove_at KEYED(node_remove_at)
+#define leaf_init KEYED(leaf_init)
+#define leaf_slot_size KEYED(leaf_slot_size)
+#define leaf_key KEYED(leaf_key)
+#define leaf_value KEYED(leaf_value)
+#define leaf_length KEYED(leaf_length)
+#define leaf_used KEYED(leaf_used)
+#define leaf_fits KEYED(leaf_fits)
+#define leaf_underflows KEYED(leaf_underflows)
+#define leaf_is_safe KEYED(leaf_is_safe)
+#define leaf_can_replace KEYED(leaf_can_replace)
+#define leaf_can_merge KEYED(leaf_can_merge)
+#define leaf_insert_at KEYED(leaf_insert_at)
+#define leaf_remove_at KEYED(leaf_remove_at)
+#define enqueue KEYED(enqueue)
+#define dequeue KEYED(dequeue)
+#define height KEYED(height)
+#define find_leaf KEYED(find_leaf)
+#define cut KEYED(cut)
+#define make_node KEYED(make_node)
+#define make_leaf KEYED(make_leaf)
+#define free_node KEYED(free_node)
+#define get_left_index KEYED(get_left_index)
+#define insert_into_leaf KEYED(insert_into_leaf)
+#define insert_into_leaf_after_splitting KEYED(insert_into_leaf_after_splitting)
+#define insert_into_node KEYED(insert_into_node)
+#define insert_into_node_after_splitting KEYED(insert_into_node_after_splitting)
+#define insert_into_parent KEYED(insert_into_parent)
+#define insert_into_new_root KEYED(insert_into_new_root)
+#define start_new_tree KEYED(start_new_tree)
+#define get_neighbor_index KEYED(get_neighbor_index)
+#define remove_entry_from_node KEYED(remove_entry_from_node)
+#define adjust_root KEYED(adjust_root)
+#define coalesce_nodes KEYED(coalesce_nodes)
+#define redistribute_nodes KEYED(redistribute_nodes)
+#define delete_entry KEYED(delete_entry)
+#define tree_bulk_load KEYED(tree_bulk_load)
+#define tree_compaction_step KEYED(tree_compaction_step)
+
+/* Returns the smallest key of the tree at or above a key of any
+ * table that is not above every key of the tree.
+ */
+#define KEY_AT_LEAST(key) ((key) < KEY_OUT(KEY_MIN) ? KEY_MIN : KEY_IN(key))
+
+// TYPES.
+
+/* Type representing an entry of an internal page, as read out
+ * of the page.  page points to the subtree holding the keys
+ * greater than or equal to key.
+ */
+typedef struct entry {
+    tree_key key;
+    int64_t page;
+} entry;
+
+/* Types representing leaf and internal pages.
+ * Both begin with the same 128-byte header, so the
+ * header fields of any node can be read through leaf_page_t.
+ * The 8 bytes at offset 120 hold the right sibling of a leaf
+ * and the leftmost child of an internal page.
+ * Every key of a node is stored as its distance from key_base
+ * in key_width bytes: 2, 4, 8 or 16, up to KEY_SIZE.  page_size is
+ * the size of the page, so the functions on a node need nothing but
+ * the node.
+ * A leaf is a slotted page: the slots follow the header in key
+ * order, each a key followed by the 16-bit offset and length of
+ * its value, and the values are kept in a heap that grows down
+ * from the end of the page.  heap_start is the lowest byte of the
+ * heap, and heap_free counts the bytes of removed values inside it.
+ * An internal page keeps its keys from the start of entries and the
+ * 32-bit page numbers of its other children at the end.
+ * parent_page is no longer used: the parent of a node is found on the
+ * path that led to it.  Files that kept parent pointers in it are read
+ * all the same.
+ */
+typedef struct leaf_page_t {
+    int64_t parent_page;
+    int32_t is_leaf;
+    int32_t num_keys;
+    int32_t heap_start;
+    int32_t heap_free;
+    tree_key key_base;
+    int32_t key_width;
+    int32_t page_size;
+    char reserved[88 - KEY_SIZE];
+    int64_t right_sibling;
+    char slots[];
+} leaf_page_t;
+
+typedef struct internal_page_t {
+    int64_t parent_page;
+    int32_t is_leaf;
+    int32_t num_keys;
+    char reserved1[8];
+    tree_key key_base;
+    int32_t key_width;
+    int32_t page_size;
+    char reserved[88 - KEY_SIZE];
+    int64_t one_more_page;
+    char entries[];
+} internal_page_t;
+
+/* Type representing the path from the root down to a node.
+ * pages[0] is the root, and pages[i + 1] is the child index[i]
+ * of pages[i]; the node is pages[depth - 1].
+ */
+typedef struct tree_path {
+    int depth;
+    int64_t pages[MAX_HEIGHT];
+    int index[MAX_HEIGHT];
+} tree_path;
+
+/* Type representing a queue to print the B+ tree.
+ * This type helps the print_tree function to print out
+ * B+ tree in BFS.
+ */
+typedef struct queue {
+    int64_t page;
+    struct queue * next;
+} queue;
+
+// FUNCTION PROTOTYPES.
+
+// Getters and Setters.
+
+int32_t get_is_leaf(table * t, int64_t page);
+int32_t get_num_keys(table * t, int64_t page);
+int64_t get_right_sibling(table * t, int64_t leaf);
+tree_key get_leaf_key_at(table * t, int64_t leaf, int index);
+tree_key get_internal_key_at(table * t, int64_t page, int index);
+int64_t get_internal_value_at(table * t, int64_t page, int index);
+
+void set_is_leaf(table * t, int64_t page, int32_t bit);
+void set_num_keys(table * t, int64_t page, int32_t num);
+void set_right_sibling(table * t, int64_t leaf, int64_t page);
+void set_leaf_key_at(table * t, int64_t leaf, int index, tree_key key);
+void set_leaf_value_at(table * t, int64_t leaf, int index, char * value);
+void set_leaf_empty(table * t, int64_t leaf);
+void set_node_empty(table * t, int64_t page);
+void set_internal_key_at(table * t, int64_t page, int index, tree_key key);
+void set_internal_value_at(table * t, int64_t page, int index, int64_t offset);
+
+// Concurrency.
+
+void begin_op( table * t );
+void hold_latch( buf_frame * f );
+buf_frame * latch_page( table * t, int64_t page );
+int end_op( table * t );
+int64_t latch_path( table * t, tree_key key, bool deleting );
+int64_t get_parent( int64_t n );
+
+// Search inside a node.
+
+int search_leaf( const leaf_page_t * leaf, tree_key key );
+int search_internal( const internal_page_t * page, tree_key key );
+
+// Compressed keys.
+
+int key_width( tree_key min_key, tree_key max_key );
+tree_ukey load_delta( const char * p, int width );
+void store_delta( char * p, int width, tree_ukey delta );
+
+// Internal pages.
+
+void node_init( internal_page_t * p, int page_size );
+int node_capacity( int page_size, tree_key min_key, tree_key max_key );
+tree_key node_key( const internal_page_t * p, int index );
+int64_t node_child( const internal_page_t * p, int index );
+void node_set_key( internal_page_t * p, int index, tree_key key );
+void node_set_child( internal_page_t * p, int index, int64_t page );
+int node_read( const internal_page_t * p, entry entries[] );
+void node_write( internal_page_t * p, const entry entries[], int num_entries );
+bool node_fits( const internal_page_t * p, tree_key key );
+bool node_can_set_key( const internal_page_t * p, int index, tree_key key );
+bool node_underflows( const internal_page_t * p );
+bool node_is_safe( const internal_page_t * p, bool deleting );
+bool node_can_merge( const internal_page_t * left, tree_key k_prime,
+        const internal_page_t * right );
+int node_split( int page_size, const entry entries[], int num_entries );
+void node_insert_at( internal_page_t * p, int index, tree_key key, int64_t child );
+void node_remove_at( internal_page_t * p, int index );
+
+// Slotted leaves.
+
+void leaf_init( leaf_page_t * leaf, int page_size );
+int leaf_slot_size( tree_key min_key, tree_key max_key );
+tree_key leaf_key( const leaf_page_t * leaf, int index );
+char * leaf_value( const leaf_page_t * leaf, int index );
+int leaf_length( const leaf_page_t * leaf, int index );
+int leaf_used( const leaf_page_t * leaf );
+bool leaf_fits( const leaf_page_t * leaf, tree_key key, int length );
+bool leaf_underflows( const leaf_page_t * leaf );
+bool leaf_is_safe( const leaf_page_t * leaf, int length, bool deleting );
+bool leaf_can_replace( const leaf_page_t * leaf, int index, int length );
+bool leaf_can_merge( const leaf_page_t * leaf, const leaf_page_t * other );
+void leaf_insert_at( leaf_page_t * leaf, int index, tree_key key,
+        const char * value, int length );
+void leaf_remove_at( leaf_page_t * leaf, int index );
+
+// Output and utility.
+
+void enqueue( queue ** q, int64_t new_node );
+int64_t dequeue( queue ** q );
+int height( table * t );
+buf_frame * find_leaf( table * t, tree_key key, bool exclusive );
+int cut( int length );
+
+// Insertion.
+
+int64_t make_node( table * t, int64_t near );
+int64_t make_leaf( table * t, int64_t near );
+void free_node( table * t, int64_t page );
+int get_left_index( int64_t left );
+void insert_into_leaf( table * t, int64_t leaf, tree_key key, char * value );
+void insert_into_leaf_after_splitting(table * t, int64_t leaf, tree_key key, char * value);
+void insert_into_node(table * t, int64_t n, int left_index, tree_key key, int64_t right);
+void insert_into_node_after_splitting(table * t, int64_t old_node, int left_index,
+                                        tree_key key, int64_t right);
+void insert_into_parent(table * t, int64_t left, tree_key key, int64_t right);
+void insert_into_new_root(table * t, int64_t left, tree_key key, int64_t right);
+void start_new_tree(table * t, tree_key key, char * value);
+
+// Bulk loading.
+
+int64_t tree_bulk_load( table * t, record * records, int64_t num_records, int fill_factor );
+
+// Compaction.
+
+int tree_compaction_step( bpt_compaction * compaction );
+
+// Deletion.
+
+int get_neighbor_index( int64_t n );
+int64_t remove_entry_from_node(table * t, int64_t n, tree_key key);
+void adjust_root( table * t, int64_t root );
+void coalesce_nodes(table * t, int64_t n, int64_t neighbor, int neighbor_index, tree_key k_prime);
+void redistribute_nodes(table * t, int64_t n, int64_t neighbor, int neighbor_index,
+                            int k_prime_index, tree_key k_prime);
+void delete_entry( table * t, int64_t n, tree_key key );
+/*
+void destroy_tree_nodes(node * root);
+node * destroy_tree(node * root);
+*/
+
+#endif /* __TREE_H__ */
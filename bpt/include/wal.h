@@ -0,0 +1,92 @@
+#ifndef __WAL_H__
+#define __WAL_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Durability levels given to open_table.
+ * A positive level syncs the log every that many milliseconds.
+ */
+#define DURABILITY_COMMIT 0
+#define DURABILITY_NONE -1
+
+// Suffix appended to the data file name to name its log.
+#define WAL_SUFFIX ".wal"
+
+// Size of buffered log records that is written out without a sync.
+#define WAL_BUFFER_SIZE (1024 * 1024)
+
+// Size of the log that triggers a checkpoint.
+#define WAL_CHECKPOINT_SIZE (64 * 1024 * 1024)
+
+struct buf_pool;
+
+// TYPES.
+
+/* Type representing the write-ahead log of a data file.
+ * Records are appended to an in-memory buffer and carry increasing
+ * log sequence numbers (LSN), the number of log bytes written before
+ * their end.  One committer at a time becomes the leader, writes
+ * everything buffered so far and syncs it once for every waiting
+ * committer: this is the group commit.
+ * failed is set once a write or a sync of the log fails.  The records
+ * it held are lost and the file may end in a torn record, past which
+ * replay never reads, so every later flush fails as well.
+ */
+typedef struct wal {
+    int fd;
+    int durability;
+    pthread_mutex_t lock;
+    pthread_cond_t flushed;
+    pthread_cond_t wakeup;
+    char * buffer;
+    size_t buffer_len;
+    size_t buffer_cap;
+    char * spare;
+    size_t spare_cap;
+    uint64_t next_lsn;
+    uint64_t written_lsn;
+    uint64_t flushed_lsn;
+    uint64_t checkpoint_lsn;
+    bool writing;
+    bool failed;
+    bool stop;
+    bool has_flusher;
+    pthread_t flusher;
+} wal;
+
+/* Type of the header of a log record.
+ * A record holds every page range changed by one operation and is
+ * applied entirely or not at all.  The checksum covers everything
+ * after itself, so a record torn by a crash is ignored.
+ * It is followed by ranges, each a wal_range and its bytes.
+ */
+typedef struct wal_record {
+    uint32_t checksum;
+    uint32_t length;
+    uint64_t lsn;
+} wal_record;
+
+typedef struct wal_range {
+    int64_t page;
+    uint32_t offset;
+    uint32_t size;
+} wal_range;
+
+// FUNCTION PROTOTYPES.
+
+wal * wal_open( const char * pathname, int durability );
+int wal_close( wal * log );
+
+uint32_t wal_checksum( const char * data, size_t len );
+uint64_t wal_append( wal * log, const char * rec, size_t len );
+int wal_flush( wal * log, uint64_t lsn );
+int wal_commit( wal * log, uint64_t lsn );
+uint64_t wal_size( wal * log );
+int wal_truncate( wal * log );
+int wal_replay( wal * log, struct buf_pool * pool );
+
+#endif /* __WAL_H__ */
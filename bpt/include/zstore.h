@@ -0,0 +1,89 @@
+#ifndef __ZSTORE_H__
+#define __ZSTORE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "aio.h"
+
+// Suffix appended to the data file name to name its compressed page store.
+#define ZSTORE_SUFFIX ".z"
+
+// Unit of space in the store.  A page is stored only if it saves one.
+#define ZSTORE_SECTOR 512
+
+// Largest number of pages compressed for one batch of writes.
+#define ZSTORE_BATCH 256
+
+// Identifies the superblock of a store.
+#define ZSTORE_MAGIC 0x5a545042
+
+// TYPES.
+
+/* Type representing the superblock, the first sector of a store.
+ * It locates the page translation map written by the last sync:
+ * map_entries entries of 8 bytes from sector map_start.
+ * checksum covers the rest of the superblock.
+ */
+typedef struct zstore_super {
+    uint32_t checksum;
+    uint32_t magic;
+    uint32_t page_size;
+    uint32_t map_checksum;
+    uint64_t map_start;
+    uint64_t map_entries;
+} zstore_super;
+
+/* Type representing the compressed page store of a data file.
+ * A page in the store is kept as a compressed block in a run of
+ * sectors, and its page in the data file is a hole.  The page
+ * translation map gives, by page number, the first sector of that
+ * run shifted left by 16 bits plus the length of the block, or 0 for
+ * a page kept uncompressed in the data file.
+ * The map is written out whole when the store is synced, to the one
+ * of two runs of sectors kept for it that the superblock does not
+ * point at; map_slot is the run written last.  A run is reallocated
+ * half again as large when the map outgrows it.  In between, sectors
+ * are allocated and freed in a bitmap rebuilt from the map at open.
+ * Runs are handed out by next fit from the last one, so pages
+ * written together lie together.
+ * The lock guards the map and the bitmap; blocks are read and
+ * written without it.
+ */
+typedef struct zstore {
+    int fd;
+    int data_fd;
+    int page_size;
+    pthread_mutex_t lock;
+    uint64_t * map;
+    int64_t map_size;
+    bool map_dirty;
+    int64_t map_start[2];
+    int64_t map_sectors[2];
+    int map_slot;
+    uint64_t * used;
+    int64_t used_words;
+    int64_t num_sectors;
+    int64_t free_sectors;
+    int64_t hint;
+} zstore;
+
+// FUNCTION PROTOTYPES.
+
+zstore * zstore_open( const char * path, int data_fd, int page_size );
+int zstore_close( zstore * zs );
+
+int zstore_read( zstore * zs, int64_t page, char * out );
+int64_t zstore_read_batch( zstore * zs, aio * ctx, const int64_t pages[],
+        char * const out[], int num_pages, bool found[] );
+int zstore_write( zstore * zs, int64_t page, const char * image );
+int zstore_write_batch( zstore * zs, aio * ctx, const int64_t pages[],
+        char * const images[], int num_pages, bool stored[] );
+int64_t zstore_drop( zstore * zs, int64_t page );
+int zstore_sync( zstore * zs );
+
+#endif /* __ZSTORE_H__ */
@@ -0,0 +1,261 @@
+/*
+ *  aio.c
+ *
+ *  Batched page I/O of the disk-based B+ tree.
+ *  A batch of page reads or writes is handed to io_uring, which keeps
+ *  up to depth of them in flight and completes them out of order, so
+ *  a batch costs a few system calls and overlaps the latency of its
+ *  pages.  The ring is set up with the raw system calls.  Where
+ *  io_uring is not available, the same batch is served synchronously
+ *  with pread and pwrite.
+ */
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "aio.h"
+
+// UTILITIES
+
+static int uring_setup( unsigned entries, struct io_uring_params * p ) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter( int fd, unsigned to_submit, unsigned min_complete ) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+            IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+/* Finishes a request synchronously from byte done on.
+ * Returns 0, or -1 on error.
+ */
+static int finish_sync( int fd, int kind, aio_req * req, size_t done ) {
+    ssize_t n;
+
+    while (done < req->len) {
+        if (kind == AIO_READ)
+            n = pread(fd, req->buf + done, req->len - done, req->offset + done);
+        else
+            n = pwrite(fd, req->buf + done, req->len - done, req->offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 || (n == 0 && kind == AIO_WRITE))
+            return -1;
+        if (n == 0)
+            break;
+        done += n;
+    }
+    if (done < req->len)
+        memset(req->buf + done, 0, req->len - done);
+    return 0;
+}
+
+/* Maps the rings of an io_uring instance.
+ * Returns false if the kernel refuses it.
+ */
+static bool uring_init( aio * ctx ) {
+    struct io_uring_params p;
+    char * sq, * cq;
+
+    memset(&p, 0, sizeof(p));
+    ctx->ring_fd = uring_setup(ctx->depth, &p);
+    if (ctx->ring_fd < 0)
+        return false;
+
+    ctx->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ctx->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ctx->cq_ring_size > ctx->sq_ring_size)
+            ctx->sq_ring_size = ctx->cq_ring_size;
+        ctx->cq_ring_size = 0;
+    }
+    ctx->sq_ring = mmap(NULL, ctx->sq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ctx->ring_fd, IORING_OFF_SQ_RING);
+    if (ctx->sq_ring == MAP_FAILED) {
+        close(ctx->ring_fd);
+        return false;
+    }
+    if (ctx->cq_ring_size == 0)
+        ctx->cq_ring = ctx->sq_ring;
+    else {
+        ctx->cq_ring = mmap(NULL, ctx->cq_ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ctx->ring_fd, IORING_OFF_CQ_RING);
+        if (ctx->cq_ring == MAP_FAILED) {
+            munmap(ctx->sq_ring, ctx->sq_ring_size);
+            close(ctx->ring_fd);
+            return false;
+        }
+    }
+    ctx->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ctx->sqes = mmap(NULL, ctx->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ctx->ring_fd, IORING_OFF_SQES);
+    if (ctx->sqes == MAP_FAILED) {
+        if (ctx->cq_ring_size != 0)
+            munmap(ctx->cq_ring, ctx->cq_ring_size);
+        munmap(ctx->sq_ring, ctx->sq_ring_size);
+        close(ctx->ring_fd);
+        return false;
+    }
+
+    sq = (char *)ctx->sq_ring;
+    cq = (char *)ctx->cq_ring;
+    ctx->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ctx->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ctx->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ctx->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ctx->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ctx->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ctx->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ctx->cqes = cq + p.cq_off.cqes;
+    ctx->depth = p.sq_entries;
+    return true;
+}
+
+/* Unmaps the rings of an io_uring instance and closes it.  Requests
+ * still in flight are cancelled by the kernel.  The context then
+ * serves its batches synchronously.
+ */
+static void uring_teardown( aio * ctx ) {
+    munmap(ctx->sqes, ctx->sqes_size);
+    if (ctx->cq_ring != ctx->sq_ring)
+        munmap(ctx->cq_ring, ctx->cq_ring_size);
+    munmap(ctx->sq_ring, ctx->sq_ring_size);
+    close(ctx->ring_fd);
+    ctx->ring_fd = -1;
+    ctx->depth = 1;
+    __atomic_store_n(&ctx->uring, false, __ATOMIC_RELEASE);
+}
+
+/* Runs a batch through the ring, refilling it as requests complete.
+ * A short transfer is finished synchronously.
+ * queued counts the requests in the submission ring that the kernel
+ * has not taken yet, which are submitted again after an interrupted
+ * call, and in_flight those it has taken and not completed.
+ * The kernel uses the buffers of the requests in flight until they
+ * complete, so they are waited for even after an error.  If the ring
+ * cannot be waited on at all, it is torn down instead, so that no
+ * completion of this batch is left for the next.
+ */
+static int uring_submit( aio * ctx, int fd, int kind, aio_req reqs[], int num_reqs ) {
+    struct io_uring_sqe * sqe;
+    struct io_uring_cqe * cqe;
+    unsigned tail, head, index;
+    int next = 0, queued = 0, in_flight = 0, n, result = 0;
+    aio_req * req;
+
+    while (next < num_reqs || queued > 0 || in_flight > 0) {
+        tail = *ctx->sq_tail;
+        for (; next < num_reqs && queued + in_flight < ctx->depth; next++, queued++) {
+            index = tail & *ctx->sq_mask;
+            sqe = &((struct io_uring_sqe *)ctx->sqes)[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = kind == AIO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)(uintptr_t)reqs[next].buf;
+            sqe->len = reqs[next].len;
+            sqe->off = reqs[next].offset;
+            sqe->user_data = next;
+            ctx->sq_array[index] = index;
+            tail++;
+        }
+        __atomic_store_n(ctx->sq_tail, tail, __ATOMIC_RELEASE);
+
+        n = uring_enter(ctx->ring_fd, queued, 1);
+        if (n >= 0) {
+            queued -= n;
+            in_flight += n;
+        }
+        else if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+            // Nothing was lost: the call is made again once reaped.
+        }
+        else if (queued > 0) {
+            // The requests the kernel has not taken are taken back.
+            __atomic_store_n(ctx->sq_tail, tail - queued, __ATOMIC_RELEASE);
+            queued = 0;
+            next = num_reqs;
+            result = -1;
+        }
+        else {
+            uring_teardown(ctx);
+            return -1;
+        }
+
+        head = *ctx->cq_head;
+        while (head != __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE)) {
+            cqe = &((struct io_uring_cqe *)ctx->cqes)[head & *ctx->cq_mask];
+            req = &reqs[cqe->user_data];
+            if (cqe->res < 0 && cqe->res != -EAGAIN && cqe->res != -EINTR)
+                result = -1;
+            else if (finish_sync(fd, kind, req, cqe->res < 0 ? 0 : cqe->res) != 0)
+                result = -1;
+            head++;
+            in_flight--;
+        }
+        __atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return result;
+}
+
+// ASYNCHRONOUS I/O
+
+/* Creates an I/O context keeping up to depth requests in flight.
+ * io_uring is used if use_uring is set and the kernel allows it;
+ * otherwise requests are served synchronously.
+ */
+aio * aio_open( int depth, bool use_uring ) {
+    aio * ctx;
+
+    ctx = (aio *) calloc(1, sizeof(aio));
+    if (ctx == NULL) {
+        perror("I/O context creation.");
+        exit(EXIT_FAILURE);
+    }
+    ctx->depth = depth > 0 ? depth : AIO_DEPTH;
+    ctx->ring_fd = -1;
+    pthread_mutex_init(&ctx->lock, NULL);
+    ctx->uring = use_uring && uring_init(ctx);
+    if (!ctx->uring)
+        ctx->depth = 1;
+
+    return ctx;
+}
+
+
+void aio_close( aio * ctx ) {
+    if (ctx == NULL)
+        return;
+    if (ctx->uring)
+        uring_teardown(ctx);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
+}
+
+
+/* Reads or writes every request of a batch and waits for all of them.
+ * kind is AIO_READ or AIO_WRITE.
+ * Returns 0, or -1 if any request failed.
+ */
+int aio_submit( aio * ctx, int fd, int kind, aio_req reqs[], int num_reqs ) {
+    int i, result = 0;
+
+    if (num_reqs <= 0)
+        return 0;
+
+    // A ring torn down by an earlier batch is seen under the lock.
+    if (__atomic_load_n(&ctx->uring, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&ctx->lock);
+        if (ctx->uring) {
+            result = uring_submit(ctx, fd, kind, reqs, num_reqs);
+            pthread_mutex_unlock(&ctx->lock);
+            return result;
+        }
+        pthread_mutex_unlock(&ctx->lock);
+    }
+
+    for (i = 0; i < num_reqs; i++)
+        if (finish_sync(fd, kind, &reqs[i], 0) != 0)
+            result = -1;
+    return result;
+}
@@ -0,0 +1,136 @@
+/*
+ *  aio_bench.c
+ *
+ *  Compares the batched page reads of the buffer pool at several
+ *  queue depths: synchronous pread, then io_uring keeping 1, 8 and 32
+ *  reads in flight.  Random pages of a scratch file are read in
+ *  batches, with O_DIRECT when the file system allows it so that the
+ *  device and not the page cache is measured.  The scratch file is
+ *  removed at the end.
+ *
+ *  usage: aio_bench [file [megabytes [reads]]]
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <time.h>
+#include "bpt.h"
+
+// Number of pages requested per batch.
+#define BENCH_BATCH 256
+
+static double now( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Fills the file up to num_pages pages.
+ */
+static void prepare( const char * path, int64_t num_pages ) {
+    struct stat st;
+    char * page;
+    int64_t i;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror("Benchmark file.");
+        exit(EXIT_FAILURE);
+    }
+    page = (char *) malloc(PAGE_SIZE);
+    if (page == NULL) {
+        perror("Benchmark page.");
+        exit(EXIT_FAILURE);
+    }
+    for (i = st.st_size / PAGE_SIZE; i < num_pages; i++) {
+        memset(page, (int)i, PAGE_SIZE);
+        if (pwrite(fd, page, PAGE_SIZE, i * PAGE_SIZE) != PAGE_SIZE) {
+            perror("Benchmark file.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    fsync(fd);
+    close(fd);
+    free(page);
+}
+
+/* Reads num_reads random pages in batches through one context
+ * and prints the throughput and the mean latency of a batch.
+ */
+static void run( const char * name, aio * ctx, int fd, char * buffers,
+        int64_t num_pages, int64_t num_reads ) {
+    aio_req reqs[BENCH_BATCH];
+    unsigned seed = 7;
+    double start, elapsed;
+    int64_t done;
+    int i;
+
+    start = now();
+    for (done = 0; done < num_reads; done += BENCH_BATCH) {
+        for (i = 0; i < BENCH_BATCH; i++) {
+            reqs[i].buf = buffers + (size_t)i * PAGE_SIZE;
+            reqs[i].offset = (int64_t)(rand_r(&seed) % num_pages) * PAGE_SIZE;
+            reqs[i].len = PAGE_SIZE;
+        }
+        if (aio_submit(ctx, fd, AIO_READ, reqs, BENCH_BATCH) != 0) {
+            perror("Benchmark read.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    elapsed = now() - start;
+
+    printf("%-12s %10.0f pages/s %10.1f us/batch\n", name,
+            done / elapsed, elapsed * 1e6 / (done / BENCH_BATCH));
+}
+
+int main( int argc, char ** argv ) {
+    const char * path = argc > 1 ? argv[1] : "aio_bench.db";
+    int64_t num_pages = (argc > 2 ? atoll(argv[2]) : 256) * 1024 * 1024 / PAGE_SIZE;
+    int64_t num_reads = argc > 3 ? atoll(argv[3]) : 65536;
+    int depths[] = { 1, 8, 32 };
+    char name[32], * buffers;
+    bool direct = true;
+    aio * ctx;
+    int fd, i;
+
+    if (num_pages <= 0 || num_reads <= 0) {
+        printf("usage: %s [file [megabytes [reads]]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    prepare(path, num_pages);
+
+    if ((fd = open(path, O_RDONLY | O_DIRECT)) < 0) {
+        direct = false;
+        fd = open(path, O_RDONLY);
+    }
+    if (fd < 0 || posix_memalign((void **)&buffers, PAGE_SIZE,
+                (size_t)BENCH_BATCH * PAGE_SIZE) != 0) {
+        perror("Benchmark setup.");
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+    printf("%ld random page reads over %ld pages, %d per batch%s\n",
+            num_reads, num_pages, BENCH_BATCH, direct ? ", O_DIRECT" : "");
+
+    ctx = aio_open(1, false);
+    run("sync", ctx, fd, buffers, num_pages, num_reads);
+    aio_close(ctx);
+
+    for (i = 0; i < 3; i++) {
+        ctx = aio_open(depths[i], true);
+        if (!ctx->uring) {
+            printf("io_uring is not available.\n");
+            aio_close(ctx);
+            break;
+        }
+        snprintf(name, sizeof(name), "uring qd%d", depths[i]);
+        run(name, ctx, fd, buffers, num_pages, num_reads);
+        aio_close(ctx);
+    }
+
+    free(buffers);
+    close(fd);
+    unlink(path);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,380 @@
+/*
+ *  alloc.c
+ *
+ *  Page allocator of the disk-based B+ tree.
+ *  Free pages are tracked in a bitmap in memory instead of a list
+ *  linked through the free pages, so taking or giving back a page
+ *  touches no page at all.  A page is taken after a given one where
+ *  it can be, so the sibling made by a split lies next to the node
+ *  split, and otherwise the lowest free page is taken.  When no page
+ *  is free, the file grows by an eighth, and the new blocks are
+ *  allocated at once by the file system, so they lie together on disk.
+ *  The map is saved at checkpoints as the runs of free pages.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "alloc.h"
+#include "wal.h"
+
+// UTILITIES
+
+static int pread_all( int fd, char * buf, size_t len, int64_t offset ) {
+    ssize_t n;
+    size_t done = 0;
+
+    while (done < len) {
+        n = pread(fd, buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+static int pwrite_all( int fd, const char * buf, size_t len, int64_t offset ) {
+    ssize_t n;
+    size_t done = 0;
+
+    while (done < len) {
+        n = pwrite(fd, buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+static bool is_free( space_map * sm, int64_t i ) {
+    return sm->free[i >> 6] >> (i & 63) & 1;
+}
+
+/* Makes room in the bitmap for num_pages pages.
+ */
+static void grow_bitmap( space_map * sm, int64_t num_pages ) {
+    int64_t words = (num_pages + 63) / 64, size;
+
+    if (words <= sm->words)
+        return;
+    size = sm->words * 2 > words ? sm->words * 2 : words;
+    sm->free = (uint64_t *) realloc(sm->free, size * sizeof(uint64_t));
+    if (sm->free == NULL) {
+        perror("Space map.");
+        exit(EXIT_FAILURE);
+    }
+    memset(sm->free + sm->words, 0, (size - sm->words) * sizeof(uint64_t));
+    sm->words = size;
+}
+
+static void mark( space_map * sm, int64_t start, int64_t n, bool free ) {
+    int64_t i;
+
+    for (i = start; i < start + n; i++) {
+        if (is_free(sm, i) == free)
+            continue;
+        sm->free[i >> 6] ^= (uint64_t)1 << (i & 63);
+        sm->num_free += free ? 1 : -1;
+    }
+    sm->dirty = true;
+}
+
+/* Makes every page of a file of num_pages pages used.
+ */
+static void clear( space_map * sm, int64_t num_pages ) {
+    grow_bitmap(sm, num_pages);
+    memset(sm->free, 0, sm->words * sizeof(uint64_t));
+    sm->num_pages = num_pages;
+    sm->num_free = 0;
+}
+
+/* Returns the first page from page number from on that is free,
+ * or used if free is not set, or num_pages if there is none.
+ */
+static int64_t find( space_map * sm, int64_t from, bool free ) {
+    int64_t w = from >> 6;
+    uint64_t bits;
+
+    if (from >= sm->num_pages)
+        return sm->num_pages;
+    bits = (free ? sm->free[w] : ~sm->free[w]) & (~(uint64_t)0 << (from & 63));
+    while (bits == 0) {
+        if (++w << 6 >= sm->num_pages)
+            return sm->num_pages;
+        bits = free ? sm->free[w] : ~sm->free[w];
+    }
+    w = (w << 6) + __builtin_ctzll(bits);
+    return w < sm->num_pages ? w : sm->num_pages;
+}
+
+/* Grows the file by an eighth, within the extent limits,
+ * and returns the number of the first new page.
+ */
+static int64_t grow_file( space_map * sm ) {
+    int64_t bytes = sm->num_pages * sm->page_size / 8, first = sm->num_pages, n;
+
+    if (bytes < SPACE_MIN_EXTENT)
+        bytes = SPACE_MIN_EXTENT;
+    if (bytes > SPACE_MAX_EXTENT)
+        bytes = SPACE_MAX_EXTENT;
+    n = bytes / sm->page_size > 0 ? bytes / sm->page_size : 1;
+
+    /* Failing to preallocate costs only the layout on disk:
+     * the pages are then allocated as they are written.
+     */
+    if (sm->preallocate)
+        fallocate(sm->data_fd, 0, first * sm->page_size, n * sm->page_size);
+    grow_bitmap(sm, first + n);
+    sm->num_pages = first + n;
+    mark(sm, first, n, true);
+    return first;
+}
+
+
+// SPACE MAP
+
+/* Opens the space map of a data file whose map is saved at path,
+ * with no page yet.  The map is then loaded or rebuilt.
+ * preallocate asks for the blocks of new pages to be allocated
+ * in the file system as the file grows.
+ * Returns NULL if the file of the map cannot be opened.
+ */
+space_map * space_open( const char * path, int data_fd, int page_size, bool preallocate ) {
+    space_map * sm;
+
+    sm = (space_map *) calloc(1, sizeof(space_map));
+    if (sm == NULL) {
+        perror("Space map creation.");
+        exit(EXIT_FAILURE);
+    }
+    sm->data_fd = data_fd;
+    sm->page_size = page_size;
+    sm->preallocate = preallocate;
+
+    sm->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (sm->fd < 0) {
+        space_close(sm);
+        return NULL;
+    }
+    return sm;
+}
+
+
+/* Closes the map.  Changes since the last sync are not kept.
+ */
+int space_close( space_map * sm ) {
+    int result = 0;
+
+    if (sm == NULL)
+        return 0;
+    if (sm->fd >= 0 && close(sm->fd) != 0)
+        result = -1;
+    free(sm->free);
+    free(sm);
+    return result;
+}
+
+
+/* Makes every page of a file of num_pages pages free
+ * but the header page, so the pages in use can be marked.
+ */
+void space_reset( space_map * sm, int64_t num_pages ) {
+    clear(sm, num_pages);
+    mark(sm, 1, num_pages - 1, true);
+    sm->hint = 1;
+}
+
+
+/* Loads the map saved by the last sync for a file of num_pages pages.
+ * Returns false if there is none, or it is damaged or not of that
+ * file, in which case the map must be rebuilt.
+ */
+bool space_load( space_map * sm, int64_t num_pages ) {
+    space_header header;
+    uint64_t * buf, * extents;
+    struct stat st;
+    size_t len;
+    uint64_t i;
+    bool valid;
+
+    if (fstat(sm->fd, &st) != 0 || st.st_size < (off_t)sizeof(header) ||
+            pread_all(sm->fd, (char *)&header, sizeof(header), 0) != 0 ||
+            header.magic != SPACE_MAGIC || header.page_size != (uint32_t)sm->page_size ||
+            header.num_pages != (uint64_t)num_pages ||
+            header.num_extents > (uint64_t)num_pages ||
+            st.st_size != (off_t)(sizeof(header) + header.num_extents * 2 * sizeof(uint64_t)))
+        return false;
+
+    len = st.st_size;
+    buf = (uint64_t *) malloc(len);
+    if (buf == NULL) {
+        perror("Space map.");
+        exit(EXIT_FAILURE);
+    }
+    valid = pread_all(sm->fd, (char *)buf, len, 0) == 0 &&
+        header.checksum == wal_checksum((char *)buf + sizeof(uint32_t),
+                len - sizeof(uint32_t));
+
+    clear(sm, num_pages);
+    extents = buf + sizeof(header) / sizeof(uint64_t);
+    for (i = 0; valid && i < header.num_extents; i++) {
+        if (extents[2 * i] < 1 || extents[2 * i + 1] > (uint64_t)num_pages ||
+                extents[2 * i] > (uint64_t)num_pages - extents[2 * i + 1])
+            valid = false;
+        else
+            mark(sm, extents[2 * i], extents[2 * i + 1], true);
+    }
+    free(buf);
+    sm->hint = find(sm, 1, true);
+    sm->dirty = false;
+    return valid;
+}
+
+
+/* Marks the page at offset page as in use.
+ * An offset outside the file is ignored.
+ */
+void space_use( space_map * sm, int64_t page ) {
+    if (page > 0 && page / sm->page_size < sm->num_pages)
+        mark(sm, page / sm->page_size, 1, false);
+}
+
+
+/* Takes a free page and returns its offset.  The first free page
+ * after the page at offset near is taken if there is one, and
+ * otherwise the lowest free page.  The file grows if none is free,
+ * so num_pages may change.
+ */
+int64_t space_alloc( space_map * sm, int64_t near ) {
+    int64_t i = sm->num_pages;
+
+    if (sm->num_free > 0 && near > 0)
+        i = find(sm, near / sm->page_size + 1, true);
+    if (i == sm->num_pages && sm->num_free > 0)
+        i = find(sm, sm->hint, true);
+    if (i == sm->num_pages)
+        i = grow_file(sm);
+
+    mark(sm, i, 1, false);
+    if (i == sm->hint)
+        sm->hint = find(sm, i + 1, true);
+    return i * sm->page_size;
+}
+
+
+/* Gives back the page at offset page.
+ */
+void space_free( space_map * sm, int64_t page ) {
+    int64_t i = page / sm->page_size;
+
+    mark(sm, i, 1, true);
+    if (i < sm->hint)
+        sm->hint = i;
+}
+
+
+/* Grows the map to a file of num_pages pages whose new pages
+ * are all in use, as when they were written past the end.
+ */
+void space_extend( space_map * sm, int64_t num_pages ) {
+    if (num_pages <= sm->num_pages)
+        return;
+    grow_bitmap(sm, num_pages);
+    sm->num_pages = num_pages;
+    sm->dirty = true;
+}
+
+
+/* Returns whether the page at offset page is free.
+ */
+bool space_is_free( space_map * sm, int64_t page ) {
+    int64_t i = page / sm->page_size;
+
+    return i > 0 && i < sm->num_pages && is_free(sm, i);
+}
+
+
+/* Returns the number of pages up to the last one in use,
+ * the size the file could be cut to.
+ */
+int64_t space_end( space_map * sm ) {
+    int64_t i;
+
+    for (i = sm->num_pages - 1; i > 0 && is_free(sm, i); i--)
+        ;
+    return i + 1;
+}
+
+
+/* Shrinks the map to a file of num_pages pages.
+ * The pages cut off must be free.
+ */
+void space_truncate( space_map * sm, int64_t num_pages ) {
+    if (num_pages >= sm->num_pages)
+        return;
+    mark(sm, num_pages, sm->num_pages - num_pages, false);
+    sm->num_pages = num_pages;
+    if (sm->hint > num_pages)
+        sm->hint = num_pages;
+}
+
+
+/* Saves the map if it has changed since the last sync,
+ * as the runs of free pages, and syncs it.
+ * The saved map is trusted only if no page changes after it, so the
+ * table saves it at a checkpoint, before the log is emptied.
+ * Returns 0, or -1 on error.
+ */
+int space_sync( space_map * sm ) {
+    space_header header;
+    uint64_t * buf;
+    int64_t start, end, n = 0, cap = 16;
+    size_t len;
+    int result = 0;
+
+    if (!sm->dirty)
+        return 0;
+
+    buf = (uint64_t *) malloc(sizeof(header) + cap * 2 * sizeof(uint64_t));
+    if (buf == NULL) {
+        perror("Space map.");
+        exit(EXIT_FAILURE);
+    }
+    for (start = find(sm, 1, true); start < sm->num_pages; start = find(sm, end, true)) {
+        end = find(sm, start, false);
+        if (n == cap) {
+            cap *= 2;
+            buf = (uint64_t *) realloc(buf, sizeof(header) + cap * 2 * sizeof(uint64_t));
+            if (buf == NULL) {
+                perror("Space map.");
+                exit(EXIT_FAILURE);
+            }
+        }
+        buf[sizeof(header) / sizeof(uint64_t) + 2 * n] = start;
+        buf[sizeof(header) / sizeof(uint64_t) + 2 * n + 1] = end - start;
+        n++;
+    }
+
+    len = sizeof(header) + n * 2 * sizeof(uint64_t);
+    memset(&header, 0, sizeof(header));
+    header.magic = SPACE_MAGIC;
+    header.page_size = sm->page_size;
+    header.num_pages = sm->num_pages;
+    header.num_extents = n;
+    memcpy(buf, &header, sizeof(header));
+    header.checksum = wal_checksum((char *)buf + sizeof(uint32_t), len - sizeof(uint32_t));
+    memcpy(buf, &header, sizeof(header));
+
+    if (pwrite_all(sm->fd, (char *)buf, len, 0) != 0 ||
+            ftruncate(sm->fd, len) != 0 || fdatasync(sm->fd) != 0)
+        result = -1;
+    else
+        sm->dirty = false;
+    free(buf);
+    return result;
+}
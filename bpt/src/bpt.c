@@ -1,8 +1,6 @@
 /*
  *  bpt.c  
  */
-#define OriginalVersion "1.14"
-#define Version "1.0"
 /*
  *  Disk-Based B+ Tree Implementation
  *  Copyright (C) 2017  Jeonghoon Lee  galeb716@daum.net
@@ -59,146 +57,422 @@
  *
  */
 
-#include "bpt.h"
+// O_DIRECT
+#define _GNU_SOURCE
+#include "tree.h"
 
-// GLOBALS.
+// FUNCTION DEFINITIONS.
+
+// FILE I/O
+
+/* Makes the first leaf of a new file.
+ */
+static void init_leaf( table * t, int64_t leaf ) {
+    set_is_leaf(t, leaf, 1);
+    set_leaf_empty(t, leaf);
+    set_right_sibling(t, leaf, 0);
+}
 
-/* The order determines the maximum and minimum
- * number of entries (keys and pointers) in any
- * node.  Every node has at most order - 1 keys and
- * at least (roughly speaking) half that number.
- * Every leaf has as many pointers to data as keys,
- * and every internal node has one more pointer
- * to a subtree than the number of keys.
- * This global variable is initialized to the
- * default value.
+
+/* Marks as in use the children of an internal node and their
+ * subtrees, the node being depth levels above the leaves.
+ * The leaves themselves are never read.
  */
-int order = INTERNAL_ORDER;
-int leaf_order = LEAF_ORDER;
+static void use_subtree( table * t, int64_t page, int depth ) {
+    internal_page_t * p;
+    int64_t * children;
+    buf_frame * f;
+    int i, n;
+
+    f = buf_get_page(t->pool, page);
+    p = (internal_page_t *)f->data;
+    n = p->num_keys + 1;
+    children = (int64_t *) malloc(n * sizeof(int64_t));
+    if (children == NULL) {
+        perror("Space map rebuild.");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < n; i++)
+        children[i] = node_child(p, i);
+    buf_put_page(t->pool, f);
+
+    for (i = 0; i < n; i++)
+        space_use(t->space, children[i]);
+    if (depth > 1) {
+        buf_prefetch(t->pool, children, n);
+        for (i = 0; i < n; i++)
+            use_subtree(t, children[i], depth - 1);
+    }
+    free(children);
+}
 
 
-/* The queue is used to print the tree in
- * level order, starting from the root
- * printing each entire rank on a separate
- * line, finishing with the leaves.
+/* Rebuilds the space map from the tree: every page
+ * the tree does not reach is free.
  */
-queue * q = NULL;
+static void rebuild_space( table * t ) {
+    int64_t root = get_root(t);
 
+    space_reset(t->space, get_num_pages(t));
+    if (root == 0)
+        return;
+    space_use(t->space, root);
+    if (!get_is_leaf(t, root))
+        use_subtree(t, root, height(t));
+}
 
-// FUNCTION DEFINITIONS.
 
-// FILE I/O
+// CONCURRENCY
 
-/* Open file to read and write data.
+/* Readers descend the tree with latch crabbing on shared latches.
+ * Writers first try to latch only the leaf exclusively, which is
+ * enough when the leaf does not split or underflow.  Otherwise they
+ * latch the header page and the path from the root exclusively,
+ * dropping the latches above every node that is safe.  Changes
+ * that split or merge nodes therefore run one at a time per table,
+ * and each operation keeps its exclusive latches until its log
+ * record is appended.
  */
-int open_db( char * pathname ) {
-    if ((data_file = fopen(pathname, "r+")) != NULL) {
-        return 0;
+
+/* Type of the pages latched exclusively by the operation
+ * in progress on a thread, in the order they were latched.
+ */
+typedef struct op_latches {
+    buf_frame ** frames;
+    int num_frames;
+    int capacity;
+} op_latches;
+
+static __thread op_latches held = { NULL, 0, 0 };
+
+/* The path from the root to the leaf latched by latch_path for the
+ * operation in progress on a thread.  Nodes keep no pointer to their
+ * parent: a split or merge finds the parent of a node on this path.
+ */
+static __thread tree_path op_path;
+
+/* Pins and latches a node whose parent the caller holds.
+ * A leaf is latched exclusively if asked, and everything
+ * else shared.  The parent keeps a leaf from splitting or
+ * merging while its latch is upgraded.
+ */
+static buf_frame * latch_child( table * t, int64_t page, bool exclusive ) {
+    buf_frame * f = buf_get_page(t->pool, page);
+
+    pthread_rwlock_rdlock(&f->latch);
+    if (exclusive && ((leaf_page_t *)f->data)->is_leaf) {
+        pthread_rwlock_unlock(&f->latch);
+        pthread_rwlock_wrlock(&f->latch);
     }
+    return f;
+}
 
-    if ((data_file = fopen(pathname, "w+")) == NULL) {
-        return -1;
+/* Returns whether a change below a node that is not the root
+ * cannot reach its parent: the node does not split on insertion
+ * and does not underflow on deletion.  A leaf is judged by the
+ * largest record it could gain or lose.
+ */
+static bool is_safe( const leaf_page_t * n, bool deleting ) {
+    if (n->is_leaf)
+        return leaf_is_safe(n, MAX_VALUE_SIZE, deleting);
+    return node_is_safe((const internal_page_t *)n, deleting);
+}
+
+
+/* Starts a write operation on a table.
+ * Write operations share the table, and a checkpoint
+ * waits for every one in progress.
+ */
+void begin_op( table * t ) {
+    pthread_rwlock_rdlock(&t->op_lock);
+    op_path.depth = 0;
+}
+
+
+/* Adds a frame pinned and latched exclusively by the caller
+ * to the operation in progress, which releases it at the end.
+ */
+void hold_latch( buf_frame * f ) {
+    if (held.num_frames == held.capacity) {
+        held.capacity = held.capacity == 0 ? 16 : held.capacity * 2;
+        held.frames = (buf_frame **) realloc(held.frames,
+                held.capacity * sizeof(buf_frame *));
+        if (held.frames == NULL) {
+            perror("Latched pages.");
+            exit(EXIT_FAILURE);
+        }
     }
+    held.frames[held.num_frames++] = f;
+}
 
-    set_free_page(0x2000);
-    set_root(0x1000);
-    
-    set_num_pages(NEW_PAGE);
 
-/* Initializing first leaf page.
- * Parent page offset is 0, is_leaf bit is on, number keys is 0.
- * Offset of right sibling is 0.
+/* Latches a page exclusively for the operation in progress.
+ * A page the operation holds already is not latched again.
+ * Returns the frame, which stays pinned until the operation ends.
  */
-    set_parent_page(0x1000, 0);
-    set_is_leaf(0x1000, 1);
-    set_num_keys(0x1000, 0);
-    set_right_sibling(0x1000, 0);
+buf_frame * latch_page( table * t, int64_t page ) {
+    buf_frame * f;
+    int i;
 
-/* Initializing free pages.
- * The link is created to point the next free page.
+    for (i = held.num_frames - 1; i >= 0; i--)
+        if (held.frames[i]->page == page)
+            return held.frames[i];
+
+    f = buf_get_page(t->pool, page);
+    pthread_rwlock_wrlock(&f->latch);
+    hold_latch(f);
+    return f;
+}
+
+
+/* Commits the changes of the operation in progress to the log and
+ * releases its latches, without waiting for the log to be synced.
+ * Returns the LSN of the commit.
  */
-    int64_t off_value = 0x3000;
-    fseek(data_file, 0x2000, SEEK_SET);
-    for (; ftell(data_file) < 0x4000; off_value += 0x1000) {
-        fwrite(&off_value, sizeof(int64_t), 1, data_file);
-        fseek(data_file, 0x0ff8, SEEK_CUR);
+static uint64_t commit_op( table * t ) {
+    uint64_t lsn;
+    int i;
+
+    lsn = buf_commit(t->pool);
+    for (i = 0; i < held.num_frames; i++)
+        unlatch(t, held.frames[i]);
+    held.num_frames = 0;
+    pthread_rwlock_unlock(&t->op_lock);
+
+    return lsn;
+}
+
+/* Takes a checkpoint when the log has grown large.
+ */
+static int checkpoint_if_full( table * t ) {
+    int result = 0;
+
+    if (wal_size(t->log) >= WAL_CHECKPOINT_SIZE) {
+        pthread_rwlock_wrlock(&t->op_lock);
+        if (wal_size(t->log) >= WAL_CHECKPOINT_SIZE &&
+                checkpoint(t) != 0)
+            result = -1;
+        pthread_rwlock_unlock(&t->op_lock);
     }
-    off_value = 0;
-    fwrite(&off_value, sizeof(int64_t), 1, data_file);
+    return result;
+}
 
-    fd = fileno(data_file);
-    fdatasync(fd);
 
-    return 0;
+/* Ends the operation in progress: its changes are committed to the
+ * log, its latches released, and then the commit is made as durable
+ * as the table asks.  Waiting after the latches are released lets
+ * the operations that wanted them share the same log sync.
+ * A checkpoint is taken when the log has grown large.
+ */
+int end_op( table * t ) {
+    int result;
+
+    result = wal_commit(t->log, commit_op(t));
+    if (checkpoint_if_full(t) != 0)
+        result = -1;
+
+    return result;
 }
 
-// OUTPUT AND UTILITIES
 
-/* Copyright and license notice to user at startup. 
+/* Latches exclusively the header page and the path from the root
+ * to the leaf that may hold key, for an insertion that splits or a
+ * deletion that merges.  Holding the header page keeps such changes
+ * one at a time, and lets them allocate and free pages and move the
+ * root.  On the way down, the latches above a safe node are released.
+ * The path is kept for the change to find the parent of each node on.
+ * Returns the leaf, or 0 if the tree is empty.
+ */
+int64_t latch_path( table * t, tree_key key, bool deleting ) {
+    buf_frame * f;
+    internal_page_t * p;
+    int64_t c;
+    int i;
+
+    latch_page(t, 0);
+    op_path.depth = 0;
+    c = get_root(t);
+    if (c == 0)
+        return 0;
+
+    f = latch_page(t, c);
+    op_path.pages[op_path.depth++] = c;
+    while (!((leaf_page_t *)f->data)->is_leaf) {
+        p = (internal_page_t *)f->data;
+        i = search_internal(p, key);
+        c = node_child(p, i);
+        f = latch_page(t, c);
+        op_path.index[op_path.depth - 1] = i;
+        op_path.pages[op_path.depth++] = c;
+
+        // Keep the header page and the new node only.
+        if (is_safe((leaf_page_t *)f->data, deleting)) {
+            for (i = 1; i < held.num_frames - 1; i++)
+                unlatch(t, held.frames[i]);
+            held.frames[1] = f;
+            held.num_frames = 2;
+        }
+    }
+
+    return c;
+}
+
+
+/* Returns the level of a node on the path latched by the operation
+ * in progress, the root being at level 0.
  */
-void license_notice( void ) {
-    printf("Disk-Based B+ Tree Version %s\n"
-            "\t-- Copyright (C) 2017  Jeonghoon Lee  galeb716@daum.net\n"
-            "Copyright and license information of the original code is "
-            "described below.\n", Version);
-    printf("=================================================================="
-            "==============\n");
-    printf("bpt version %s -- Copyright (C) 2010  Amittai Aviram "
-            "http://www.amittai.com\n", OriginalVersion);
-    printf("This program comes with ABSOLUTELY NO WARRANTY.\n"
-            "This is free software, and you are welcome to redistribute it\n"
-            "under certain conditions.\n");
-    printf("=================================================================="
-            "==============\n\n");
+static int path_level( int64_t n ) {
+    int i;
+
+    for (i = op_path.depth - 1; i >= 0; i--)
+        if (op_path.pages[i] == n)
+            return i;
+
+    // Error state.
+    printf("Search for node not on the latched path.\n");
+    printf("Node:  #%ld\n", (long)n);
+    exit(EXIT_FAILURE);
 }
 
 
-/* First message to the user.
+/* Returns the parent of a node on the path latched by the operation
+ * in progress, or 0 for the root.
  */
-void usage_1( void ) {
-    printf("B+ Tree of Internal Order %d and Leaf Order %d.\n", order, leaf_order);
-    printf("To start with input from a file of newline-delimited integers, \n"
-           "start again and enter the input filename after the data filename:\n"
-           "%% bpt <datafile> <inputfile>.\n");
+int64_t get_parent( int64_t n ) {
+    int level = path_level(n);
+
+    return level == 0 ? 0 : op_path.pages[level - 1];
 }
 
+// READAHEAD
+
+/* A scan that has stepped along the leaf chain a few times asks the
+ * buffer pool for the next leaves in one batch, before it reaches
+ * them.  The leaves are found through the level above them rather
+ * than the sibling links, so a whole window is known at once.
+ * Readahead is only a hint: it latches nothing it would wait for,
+ * and gives up for now when a writer holds a page on its way.
+ */
 
-/* Second message to the user.
+/* Pins and latches a page shared if no writer holds it.
+ * Returns NULL otherwise.
  */
-void usage_2( void ) {
-    printf("Enter any of the following commands after the prompt > :\n"
-    "\to <k>  -- Open existing data file <k> or create one if not existed.\n"
-    "\ti <k1> <k2> -- Insert <k1> (an integer) as key and <k2> (a string) as value).\n"
-    "\tf <k>  -- Find the value under key <k>.\n"
-    "\tp <k>  -- Print the path from the root to key <k> and its associated "
-           "value.\n"
-    //"\tr <k1> <k2> -- Print the keys and values found in the range "
-    //        "[<k1>, <k2>\n"
-    "\td <k>  -- Delete key <k> and its associated value.\n"
-    //"\tx -- Destroy the whole tree.  Start again with an empty tree of the "
-    //       "same order.\n"
-    "\tt -- Print the B+ tree.\n"
-    "\tl -- Print the keys of the leaves (bottom row of the tree).\n"
-    "\tq -- Quit. (Or use Ctl-D.)\n"
-    "\t? -- Print this help message.\n");
+static buf_frame * try_latch( table * t, int64_t page ) {
+    buf_frame * f = buf_get_page(t->pool, page);
+
+    if (pthread_rwlock_tryrdlock(&f->latch) == 0)
+        return f;
+    buf_put_page(t->pool, f);
+    return NULL;
 }
 
+/* Collects into pages the leaves that follow the leaf holding key,
+ * at most READAHEAD_PAGES of them, in key order.
+ * ra->next_key is set to the smallest key of the last leaf collected,
+ * and ra->done once the rightmost leaf has been collected.
+ * Returns the number of leaves collected.
+ */
+static int next_leaves( table * t, read_ahead * ra, tree_key key, int64_t pages[] ) {
+    buf_frame * header, * f, * child;
+    internal_page_t * p;
+    bool first = true, has_high, full;
+    int64_t c;
+    tree_key high = 0;
+    int i, j, n = 0;
+
+    while (n < READAHEAD_PAGES) {
+        header = buf_get_page(t->pool, 0);
+        c = load_root(header);
+        buf_put_page(t->pool, header);
+        if (c == 0 || (f = try_latch(t, c)) == NULL)
+            return n;
+        if (((leaf_page_t *)f->data)->is_leaf) {
+            unlatch(t, f);
+            ra->done = true;
+            return n;
+        }
+
+        // Descend to the parent of the leaf, keeping the key bounding it.
+        has_high = false;
+        while (true) {
+            p = (internal_page_t *)f->data;
+            i = search_internal(p, key);
+            c = node_child(p, i);
+            if ((child = try_latch(t, c)) == NULL) {
+                unlatch(t, f);
+                return n;
+            }
+            if (((leaf_page_t *)child->data)->is_leaf) {
+                unlatch(t, child);
+                break;
+            }
+            if (i < p->num_keys) {
+                high = node_key(p, i);
+                has_high = true;
+            }
+            unlatch(t, f);
+            f = child;
+        }
+
+        // The leaf holding key itself is wanted only after the first parent.
+        for (j = first ? i + 1 : i; j <= p->num_keys && n < READAHEAD_PAGES; j++) {
+            pages[n++] = node_child(p, j);
+            ra->next_key = KEY_OUT(j == 0 ? key : node_key(p, j - 1));
+        }
+        full = j <= p->num_keys;
+        unlatch(t, f);
+
+        if (full)
+            break;
+        if (!has_high) {
+            ra->done = true;
+            break;
+        }
+        key = high;
+        first = false;
+    }
+
+    return n;
+}
+
+/* Notes that a scan is about to leave a leaf, and reads the next
+ * leaves ahead once the scan has gone past a couple of them and
+ * fewer than half a window remain read ahead.
+ */
+static void read_ahead_step( table * t, read_ahead * ra, const leaf_page_t * leaf ) {
+    int64_t pages[READAHEAD_PAGES];
+    int n;
+
+    ra->steps++;
+    if (ra->left > 0)
+        ra->left--;
+    if (ra->done || ra->steps < 2 || ra->left > READAHEAD_PAGES / 2)
+        return;
+    if (ra->left == 0 && leaf->num_keys == 0)
+        return;
+
+    n = next_leaves(t, ra, ra->left == 0 ? leaf_key(leaf, 0) : KEY_IN(ra->next_key), pages);
+    ra->left += n;
+    buf_prefetch(t->pool, pages, n);
+}
+
+// OUTPUT AND UTILITIES
 
 /* Helper function for printing the
  * tree out.  See print_tree.
  * Enqueue new node at the 
  */
-void enqueue( int64_t new_node ) {
+void enqueue( queue ** q, int64_t new_node ) {
     queue * c, * d;
     c = (queue *) malloc(sizeof(queue));
-    if (q == NULL) {
-        q = c;
-        q->page = new_node;
-        q->next = NULL;
+    if (*q == NULL) {
+        *q = c;
+        (*q)->page = new_node;
+        (*q)->next = NULL;
         
     }
     else {
-        d = q;
+        d = *q;
         while(d->next != NULL) {
             d = d->next;
         }
@@ -212,10 +486,10 @@ void enqueue( int64_t new_node ) {
 /* Helper function for printing the
  * tree out.  See print_tree.
  */
-int64_t dequeue( void ) {
-    queue * n = q;
+int64_t dequeue( queue ** q ) {
+    queue * n = *q;
     int64_t ret;
-    q = q->next;
+    *q = (*q)->next;
     ret = n->page;
     free(n);
     return ret;
@@ -225,30 +499,43 @@ int64_t dequeue( void ) {
 /* Prints the bottom row of keys
  * of the tree (with their respective
  * pointers, if the verbose_output flag is set.
+ * The leaves are read ahead as the row is printed.
+ * Write operations on the table wait until it is printed.
  */
-void print_leaves( void ) {
+static void tree_print_leaves( table * t ) {
     int i;
-    int64_t c = get_root();
+    char text[KEY_TEXT_SIZE];
+    int64_t c;
+    buf_frame * f;
+    read_ahead ra;
 
+    pthread_rwlock_wrlock(&t->op_lock);
+    c = get_root(t);
     if (c == 0) {
         printf("Empty tree.\n");
+        pthread_rwlock_unlock(&t->op_lock);
         return;
     }
-    while (!get_is_leaf(c))
-        c = get_internal_value_at(c, 0);
+    while (!get_is_leaf(t, c))
+        c = get_internal_value_at(t, c, 0);
+    memset(&ra, 0, sizeof(read_ahead));
     while (true) {
-        for (i = 0; i < get_num_keys(c); i++)
-            printf("%ld ", get_leaf_key_at(c, i));
+        for (i = 0; i < get_num_keys(t, c); i++)
+            printf("%s ", key_format(KEY_TYPE, KEY_OUT(get_leaf_key_at(t, c, i)), text));
 
         // move to the right sibling if it exists
-        if (get_right_sibling(c) != 0) {
+        if (get_right_sibling(t, c) != 0) {
             printf("| ");
-            c = get_right_sibling(c);
+            f = buf_get_page(t->pool, c);
+            read_ahead_step(t, &ra, (leaf_page_t *)f->data);
+            buf_put_page(t->pool, f);
+            c = get_right_sibling(t, c);
         }
         else
             break;
     }
     printf("\n");
+    pthread_rwlock_unlock(&t->op_lock);
 }
 
 
@@ -256,31 +543,17 @@ void print_leaves( void ) {
  * of the tree, which length in number of edges
  * of the path from the root to any leaf.
  */
-int height( void ) {
+int height( table * t ) {
     int h = 0;
-    int64_t c = get_root();
-    while (!get_is_leaf(c)) {
-        c = get_internal_value_at(c, 0);
+    int64_t c = get_root(t);
+    while (!get_is_leaf(t, c)) {
+        c = get_internal_value_at(t, c, 0);
         h++;
     }
     return h;
 }
 
 
-/* Utility function to give the length in edges
- * of the path from any node to the root.
- */
-int path_to_root( int64_t child ) {
-    int length = 0;
-    int64_t c = child;
-    while (c != get_root()) {
-        c = get_parent_page(c);
-        length++;
-    }
-    return length;
-}
-
-
 /* Prints the B+ tree in the command
  * line in level (rank) order, with the 
  * keys in each node and the '|' symbol
@@ -289,162 +562,453 @@ int path_to_root( int64_t child ) {
  * the values of the pointers corresponding
  * to the keys also appear next to their respective
  * keys, in hexadecimal notation.
+ * Write operations on the table wait until it is printed.
  */
-void print_tree( void ) {
+static void tree_print_tree( table * t ) {
 
     int64_t n = 0;
     int i = 0;
-    int rank = 0;
-    int new_rank = 0;
-    int64_t root;
+    int64_t root, leftmost;
+    char text[KEY_TEXT_SIZE];
+    queue * q;
 
-    root = get_root();
+    pthread_rwlock_wrlock(&t->op_lock);
+    root = get_root(t);
 
     if (root == 0) {
         printf("Empty tree.\n");
+        pthread_rwlock_unlock(&t->op_lock);
         return;
     }
     q = NULL;
-    enqueue(root);
+    enqueue(&q, root);
+    leftmost = get_is_leaf(t, root) ? 0 : get_internal_value_at(t, root, 0);
     while( q != NULL ) {
-        n = dequeue();
-        // not root & is the left most sibling
-        if (get_parent_page(n) != 0 && n == get_internal_value_at(get_parent_page(n), 0)) {
-            new_rank = path_to_root(n);
-            if (new_rank != rank) {
-                rank = new_rank;
-                printf("\n");
-            }
+        n = dequeue(&q);
+        // the leftmost node of each level below the root starts a line
+        if (n == leftmost) {
+            leftmost = get_is_leaf(t, n) ? 0 : get_internal_value_at(t, n, 0);
+            printf("\n");
         }
-        for (i = 0; i < get_num_keys(n); i++) {
-            if (get_is_leaf(n))
-                printf("%ld ", get_leaf_key_at(n, i));
+        for (i = 0; i < get_num_keys(t, n); i++) {
+            if (get_is_leaf(t, n))
+                printf("%s ", key_format(KEY_TYPE, KEY_OUT(get_leaf_key_at(t, n, i)), text));
             else 
-                printf("%ld ", get_internal_key_at(n, i));
+                printf("%s ", key_format(KEY_TYPE, KEY_OUT(get_internal_key_at(t, n, i)), text));
         }
-        if (!get_is_leaf(n))
-            for (i = 0; i <= get_num_keys(n); i++)
-                enqueue(get_internal_value_at(n, i));
+        if (!get_is_leaf(t, n))
+            for (i = 0; i <= get_num_keys(t, n); i++)
+                enqueue(&q, get_internal_value_at(t, n, i));
 
         printf("| ");
     }
     printf("\n");
+    pthread_rwlock_unlock(&t->op_lock);
 }
 
 
-/* Finds the record under a given key and prints an
- * appropriate message to stdout.
+/* Pins and latches the root as latch_child does.
+ * Returns NULL if the tree is empty.
  */
-void find_and_print(int64_t key) {
+static buf_frame * latch_root( table * t, bool exclusive ) {
+    buf_frame * header, * f;
+    int64_t c;
+
+    header = buf_get_page(t->pool, 0);
+
+    // The root may split or shrink before it is latched.
+    do {
+        c = load_root(header);
+        if (c == 0) {
+            buf_put_page(t->pool, header);
+            return NULL;
+        }
+        f = latch_child(t, c, exclusive);
+        if (c == load_root(header))
+            break;
+        unlatch(t, f);
+    } while (true);
+    buf_put_page(t->pool, header);
 
-    char * r = find(key);
-    if (r == NULL)
-        printf("Record not found under key %ld.\n", key);
-    else
-        printf("Record -- key %ld, value %s.\n", key, r);
+    return f;
+}
+
+
+/* Same as find_leaf.  If high is not NULL, it is also set to
+ * the smallest key that the leaves right of the leaf may hold,
+ * and has_high cleared if the leaf is the rightmost.  While the
+ * leaf stays latched, it holds no key at or above high.
+ */
+static buf_frame * find_leaf_bounded( table * t, tree_key key, bool exclusive,
+        tree_key * high, bool * has_high ) {
+    int i = 0;
+    buf_frame * f, * child;
+    internal_page_t * p;
+    int64_t c;
+
+    if (has_high != NULL)
+        *has_high = false;
+
+    if ((f = latch_root(t, exclusive)) == NULL)
+        return NULL;
+
+    while (!((leaf_page_t *)f->data)->is_leaf) {
+        p = (internal_page_t *)f->data;
+        i = search_internal(p, key);
+        c = node_child(p, i);
+        if (high != NULL && i < p->num_keys) {
+            *high = node_key(p, i);
+            *has_high = true;
+        }
+        child = latch_child(t, c, exclusive);
+        unlatch(t, f);
+        f = child;
+    }
 
-    free(r);
+    return f;
 }
 
-// DO NOT NEED TO IMPLEMENT
 
-/* Finds and prints the keys, pointers, and values within a range
- * of keys between key_start and key_end, including both bounds.
+/* Traces the path from the root to a leaf, searching
+ * by key, with latch crabbing: each child is latched
+ * before the latch on its parent is released.
+ * Internal pages are latched shared, and the leaf
+ * exclusively if asked and shared otherwise.
+ * Returns the leaf containing the given key, pinned
+ * and latched, or NULL if the tree is empty.
+ */
+buf_frame * find_leaf( table * t, tree_key key, bool exclusive ) {
+    return find_leaf_bounded(t, key, exclusive, NULL, NULL);
+}
+
 
-void find_and_print_range( node * root, int key_start, int key_end,
-        bool verbose ) {
+/* Finds the value under a key and leaves it in place: the leaf
+ * holding it stays pinned and latched shared, and view->value points
+ * into the page, until release_view.  Writers of the leaf wait until
+ * then, so the thread must not write the table in the meantime.
+ * view->table is the table, and the rest of the view is cleared.
+ * Returns the value, or NULL if the key is not found, in which case
+ * nothing is held.
+ */
+static const char * tree_find_view( bpt_view * view, bpt_key key ) {
     int i;
-    int array_size = key_end - key_start + 1;
-    int returned_keys[array_size];
-    void * returned_pointers[array_size];
-    int num_found = find_range( root, key_start, key_end, verbose,
-            returned_keys, returned_pointers );
-    if (!num_found)
-        printf("None found.\n");
-    else {
-        for (i = 0; i < num_found; i++)
-            printf("Key: %d   Location: %lx  Value: %s\n",
-                    returned_keys[i],
-                    (unsigned long)returned_pointers[i],
-                    ((record *)
-                     returned_pointers[i])->value);
+    leaf_page_t * leaf;
+    tree_key k = KEY_IN(key);
+
+    if (!KEY_FITS(key))
+        return NULL;
+    view->frame = find_leaf(view->table, k, false);
+    if (view->frame == NULL)
+        return NULL;
+
+    leaf = (leaf_page_t *)view->frame->data;
+    i = search_leaf(leaf, k);
+    if (i == leaf->num_keys || leaf_key(leaf, i) != k) {
+        release_view(view);
+        return NULL;
     }
+    view->value = leaf_value(leaf, i);
+    view->length = leaf_length(leaf, i);
+
+    return view->value;
 }
-*/
 
-// DO NOT NEED TO IMPLEMENT
-
-/* Finds keys and their pointers, if present, in the range specified
- * by key_start and key_end, inclusive.  Places these in the arrays
- * returned_keys and returned_pointers, and returns the number of
- * entries found.
-
-int find_range( node * root, int key_start, int key_end, bool verbose,
-        int returned_keys[], void * returned_pointers[]) {
-    int i, num_found;
-    num_found = 0;
-    node * n = find_leaf( root, key_start, verbose );
-    if (n == NULL) return 0;
-    for (i = 0; i < n->num_keys && n->keys[i] < key_start; i++) ;
-    if (i == n->num_keys) return 0;
-    while (n != NULL) {
-        for ( ; i < n->num_keys && n->keys[i] <= key_end; i++) {
-            returned_keys[num_found] = n->keys[i];
-            returned_pointers[num_found] = n->pointers[i];
-            num_found++;
+
+// MULTI-GET
+
+static int compare_probes( const void * a, const void * b ) {
+    bpt_key x = **(const bpt_key * const *)a;
+    bpt_key y = **(const bpt_key * const *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Looks up n probes, pointers into keys sorted by the keys they
+ * point to, in the subtree of a node latched shared.
+ * The probes are split among the children they lead to, and each
+ * child is visited once for all of its probes.  The children of a
+ * node are first read in one batch, through pages, which has room
+ * for n of them.
+ * Returns the number of probes found.
+ */
+static int find_below( table * t, buf_frame * f, const bpt_key * probes[], int n,
+        const bpt_key keys[], char values[][VALUE_SIZE], int lengths[], int64_t pages[] ) {
+    leaf_page_t * leaf = (leaf_page_t *)f->data;
+    internal_page_t * p = (internal_page_t *)f->data;
+    buf_frame * child;
+    tree_key high;
+    int64_t c;
+    int i, j, k, e, m, count = 0;
+
+    if (leaf->is_leaf) {
+        for (k = 0; k < n; k++) {
+            i = search_leaf(leaf, KEY_IN(*probes[k]));
+            if (i < leaf->num_keys && leaf_key(leaf, i) == KEY_IN(*probes[k])) {
+                j = probes[k] - keys;
+                lengths[j] = snprintf(values[j], VALUE_SIZE, "%s", leaf_value(leaf, i));
+                count++;
+            }
+        }
+        return count;
+    }
+
+    for (k = 0, m = 0; k < n; k++) {
+        c = node_child(p, search_internal(p, KEY_IN(*probes[k])));
+        if (m == 0 || pages[m - 1] != c)
+            pages[m++] = c;
+    }
+    if (m > 1)
+        buf_prefetch(t->pool, pages, m);
+
+    for (k = 0; k < n; k = e) {
+        i = search_internal(p, KEY_IN(*probes[k]));
+        e = k + 1;
+        if (i < p->num_keys) {
+            high = node_key(p, i);
+            while (e < n && KEY_IN(*probes[e]) < high)
+                e++;
         }
-        n = n->pointers[leaf_order - 1];
-        i = 0;
+        else
+            e = n;
+        child = latch_child(t, node_child(p, i), false);
+        count += find_below(t, child, probes + k, e - k, keys, values, lengths, pages);
+        unlatch(t, child);
     }
-    return num_found;
+
+    return count;
 }
-*/
 
-/* Traces the path from the root to a leaf, searching
- * by key.  Displays information about the path
- * if the verbose flag is set.
- * Returns the leaf containing the given key.
+
+/* Looks up num_keys keys at once.  The keys are sorted and the tree
+ * is descended once for all of them, so every node on the way is
+ * visited once however many keys lead through it, and the pages
+ * of each level are read in batches.  The keys need not be sorted
+ * or distinct.
+ * For each key found, its value is copied into values[i], cut to
+ * fit and ended with a null as find_into does, and lengths[i] is set
+ * to the length of the whole value without its null, so the value
+ * was cut if it is VALUE_SIZE or more.  lengths[i] is -1 for the
+ * others.  Nothing is allocated for a key.
+ * Returns the number of keys found.
  */
-int64_t find_leaf( int64_t key ) {
-    int i = 0;
+static int tree_find_many( table * t, const bpt_key keys[], int num_keys,
+        char values[][VALUE_SIZE], int lengths[] ) {
+    const bpt_key ** probes;
+    int64_t * pages;
+    buf_frame * root;
+    int i, n = 0, count = 0;
+
+    if (num_keys <= 0)
+        return 0;
 
-    int64_t c = get_root();
-    if (c == 0) {
-        printf("Empty tree.\n");
-        return c;
+    probes = (const bpt_key **) malloc(num_keys * sizeof(bpt_key *));
+    pages = (int64_t *) malloc(num_keys * sizeof(int64_t));
+    if (probes == NULL || pages == NULL) {
+        perror("Multi-get probes.");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < num_keys; i++) {
+        if (KEY_FITS(keys[i]))
+            probes[n++] = &keys[i];
+        lengths[i] = -1;
+    }
+    qsort(probes, n, sizeof(bpt_key *), compare_probes);
+
+    if (n > 0 && (root = latch_root(t, false)) != NULL) {
+        count = find_below(t, root, probes, n, keys, values, lengths, pages);
+        unlatch(t, root);
     }
 
-    while (!get_is_leaf(c)) {
+    free(pages);
+    free(probes);
+    return count;
+}
+
+// RANGE SCAN
+
+static char * find_leaf_at( bpt_snapshot * snapshot, tree_key key );
+
+/* Positions a new cursor at the first key greater than
+ * or equal to lower_bound.
+ * The tree is descended once; the cursor then follows the
+ * right sibling links of the leaves.
+ * The current leaf stays latched shared, so writers of that
+ * leaf wait until the cursor moves on or is closed.
+ * A cursor over a snapshot holds no latch between calls
+ * instead, so a long scan does not keep writers waiting.
+ */
+static void tree_cursor_seek( bpt_cursor * cursor, bpt_key lower_bound ) {
+    tree_key key;
+
+    // No key of the tree is at or above the bound.
+    if (lower_bound > KEY_OUT(KEY_MAX))
+        return;
+    key = KEY_AT_LEAST(lower_bound);
 
-        i = 0;
-        while (i < get_num_keys(c)) {
-            if (key >= get_internal_key_at(c, i)) i++;
-            else break;
+    if (cursor->snapshot != NULL) {
+        cursor->page = find_leaf_at(cursor->snapshot, key);
+        if (cursor->page != NULL)
+            cursor->index = search_leaf((leaf_page_t *)cursor->page, key);
+        return;
+    }
+    cursor->frame = find_leaf(cursor->table, key, false);
+    if (cursor->frame != NULL)
+        cursor->index = search_leaf((leaf_page_t *)cursor->frame->data, key);
+}
+
+
+/* Moves a cursor at the end of its leaf to the right sibling,
+ * reading the leaves after it ahead once the scan goes on.
+ * Latches are taken from left to right here but from right to left
+ * by a merge, so the cursor only tries the latch of the sibling.
+ * If a writer holds it, the cursor lets go of its leaf and
+ * descends again to the first key after the last one it passed.
+ */
+static void cursor_step( bpt_cursor * cursor ) {
+    table * t = cursor->table;
+    leaf_page_t * leaf;
+    buf_frame * next;
+    tree_key last;
+
+    // A snapshot sees the sibling links as they were.
+    if (cursor->snapshot != NULL) {
+        leaf = (leaf_page_t *)cursor->page;
+        if (leaf->right_sibling != 0)
+            read_ahead_step(t, &cursor->ra, leaf);
+        if (leaf->right_sibling == 0) {
+            free(cursor->page);
+            cursor->page = NULL;
         }
+        else
+            buf_read_version(t->pool, leaf->right_sibling,
+                    cursor->snapshot->snap.ts, cursor->page);
+        cursor->index = 0;
+        return;
+    }
 
-        c = get_internal_value_at(c, i);
+    leaf = (leaf_page_t *)cursor->frame->data;
+    if (leaf->right_sibling == 0) {
+        unlatch(t, cursor->frame);
+        cursor->frame = NULL;
+        return;
     }
 
-    return c;
+    read_ahead_step(t, &cursor->ra, leaf);
+    next = buf_get_page(t->pool, leaf->right_sibling);
+    if (pthread_rwlock_tryrdlock(&next->latch) == 0) {
+        unlatch(t, cursor->frame);
+        cursor->frame = next;
+        cursor->index = 0;
+        return;
+    }
+    buf_put_page(t->pool, next);
+
+    last = leaf_key(leaf, leaf->num_keys - 1);
+    unlatch(t, cursor->frame);
+    cursor->frame = last == KEY_MAX ? NULL : find_leaf(t, last + 1, false);
+    if (cursor->frame != NULL)
+        cursor->index = search_leaf((leaf_page_t *)cursor->frame->data, last + 1);
 }
 
 
-/* Finds and returns the record to which
- * a key refers.
+/* Returns the current leaf of a cursor, or NULL at the end.
  */
-char * find( int64_t key ) {
-    int i = 0;
+static leaf_page_t * cursor_leaf( bpt_cursor * cursor ) {
+    if (cursor->snapshot != NULL)
+        return (leaf_page_t *)cursor->page;
+    return cursor->frame != NULL ? (leaf_page_t *)cursor->frame->data : NULL;
+}
 
-    int64_t c = find_leaf( key );
-    if (c == 0) return NULL;
-    for (i = 0; i < get_num_keys(c); i++)
-        if (get_leaf_key_at(c, i) == key) break;
-    if (i == get_num_keys(c)) 
+
+/* Returns the next batch of at most max records in key order.
+ * A batch never spans two leaves.  The keys are copied into keys;
+ * values[i] is a string inside the current leaf, valid until the
+ * next call to bpt_cursor_next or bpt_cursor_close.
+ * Returns 0 when the scan has passed the last leaf.
+ */
+static int tree_cursor_next( bpt_cursor * cursor, bpt_key keys[], char * values[], int max ) {
+    leaf_page_t * leaf;
+    int n;
+
+    while ((leaf = cursor_leaf(cursor)) != NULL) {
+        if (cursor->index < leaf->num_keys)
+            break;
+
+        // move to the right sibling if it exists
+        cursor_step(cursor);
+    }
+    if (leaf == NULL)
         return 0;
-    else
-        return get_leaf_value_at(c, i);
+
+    for (n = 0; n < max && cursor->index < leaf->num_keys; n++, cursor->index++) {
+        keys[n] = KEY_OUT(leaf_key(leaf, cursor->index));
+        values[n] = leaf_value(leaf, cursor->index);
+    }
+    return n;
+}
+
+
+/* Traces the path from the root to a leaf as a snapshot sees it.
+ * Returns a copy of the leaf that may hold key, or NULL
+ * if the tree was empty.  The caller frees the copy.
+ */
+static char * find_leaf_at( bpt_snapshot * snapshot, tree_key key ) {
+    table * t = snapshot->table;
+    uint64_t ts = snapshot->snap.ts;
+    internal_page_t * p;
+    int64_t c;
+    char * page;
+    int i;
+
+    page = (char *) malloc(t->page_size);
+    if (page == NULL) {
+        perror("Snapshot page.");
+        exit(EXIT_FAILURE);
+    }
+
+    buf_read_version(t->pool, 0, ts, page);
+    c = ((header_page_t *)page)->root_page;
+    if (c == 0) {
+        free(page);
+        return NULL;
+    }
+
+    buf_read_version(t->pool, c, ts, page);
+    while (!((leaf_page_t *)page)->is_leaf) {
+        p = (internal_page_t *)page;
+        i = search_internal(p, key);
+        c = node_child(p, i);
+        buf_read_version(t->pool, c, ts, page);
+    }
+
+    return page;
+}
+
+
+/* Finds the record to which a key refers in a snapshot.
+ * Returns a copy of the value, or NULL if the key was not there.
+ */
+static char * tree_find_at( bpt_snapshot * snapshot, bpt_key key ) {
+    leaf_page_t * leaf;
+    char * page, * value = NULL;
+    tree_key k = KEY_IN(key);
+    int i;
+
+    if (!KEY_FITS(key) || (page = find_leaf_at(snapshot, k)) == NULL)
+        return NULL;
+
+    leaf = (leaf_page_t *)page;
+    i = search_leaf(leaf, k);
+    if (i < leaf->num_keys && leaf_key(leaf, i) == k) {
+        value = (char *) malloc(sizeof(char) * leaf_length(leaf, i));
+        memcpy(value, leaf_value(leaf, i), leaf_length(leaf, i));
+    }
+    free(page);
+
+    return value;
 }
 
+
 /* Finds the appropriate place to
  * split a node that is too big into two.
  */
@@ -461,41 +1025,24 @@ int cut( int length ) {
 
 /* Creates a new general node, which can be adapted
  * to serve as either a leaf or an internal node.
+ * The node is placed right after the page at offset near
+ * if that page is free, or as close after it as can be;
+ * near is 0 when the node belongs nowhere in particular.
+ * The header page must be latched.
  */
-int64_t make_node( void ) {
+int64_t make_node( table * t, int64_t near ) {
 
     int64_t new_node;
-    int64_t num_pages, new_num_pages, next_free_page;
-    new_node = get_free_page();
-
-    //allocate 5 new free pages and set new_node again
-    if (new_node == 0) {
-        num_pages = get_num_pages();
-        new_num_pages = num_pages + NEW_PAGE;
-        next_free_page = num_pages * 0x1000;
-        set_free_page(next_free_page);
-        fseek(data_file, num_pages * 0x1000, SEEK_SET);
-        next_free_page += 0x1000;
-        for (; num_pages < new_num_pages - 1; num_pages++) {
-            fwrite(&next_free_page, sizeof(int64_t), 1, data_file);
-            fseek(data_file, 0x0ff8, SEEK_CUR);
-            next_free_page += 0x1000;
-        }
-        next_free_page = 0;
-        fwrite(&next_free_page, sizeof(int64_t), 1, data_file);
-        set_num_pages(new_num_pages);
+    int64_t num_pages = t->space->num_pages;
 
-        new_node = get_free_page();
-    }
-    //rearrange free page list
-    set_free_page(get_next_free_page(new_node));
+    new_node = space_alloc(t->space, near);
+    if (t->space->num_pages != num_pages)
+        set_num_pages(t, t->space->num_pages);
 
-    set_is_leaf(new_node, 0);
-    set_num_keys(new_node, 0);
-    set_parent_page(new_node, 0);
+    latch_page(t, new_node);
 
-    fd = fileno(data_file);
-    fdatasync(fd);
+    set_is_leaf(t, new_node, 0);
+    set_node_empty(t, new_node);
 
     return new_node;
 }
@@ -504,30 +1051,32 @@ int64_t make_node( void ) {
 /* Creates a new leaf by creating a node
  * and then adapting it appropriately.
  */
-int64_t make_leaf( void ) {
+int64_t make_leaf( table * t, int64_t near ) {
 
-    int64_t leaf = make_node();
+    int64_t leaf = make_node(t, near);
 
-    set_is_leaf(leaf, 1);
-
-    fd = fileno(data_file);
-    fdatasync(fd);
+    set_is_leaf(t, leaf, 1);
+    set_leaf_empty(t, leaf);
 
     return leaf;
 }
 
 
+/* Gives back the page of a node that has left the tree.
+ * The header page must be latched.
+ */
+void free_node( table * t, int64_t page ) {
+    space_free(t->space, page);
+}
+
+
 /* Helper function used in insert_into_parent
  * to find the index of the parent's pointer to 
- * the node to the left of the key to be inserted.
+ * the node to the left of the key to be inserted,
+ * from the path that led to the node.
  */
-int get_left_index(int64_t parent, int64_t left) {
-
-    int left_index = 0;
-    while (left_index <= get_num_keys(parent) && 
-            get_internal_value_at(parent, left_index) != left)
-        left_index++;
-    return left_index;
+int get_left_index( int64_t left ) {
+    return op_path.index[path_level(left) - 1];
 }
 
 
@@ -535,110 +1084,100 @@ int get_left_index(int64_t parent, int64_t left) {
  * key into a leaf.
  * Returns the altered leaf.
  */
-void insert_into_leaf( int64_t leaf, int64_t key, char * value ) {
+void insert_into_leaf( table * t, int64_t leaf, tree_key key, char * value ) {
 
-    int i, insertion_point;
+    int insertion_point;
+    buf_frame * f;
+    leaf_page_t * p;
 
-    insertion_point = 0;
-    while (insertion_point < get_num_keys(leaf) && get_leaf_key_at(leaf, insertion_point) < key)
-        insertion_point++;
+    f = buf_get_page(t->pool, leaf);
+    buf_mark_dirty(t->pool, f);
+    p = (leaf_page_t *)f->data;
 
-    // shift keys and values to the right before inserting a new key.
-    for (i = get_num_keys(leaf); i > insertion_point; i--) {
-        set_leaf_key_at(leaf, i, get_leaf_key_at(leaf, i - 1));
-        set_leaf_value_at(leaf, i, get_leaf_value_at(leaf, i - 1));
-    }
-    set_leaf_key_at(leaf, insertion_point, key);
-    set_leaf_value_at(leaf, insertion_point, value);
-    set_num_keys(leaf, get_num_keys(leaf) + 1);
-    
+    insertion_point = search_leaf(p, key);
+
+    // shift slots to the right before inserting a new key.
+    leaf_insert_at(p, insertion_point, key, value, strlen(value) + 1);
+
+    buf_put_page(t->pool, f);
     return;
 }
 
-// TODO : Opmtimization
+
 /* Inserts a new key and pointer
  * to a new record into a leaf so as to exceed
- * the tree's order, causing the leaf to be split
- * in half.
+ * the tree's order or the space of the page,
+ * causing the leaf to be split in half by bytes.
 */
-void insert_into_leaf_after_splitting(int64_t leaf, int64_t key, char * value) {
+void insert_into_leaf_after_splitting(table * t, int64_t leaf, tree_key key, char * value) {
 
     int64_t new_leaf;
+    buf_frame * f, * new_f;
+    leaf_page_t * p, * new_p, * old_p, * to;
+    int insertion_index, split, num_keys, length, i, j, total, used;
+    tree_key new_key;
 
-    int64_t * temp_keys;
-    char ** temp_values;
-    int insertion_index, split, i, j;
-    int64_t new_key;
-
-    new_leaf = make_leaf();
+    new_leaf = make_leaf(t, leaf);
 
-    // make temporary array to copy
-    temp_keys = (int64_t *) malloc( leaf_order * sizeof(int64_t) );
-    if (temp_keys == NULL) {
-        perror("Temporary keys array.");
+    // make temporary copy of the leaf to split
+    old_p = (leaf_page_t *) malloc(t->page_size);
+    if (old_p == NULL) {
+        perror("Temporary leaf for splitting.");
         exit(EXIT_FAILURE);
     }
 
-    temp_values = (char **) malloc( leaf_order * sizeof(char *) );
-    if (temp_values == NULL) {
-        perror("Temporary pointers array.");
-        exit(EXIT_FAILURE);
-    }
+    f = buf_get_page(t->pool, leaf);
+    new_f = buf_get_page(t->pool, new_leaf);
+    buf_mark_dirty(t->pool, f);
+    buf_mark_dirty(t->pool, new_f);
+    p = (leaf_page_t *)f->data;
+    new_p = (leaf_page_t *)new_f->data;
 
-    insertion_index = 0;
-    while (insertion_index < leaf_order - 1 && get_leaf_key_at(leaf, insertion_index) < key)
-        insertion_index++;
+    memcpy(old_p, p, t->page_size);
+    num_keys = p->num_keys + 1;
+    length = strlen(value) + 1;
+    insertion_index = search_leaf(p, key);
 
-    for (i = 0, j = 0; i < get_num_keys(leaf); i++, j++) {
-        if (j == insertion_index) j++;
-        temp_keys[j] = get_leaf_key_at(leaf, i);
-        // TODO : When should the memory be freed?
-        temp_values[j] = get_leaf_value_at(leaf, i);
+    /* The old leaf keeps the first records up to half of the bytes,
+     * within the order on both sides.
+     */
+    total = leaf_used(p) - p->num_keys * (p->key_width + 4) +
+        num_keys * MAX_SLOT_SIZE + length;
+    used = 0;
+    for (split = 0; split < num_keys - 1 && used < total / 2; split++)
+        used += MAX_SLOT_SIZE + (split == insertion_index ? length :
+                leaf_length(old_p, split < insertion_index ? split : split - 1));
+    if (split < 1)
+        split = 1;
+    if (split > LEAF_ORDER(t->page_size) - 1)
+        split = LEAF_ORDER(t->page_size) - 1;
+    if (num_keys - split > LEAF_ORDER(t->page_size) - 1)
+        split = num_keys - (LEAF_ORDER(t->page_size) - 1);
+
+    leaf_init(p, t->page_size);
+    for (i = 0; i < num_keys; i++) {
+        to = i < split ? p : new_p;
+        if (i == insertion_index)
+            leaf_insert_at(to, to->num_keys, key, value, length);
+        else {
+            j = i < insertion_index ? i : i - 1;
+            leaf_insert_at(to, to->num_keys, leaf_key(old_p, j),
+                    leaf_value(old_p, j), leaf_length(old_p, j));
+        }
     }
 
-    temp_keys[insertion_index] = key;
-    temp_values[insertion_index] = value;
-    //strcpy(temp_values[insertion_index], value);
-
-    set_num_keys(leaf, 0);
+    free(old_p);
 
-    split = cut(leaf_order - 1);
-
-    for (i = 0; i < split; i++) {
-        set_leaf_value_at(leaf, i, temp_values[i]);
-        set_leaf_key_at(leaf, i, temp_keys[i]);
-        set_num_keys(leaf, get_num_keys(leaf) + 1);
-    }
+    // Set right sibling leaf
+    new_p->right_sibling = p->right_sibling;
+    p->right_sibling = new_leaf;
 
-    for (i = split, j = 0; i < leaf_order; i++, j++) {
-        set_leaf_value_at(new_leaf, j, temp_values[i]);
-        set_leaf_key_at(new_leaf, j, temp_keys[i]);
-        set_num_keys(new_leaf, get_num_keys(new_leaf) + 1);
-    }
+    new_key = leaf_key(new_p, 0);
 
-    free(temp_values);
-    free(temp_keys);
+    buf_put_page(t->pool, new_f);
+    buf_put_page(t->pool, f);
 
-    // Set right sibling leaf
-    set_right_sibling(new_leaf, get_right_sibling(leaf));
-    set_right_sibling(leaf, new_leaf);
-
-    // No need to implement
-    // Seems that a SEGV occurs here
-    /*
-    // Fill in empty space of the array.
-    for (i = get_num_keys(leaf); i < leaf_order - 1; i++)
-        //leaf->pointers[i] = NULL;
-        set_leaf_value_at(leaf, i, NULL);
-    for (i = get_num_keys(new_leaf); i < leaf_order - 1; i++)
-        //new_leaf->pointers[i] = NULL;
-        set_leaf_value_at(new_leaf, i, NULL);
-    */
-
-    set_parent_page(new_leaf, get_parent_page(leaf));
-    new_key = get_leaf_key_at(new_leaf, 0);
-
-    insert_into_parent(leaf, new_key, new_leaf);
+    insert_into_parent(t, leaf, new_key, new_leaf);
 
     return;
 }
@@ -648,17 +1187,17 @@ void insert_into_leaf_after_splitting(int64_t leaf, int64_t key, char * value) {
  * into a node into which these can fit
  * without violating the B+ tree properties.
  */
-void insert_into_node(int64_t n, int left_index, int64_t key, int64_t right) {
-    int i;
+void insert_into_node(table * t, int64_t n, int left_index, tree_key key, int64_t right) {
+    buf_frame * f;
+    internal_page_t * p;
 
-    for (i = get_num_keys(n); i > left_index; i--) {
-        set_internal_value_at(n, i + 1, get_internal_value_at(n, i));
-        set_internal_key_at(n, i, get_internal_key_at(n, i - 1));
-    }
-    set_internal_value_at(n, left_index + 1, right);
-    set_internal_key_at(n, left_index, key);
-    set_num_keys(n, get_num_keys(n) + 1);
+    f = buf_get_page(t->pool, n);
+    buf_mark_dirty(t->pool, f);
+    p = (internal_page_t *)f->data;
+
+    node_insert_at(p, left_index, key, right);
 
+    buf_put_page(t->pool, f);
     return;
 }
 
@@ -667,100 +1206,98 @@ void insert_into_node(int64_t n, int left_index, int64_t key, int64_t right) {
  * into a node, causing the node's size to exceed
  * the order, and causing the node to split into two.
  */
-void insert_into_node_after_splitting(int64_t old_node, int left_index, int64_t key, int64_t right) {
+void insert_into_node_after_splitting(table * t, int64_t old_node, int left_index, tree_key key, int64_t right) {
 
-    int i, j, split;
-    int64_t k_prime;
-    int64_t new_node, child;
-    int64_t * temp_keys, * temp_pointers;
+    int split, num_entries;
+    tree_key k_prime;
+    int64_t new_node;
+    buf_frame * f, * new_f;
+    internal_page_t * p, * new_p;
+    entry * temp_entries;
 
-    /* First create a temporary set of keys and pointers
+    /* First create a temporary set of entries
      * to hold everything in order, including
      * the new key and pointer, inserted in their
      * correct places. 
      * Then create a new node and copy half of the 
-     * keys and pointers to the old node and
+     * entries to the old node and
      * the other half to the new.
      */
 
-    temp_pointers = (int64_t *) malloc( (order + 1) * sizeof(int64_t) );
-    if (temp_pointers == NULL) {
-        perror("Temporary pointers array for splitting nodes.");
-        exit(EXIT_FAILURE);
-    }
-    temp_keys = (int64_t *) malloc( order * sizeof(int64_t) );
-    if (temp_keys == NULL) {
-        perror("Temporary keys array for splitting nodes.");
+    temp_entries = (entry *) malloc( INTERNAL_ORDER(t->page_size) * sizeof(entry) );
+    if (temp_entries == NULL) {
+        perror("Temporary entries array for splitting nodes.");
         exit(EXIT_FAILURE);
     }
 
-    for (i = 0, j = 0; i < get_num_keys(old_node) + 1; i++, j++) {
-        if (j == left_index + 1) j++;
-        temp_pointers[j] = get_internal_value_at(old_node, i);
-    }
-
-    for (i = 0, j = 0; i < get_num_keys(old_node); i++, j++) {
-        if (j == left_index) j++;
-        temp_keys[j] =  get_internal_key_at(old_node, i);
-    }
-
-    temp_pointers[left_index + 1] = right;
-    temp_keys[left_index] = key;
-
-    /* Create the new node and copy
-     * half the keys and pointers to the
-     * old and half to the new.
+    new_node = make_node(t, old_node);
+
+    f = buf_get_page(t->pool, old_node);
+    new_f = buf_get_page(t->pool, new_node);
+    buf_mark_dirty(t->pool, f);
+    buf_mark_dirty(t->pool, new_f);
+    p = (internal_page_t *)f->data;
+    new_p = (internal_page_t *)new_f->data;
+
+    num_entries = node_read(p, temp_entries);
+    memmove(&temp_entries[left_index + 1], &temp_entries[left_index],
+            (num_entries - left_index) * sizeof(entry));
+    temp_entries[left_index].key = key;
+    temp_entries[left_index].page = right;
+    num_entries++;
+
+    /* The old node keeps its leftmost pointer and
+     * the first split - 1 entries.  The key of the next entry
+     * moves up to the parent and its pointer becomes
+     * the leftmost pointer of the new node.
      */ 
-    split = cut(order);
-    new_node = make_node();
-    set_num_keys(old_node, 0);
-    for (i = 0; i < split - 1; i++) {
-        set_internal_value_at(old_node, i, temp_pointers[i]);
-        set_internal_key_at(old_node, i, temp_keys[i]);
-        set_num_keys(old_node, get_num_keys(old_node) + 1);
-    }
+    split = node_split(t->page_size, temp_entries, num_entries);
+    node_write(p, temp_entries, split - 1);
 
-    set_internal_value_at(old_node, i, temp_pointers[i]);
-    k_prime = temp_keys[split - 1];
-    for (++i, j = 0; i < order; i++, j++) {
-        set_internal_value_at(new_node, j, temp_pointers[i]);
-        set_internal_key_at(new_node, j, temp_keys[i]);
-        set_num_keys(new_node, get_num_keys(new_node) + 1);
-    }
+    k_prime = temp_entries[split - 1].key;
+    new_p->one_more_page = temp_entries[split - 1].page;
+    node_write(new_p, &temp_entries[split], num_entries - split);
 
-    set_internal_value_at(new_node, j, temp_pointers[i]);
-    free(temp_pointers);
-    free(temp_keys);
-    set_parent_page(new_node, get_parent_page(old_node));
-    for (i = 0; i <= get_num_keys(new_node); i++) {
-        child = get_internal_value_at(new_node, i);
-        set_parent_page(child, new_node);
-    }
+    free(temp_entries);
+
+    buf_put_page(t->pool, f);
+    buf_put_page(t->pool, new_f);
 
     /* Insert a new key into the parent of the two
      * nodes resulting from the split, with
      * the old node to the left and the new to the right.
      */
-    insert_into_parent(old_node, k_prime, new_node);
+    insert_into_parent(t, old_node, k_prime, new_node);
 
     return;
 }
 
 
+/* Returns whether key can be inserted into an internal node
+ * without splitting it.
+ */
+static bool has_room( table * t, int64_t n, tree_key key ) {
+    buf_frame * f = buf_get_page(t->pool, n);
+    bool result = node_fits((internal_page_t *)f->data, key);
+    buf_put_page(t->pool, f);
+    return result;
+}
+
+
 /* Inserts a new node (leaf or internal node) into the B+ tree.
  * Returns the root of the tree after insertion.
  */
-void insert_into_parent(int64_t left, int64_t key, int64_t right) {
+void insert_into_parent(table * t, int64_t left, tree_key key, int64_t right) {
 
     int left_index;
     int64_t parent;
 
-    parent = get_parent_page(left);
+    parent = get_parent(left);
 
     /* Case: new root. */
 
     if (parent == 0) {
-        insert_into_new_root(left, key, right);
+        insert_into_new_root(t, left, key, right);
         return;
     }
 
@@ -772,14 +1309,14 @@ void insert_into_parent(int64_t left, int64_t key, int64_t right) {
      * node.
      */
 
-    left_index = get_left_index(parent, left);
+    left_index = get_left_index(left);
 
 
     /* Simple case: the new key fits into the node.
      */
 
-    if (get_num_keys(parent) < order - 1) {
-        insert_into_node(parent, left_index, key, right);
+    if (has_room(t, parent, key)) {
+        insert_into_node(t, parent, left_index, key, right);
         return;
     }
 
@@ -787,7 +1324,7 @@ void insert_into_parent(int64_t left, int64_t key, int64_t right) {
      * to preserve the B+ tree properties.
      */
 
-    insert_into_node_after_splitting(parent, left_index, key, right);
+    insert_into_node_after_splitting(t, parent, left_index, key, right);
     return;
 }
 
@@ -796,93 +1333,123 @@ void insert_into_parent(int64_t left, int64_t key, int64_t right) {
  * and inserts the appropriate key into
  * the new root.
  */
-void insert_into_new_root(int64_t left, int64_t key, int64_t right) {
+void insert_into_new_root(table * t, int64_t left, tree_key key, int64_t right) {
 
-    int64_t root = make_node();
+    int64_t root = make_node(t, 0);
 
-    set_internal_key_at(root, 0, key);
-    set_internal_value_at(root, 0, left);
-    set_internal_value_at(root, 1, right);
-    set_num_keys(root, get_num_keys(root) + 1);
-    set_parent_page(root, 0);
-    set_parent_page(left, root);
-    set_parent_page(right, root);
+    set_internal_value_at(t, root, 0, left);
+    insert_into_node(t, root, 0, key, right);
 
-    set_root(root);
+    set_root(t, root);
 }
 
 
-// No need to implement; already implemented at open_db
+// No need to implement; already implemented at open_table
 /* First insertion:
  * start a new tree.
  */
-void start_new_tree(int64_t key, char * value) {
+void start_new_tree(table * t, tree_key key, char * value) {
 
-    int64_t root = make_leaf();
-    set_leaf_key_at(root, 0, key);
-    set_leaf_value_at(root, 0, value);
-    set_right_sibling(root, 0);
-    set_parent_page(root, 0);
-    set_num_keys(root, get_num_keys(root) + 1);
+    int64_t root = make_leaf(t, 0);
+    insert_into_leaf(t, root, key, value);
+    set_right_sibling(t, root, 0);
 
-    set_root(root);
+    set_root(t, root);
 }
 
 
-/* Master insertion function.
- * Inserts a key and an associated value into
- * the B+ tree, causing the tree to be adjusted
- * however necessary to maintain the B+ tree
- * properties.
- *
- * @return 0    if insertion successed
- *         -1   if value with given key is not found
+/* Inserts a key and its value with the path from the root latched,
+ * for the operation in progress, when the leaf may have to split.
+ * Returns -1 if the key is already in the tree, and 0 otherwise.
  */
-int insert( int64_t key, char * value ) {
-    
+static int insert_on_path( table * t, tree_key key, char * value ) {
+
     int64_t leaf;
-    
-    /* Ignore duplicate.
-     */
+    int i;
+    leaf_page_t * p;
 
-    if (find(key) != NULL) {
-        return -1;
-    }
+    leaf = latch_path(t, key, false);
 
     /* Case: the tree does not exist yet.
      * Start a new tree.
      */
-    if (get_root() == 0) {
-        start_new_tree(key, value);
+    if (leaf == 0) {
+        start_new_tree(t, key, value);
         return 0;
     }
 
+    p = (leaf_page_t *)latch_page(t, leaf)->data;
+    i = search_leaf(p, key);
+    if (i < p->num_keys && leaf_key(p, i) == key)
+        return -1;
+
+    if (leaf_fits(p, key, strlen(value) + 1))
+        insert_into_leaf(t, leaf, key, value);
 
-    /* Case: the tree already exists.
-     * (Rest of function body.)
+    /* Case:  leaf must be split.
      */
+    else
+        insert_into_leaf_after_splitting(t, leaf, key, value);
+
+    return 0;
+}
 
-    leaf = find_leaf(key);
+
+/* Master insertion function.
+ * Inserts a key and an associated value into
+ * the B+ tree, causing the tree to be adjusted
+ * however necessary to maintain the B+ tree
+ * properties.
+ *
+ * @return 0    if insertion successed
+ *         -1   if the key is already in the tree,
+ *              the value is longer than MAX_VALUE_SIZE
+ *              or the key is not of the type of the tree
+ */
+static int tree_insert( table * t, bpt_key key, char * value ) {
+    
+    int i, length, result;
+    tree_key k = KEY_IN(key);
+    buf_frame * f;
+    leaf_page_t * p;
+
+    if (!KEY_FITS(key))
+        return -1;
+    length = strnlen(value, MAX_VALUE_SIZE) + 1;
+    if (length > MAX_VALUE_SIZE)
+        return -1;
+
+    begin_op(t);
 
     /* Case: leaf has room for key and pointer.
+     * Only the leaf is latched.
      */
-    if (get_num_keys(leaf) < leaf_order - 1) {
-        insert_into_leaf(leaf, key, value);
 
-        fd = fileno(data_file);
-        fdatasync(fd);
+    f = find_leaf(t, k, true);
+    if (f != NULL) {
+        p = (leaf_page_t *)f->data;
+        i = search_leaf(p, k);
 
-        return 0;
+        // Ignore duplicate.
+        if (i < p->num_keys && leaf_key(p, i) == k) {
+            unlatch(t, f);
+            end_op(t);
+            return -1;
+        }
+        if (leaf_fits(p, k, length)) {
+            hold_latch(f);
+            insert_into_leaf(t, f->page, k, value);
+            return end_op(t);
+        }
+        unlatch(t, f);
     }
 
-    /* Case:  leaf must be split.
+    /* Otherwise latch the path from the root,
+     * which may have changed in the meantime.
      */
-    insert_into_leaf_after_splitting(leaf, key, value);
 
-    fd = fileno(data_file);
-    fdatasync(fd);
-
-    return 0;
+    result = insert_on_path(t, k, value);
+    return end_op(t) == 0 ? result : -1;
 }
 
 
@@ -897,70 +1464,44 @@ int insert( int64_t key, char * value ) {
  */
 int get_neighbor_index( int64_t n ) {
 
-    int i;
-
     /* Return the index of the key to the left
      * of the pointer in the parent pointing
-     * to n.  
+     * to n, as the path to n took it.
      * If n is the leftmost child, this means
      * return -1.
      */
-    for (i = 0; i <= get_num_keys(get_parent_page(n)); i++)
-        if (get_internal_value_at(get_parent_page(n), i) == n)
-            return i - 1;
-
-    // Error state.
-    printf("Search for nonexistent pointer to node in parent.\n");
-    printf("Node:  #%ld\n", (unsigned long)n);
-    exit(EXIT_FAILURE);
+    return op_path.index[path_level(n) - 1] - 1;
 }
 
 
-int64_t remove_entry_from_node(int64_t n, int64_t key) {
+int64_t remove_entry_from_node(table * t, int64_t n, tree_key key) {
+
+    int i;
+    buf_frame * f;
+    leaf_page_t * leaf;
+    internal_page_t * p;
 
-    int i, num_pointers;
+    f = buf_get_page(t->pool, n);
+    buf_mark_dirty(t->pool, f);
 
     // Remove the key and shift other keys accordingly.
-    i = 0;
-    if (get_is_leaf(n)) {
-        while (get_leaf_key_at(n, i) != key)
-            i++;
-        for (++i; i < get_num_keys(n); i++) {
-            set_leaf_key_at(n, i - 1, get_leaf_key_at(n, i));
-            set_leaf_value_at(n, i - 1, get_leaf_value_at(n, i));
-        }
+    if (((leaf_page_t *)f->data)->is_leaf) {
+        leaf = (leaf_page_t *)f->data;
+        i = search_leaf(leaf, key);
+        leaf_remove_at(leaf, i);
     }
     else {
-        while (get_internal_key_at(n, i) != key)
-            i++;
-        for (++i; i < get_num_keys(n); i++) {
-            set_internal_key_at(n, i - 1, get_internal_key_at(n, i));
-            set_internal_value_at(n, i, get_internal_value_at(n, i + 1));
-        }
-        //set_internal_value_at(n, i - 1, get_internal_value_at(n, i));
+        // The pointer to the right of the key goes with it.
+        p = (internal_page_t *)f->data;
+        node_remove_at(p, search_internal(p, key) - 1);
     }
 
-    // One key fewer.
-    set_num_keys(n, get_num_keys(n) - 1);
-
-    /*
-    // Is it necessary to implement?
-    // TODO : optimize
-    // Set the other pointers to NULL for tidiness.
-    // A leaf uses the last pointer to point to the next leaf.
-    if (get_is_leaf(n) n->is_leaf)
-        for (i = n->num_keys; i < leaf_order - 1; i++)
-            n->pointers[i] = NULL;
-    else
-        for (i = n->num_keys + 1; i < order; i++)
-            n->pointers[i] = NULL;
-    */
-
+    buf_put_page(t->pool, f);
     return n;
 }
 
 
-void adjust_root( int64_t root ) {
+void adjust_root( table * t, int64_t root ) {
 
     int64_t new_root;
 
@@ -969,7 +1510,7 @@ void adjust_root( int64_t root ) {
      * so nothing to be done.
      */
 
-    if (get_num_keys(root) > 0)
+    if (get_num_keys(t, root) > 0)
         return;
 
     /* Case: empty root. 
@@ -979,9 +1520,8 @@ void adjust_root( int64_t root ) {
     // the first (only) child
     // as the new root.
 
-    if (!get_is_leaf(root)) {
-        new_root = get_internal_value_at(root, 0);
-        set_parent_page(new_root, 0);
+    if (!get_is_leaf(t, root)) {
+        new_root = get_internal_value_at(t, root, 0);
     }
 
     // If it is a leaf (has no children),
@@ -990,10 +1530,9 @@ void adjust_root( int64_t root ) {
     else
         new_root = 0;
 
-    set_root(new_root);
+    set_root(t, new_root);
 
-    set_next_free_page(root, get_free_page());
-    set_free_page(root);
+    free_node(t, root);
 
 }
 
@@ -1004,11 +1543,13 @@ void adjust_root( int64_t root ) {
  * can accept the additional entries
  * without exceeding the maximum.
  */
-void coalesce_nodes(int64_t n, int64_t neighbor, int neighbor_index, int64_t k_prime) {
+void coalesce_nodes(table * t, int64_t n, int64_t neighbor, int neighbor_index, tree_key k_prime) {
+
+    int i, neighbor_insertion_index;
+    int64_t tmp, parent;
+    buf_frame * f, * neighbor_f;
 
-    int i, j, neighbor_insertion_index;
-    int32_t n_end;
-    int64_t tmp;
+    parent = get_parent(n);
 
     /* Swap neighbor with node if node is on the
      * extreme left and neighbor is to its right.
@@ -1020,50 +1561,45 @@ void coalesce_nodes(int64_t n, int64_t neighbor, int neighbor_index, int64_t k_p
         neighbor = tmp;
     }
 
+    f = buf_get_page(t->pool, n);
+    neighbor_f = buf_get_page(t->pool, neighbor);
+    buf_mark_dirty(t->pool, neighbor_f);
+
     /* Starting point in the neighbor for copying
      * keys and pointers from n.
      * Recall that n and neighbor have swapped places
      * in the special case of n being a leftmost child.
      */
 
-    neighbor_insertion_index = get_num_keys(neighbor);
+    neighbor_insertion_index = ((leaf_page_t *)neighbor_f->data)->num_keys;
 
     /* Case:  nonleaf node.
      * Append k_prime and the following pointer.
      * Append all pointers and keys from the neighbor.
      */
 
-    if (!get_is_leaf(n)) {
-
-        /* Append k_prime.
-         */
-
-        set_internal_key_at(neighbor, neighbor_insertion_index, k_prime);
-        set_num_keys(neighbor, get_num_keys(neighbor) + 1);
+    if (!((leaf_page_t *)f->data)->is_leaf) {
+        internal_page_t * p = (internal_page_t *)f->data;
+        internal_page_t * neighbor_p = (internal_page_t *)neighbor_f->data;
+        entry * entries;
 
-
-        n_end = get_num_keys(n);
-
-        for (i = neighbor_insertion_index + 1, j = 0; j < n_end; i++, j++) {
-            set_internal_key_at(neighbor, i, get_internal_key_at(n, j));
-            set_internal_value_at(neighbor, i, get_internal_value_at(n, j));
-            set_num_keys(neighbor, get_num_keys(neighbor) + 1);
-            set_num_keys(n, get_num_keys(n) - 1);
+        entries = (entry *) malloc(INTERNAL_ORDER(t->page_size) * sizeof(entry));
+        if (entries == NULL) {
+            perror("Temporary entries array for coalescing nodes.");
+            exit(EXIT_FAILURE);
         }
 
-        /* The number of pointers is always
-         * one more than the number of keys.
+        /* Append k_prime with the leftmost pointer of n,
+         * then the entries of n, and store them all at the
+         * width they need together.
          */
 
-        set_internal_value_at(neighbor, i, get_internal_value_at(n, j));
-
-        /* All children must now point up to the same parent.
-         */
-        // TODO : optimize
-        for (i = 0; i < get_num_keys(neighbor) + 1; i++) {
-            tmp = get_internal_value_at(neighbor, i);
-            set_parent_page(tmp, neighbor);
-        }
+        node_read(neighbor_p, entries);
+        entries[neighbor_insertion_index].key = k_prime;
+        entries[neighbor_insertion_index].page = p->one_more_page;
+        node_read(p, &entries[neighbor_insertion_index + 1]);
+        node_write(neighbor_p, entries, neighbor_insertion_index + p->num_keys + 1);
+        free(entries);
     }
 
     /* In a leaf, append the keys and pointers of
@@ -1073,18 +1609,21 @@ void coalesce_nodes(int64_t n, int64_t neighbor, int neighbor_index, int64_t k_p
      */
 
     else {
-        for (i = neighbor_insertion_index, j = 0; j < get_num_keys(n); i++, j++) {
-            set_leaf_key_at(neighbor, i, get_leaf_key_at(n, j));
-            set_leaf_value_at(neighbor, i, get_leaf_value_at(n, j));
-            set_num_keys(neighbor, get_num_keys(neighbor) + 1);
-        }
-        set_right_sibling(neighbor, get_right_sibling(n));
+        leaf_page_t * p = (leaf_page_t *)f->data;
+        leaf_page_t * neighbor_p = (leaf_page_t *)neighbor_f->data;
+
+        for (i = 0; i < p->num_keys; i++)
+            leaf_insert_at(neighbor_p, neighbor_p->num_keys, leaf_key(p, i),
+                    leaf_value(p, i), leaf_length(p, i));
+        neighbor_p->right_sibling = p->right_sibling;
     }
 
-    delete_entry(get_parent_page(n), k_prime);
+    buf_put_page(t->pool, neighbor_f);
+    buf_put_page(t->pool, f);
+
+    delete_entry(t, parent, k_prime);
     
-    set_next_free_page(n, get_free_page());
-    set_free_page(n);
+    free_node(t, n);
 }
 
 
@@ -1092,46 +1631,77 @@ void coalesce_nodes(int64_t n, int64_t neighbor, int neighbor_index, int64_t k_p
  * one has become too small after deletion
  * but its neighbor is too big to append the
  * small node's entries without exceeding the
- * maximum
+ * maximum.
+ * The key that separates them afterwards must fit in the
+ * parent at the width of its keys; when it does not, nothing
+ * moves and n is left short.
  */
-void redistribute_nodes(int64_t n, int64_t neighbor, int neighbor_index, 
-                            int k_prime_index, int64_t k_prime) { 
+void redistribute_nodes(table * t, int64_t n, int64_t neighbor, int neighbor_index, 
+                            int k_prime_index, tree_key k_prime) { 
+
+    int64_t moved_child, parent;
+    tree_key new_k_prime;
+    buf_frame * f, * neighbor_f, * parent_f;
+    internal_page_t * parent_p;
+    int i, moved;
+
+    f = buf_get_page(t->pool, n);
+    neighbor_f = buf_get_page(t->pool, neighbor);
+    buf_mark_dirty(t->pool, f);
+    buf_mark_dirty(t->pool, neighbor_f);
+    parent = get_parent(n);
+    parent_f = buf_get_page(t->pool, parent);
+    parent_p = (internal_page_t *)parent_f->data;
+
+    moved = 0;
+    new_k_prime = k_prime;
+
+    /* Case: leaf.  Records move one at a time from the
+     * near end of the neighbor, until n holds enough or
+     * the neighbor would fall short itself.
+     */
 
-    int i;
-    int64_t tmp;
+    if (((leaf_page_t *)f->data)->is_leaf) {
+        leaf_page_t * p = (leaf_page_t *)f->data;
+        leaf_page_t * neighbor_p = (leaf_page_t *)neighbor_f->data;
+        tree_key key;
+        int length;
+
+        for (;; moved++) {
+            i = neighbor_index != -1 ? neighbor_p->num_keys - 1 : 0;
+            key = leaf_key(neighbor_p, i);
+            length = leaf_length(neighbor_p, i);
+            if (moved > 0 && (!leaf_underflows(p) || !leaf_is_safe(neighbor_p, length, true)))
+                break;
+            new_k_prime = neighbor_index != -1 ? key : leaf_key(neighbor_p, 1);
+            if (!leaf_fits(p, key, length) ||
+                    !node_can_set_key(parent_p, k_prime_index, new_k_prime))
+                break;
+            leaf_insert_at(p, neighbor_index != -1 ? 0 : p->num_keys,
+                    key, leaf_value(neighbor_p, i), length);
+            leaf_remove_at(neighbor_p, i);
+        }
+
+        new_k_prime = neighbor_index != -1 ? leaf_key(p, 0) : leaf_key(neighbor_p, 0);
+    }
 
     /* Case: n has a neighbor to the left. 
      * Pull the neighbor's last key-pointer pair over
      * from the neighbor's right end to n's left end.
      */
 
-    if (neighbor_index != -1) {
-        if (!get_is_leaf(n)) {
-            //n->pointers[n->num_keys + 1] = n->pointers[n->num_keys];
-            set_internal_value_at( n, get_num_keys(n) + 1, get_internal_value_at(n, get_num_keys(n)) );
-            for (i = get_num_keys(n); i > 0; i--) {
-                set_internal_key_at(n, i, get_internal_key_at(n, i - 1));
-                set_internal_value_at(n, i, get_internal_value_at(n, i - 1));
-
-                set_internal_value_at( n, 0, get_internal_value_at(neighbor, get_num_keys(neighbor)) );
-                tmp = get_internal_value_at(n, 0);
-                set_parent_page(tmp, n);
-                set_internal_value_at(neighbor, get_num_keys(neighbor), 0);
-                set_internal_key_at(n, 0, k_prime);
-                set_internal_key_at( get_parent_page(n), k_prime_index, 
-                                    get_internal_key_at(neighbor, get_num_keys(neighbor) - 1) );
-            }
-        }
-        else {
-            for (i = get_num_keys(n); i > 0; i--) {
-                set_leaf_key_at(n, i, get_leaf_key_at(n, i - 1));
-                set_leaf_value_at(n, i, get_leaf_value_at(n, i - 1));
-
-                set_leaf_value_at( n, 0, get_leaf_value_at(neighbor, get_num_keys(neighbor) - 1) );
-                set_leaf_value_at(neighbor, get_num_keys(neighbor) - 1, 0);
-                set_leaf_key_at( n, 0, get_leaf_key_at(neighbor, get_num_keys(neighbor) - 1) );
-                set_internal_key_at(get_parent_page(n), k_prime_index, get_leaf_key_at(n, 0));
-            }
+    else if (neighbor_index != -1) {
+        internal_page_t * p = (internal_page_t *)f->data;
+        internal_page_t * neighbor_p = (internal_page_t *)neighbor_f->data;
+
+        new_k_prime = node_key(neighbor_p, neighbor_p->num_keys - 1);
+        if (node_fits(p, k_prime) &&
+                node_can_set_key(parent_p, k_prime_index, new_k_prime)) {
+            moved_child = node_child(neighbor_p, neighbor_p->num_keys);
+            node_insert_at(p, 0, k_prime, p->one_more_page);
+            p->one_more_page = moved_child;
+            node_remove_at(neighbor_p, neighbor_p->num_keys - 1);
+            moved = 1;
         }
     }
 
@@ -1142,80 +1712,83 @@ void redistribute_nodes(int64_t n, int64_t neighbor, int neighbor_index,
      */
 
     else {  
-        if (get_is_leaf(n)) {
-            set_leaf_key_at(n, get_num_keys(n), get_leaf_key_at(neighbor, 0));
-            set_leaf_value_at(n, get_num_keys(n), get_leaf_value_at(neighbor, 0));
-            set_internal_key_at(get_parent_page(n), k_prime_index, get_leaf_key_at(neighbor, 1));
-
-            for (i = 0; i < get_num_keys(neighbor) - 1; i++) {
-                set_leaf_key_at(neighbor, i, get_leaf_key_at(neighbor, i + 1));
-                set_leaf_value_at(neighbor, i, get_leaf_value_at(neighbor, i + 1));
-            }
-        }
-        else {
-            set_internal_key_at(n, get_num_keys(n), k_prime);
-            set_internal_value_at(n, get_num_keys(n) + 1, get_internal_value_at(neighbor, 0));
-            tmp = get_internal_value_at(n, get_num_keys(n) + 1);
-            set_parent_page(tmp, n);
-            set_internal_key_at(get_parent_page(n), k_prime_index, get_internal_key_at(neighbor, 0));
-
-            for (i = 0; i < get_num_keys(neighbor) - 1; i++) {
-                set_internal_key_at(neighbor, i, get_internal_key_at(neighbor, i + 1));
-                set_internal_value_at(neighbor, i, get_internal_value_at(neighbor, i + 1));
-            }
-            set_internal_value_at(neighbor, i, get_internal_value_at(neighbor, i + 1));
+        internal_page_t * p = (internal_page_t *)f->data;
+        internal_page_t * neighbor_p = (internal_page_t *)neighbor_f->data;
+
+        new_k_prime = node_key(neighbor_p, 0);
+        if (node_fits(p, k_prime) &&
+                node_can_set_key(parent_p, k_prime_index, new_k_prime)) {
+            moved_child = neighbor_p->one_more_page;
+            node_insert_at(p, p->num_keys, k_prime, moved_child);
+            neighbor_p->one_more_page = node_child(neighbor_p, 1);
+            node_remove_at(neighbor_p, 0);
+            moved = 1;
         }
     }
 
-    /* n now has one more key and one more pointer;
-     * the neighbor has one fewer of each.
-     */
-    set_num_keys(n, get_num_keys(n) + 1);
-    set_num_keys(neighbor, get_num_keys(neighbor) - 1);
+    buf_put_page(t->pool, parent_f);
+    buf_put_page(t->pool, neighbor_f);
+    buf_put_page(t->pool, f);
+
+    if (moved == 0)
+        return;
+    set_internal_key_at(t, parent, k_prime_index, new_k_prime);
 }
 
 
-/* Deletes an entry from the B+ tree.
- * Removes the record and its key and pointer
- * from the leaf, and then makes all appropriate
- * changes to preserve the B+ tree properties.
+/* Returns whether a node below the root has fallen below
+ * the minimum allowable size, to be preserved after deletion.
  */
-void delete_entry( int64_t n, int64_t key ) {
-
-    int min_keys;
-    int64_t neighbor;
-    int neighbor_index, k_prime_index;
-    int64_t k_prime;
-    int capacity;
-
-    // Remove key and pointer from node.
-
-    n = remove_entry_from_node(n, key);
-
-    /* Case:  deletion from the root. 
-     */
+static bool underflows( table * t, int64_t n ) {
+    buf_frame * f = buf_get_page(t->pool, n);
+    leaf_page_t * p = (leaf_page_t *)f->data;
+    bool result = p->is_leaf ? leaf_underflows(p) :
+        node_underflows((internal_page_t *)p);
+    buf_put_page(t->pool, f);
+    return result;
+}
 
-    if (n == get_root()) {
-        adjust_root(n);
-        return;
-    }
 
+/* Returns whether two neighbors can be coalesced into one node.
+ * Internal nodes also take the key between them from the parent.
+ */
+static bool fit_in_one( table * t, int64_t n, int64_t neighbor, int neighbor_index,
+        tree_key k_prime ) {
+    buf_frame * f = buf_get_page(t->pool, n);
+    buf_frame * neighbor_f = buf_get_page(t->pool, neighbor);
+    leaf_page_t * p = (leaf_page_t *)f->data;
+    leaf_page_t * neighbor_p = (leaf_page_t *)neighbor_f->data;
+    bool result;
+
+    if (p->is_leaf)
+        result = leaf_can_merge(p, neighbor_p);
+    else if (neighbor_index == -1)
+        result = node_can_merge((internal_page_t *)p, k_prime,
+                (internal_page_t *)neighbor_p);
+    else
+        result = node_can_merge((internal_page_t *)neighbor_p, k_prime,
+                (internal_page_t *)p);
+    buf_put_page(t->pool, neighbor_f);
+    buf_put_page(t->pool, f);
+    return result;
+}
 
-    /* Case:  deletion from a node below the root.
-     * (Rest of function body.)
-     */
 
-    /* Determine minimum allowable size of node,
-     * to be preserved after deletion.
-     */
+/* Restores the minimum size of a node below the root that has
+ * lost entries or bytes, by coalescence or redistribution with a
+ * neighbor if it has fallen below it.
+ */
+static void rebalance_node( table * t, int64_t n ) {
 
-    min_keys = get_is_leaf(n) ? cut(leaf_order - 1) : cut(order) - 1;
+    int64_t neighbor;
+    int neighbor_index, k_prime_index;
+    tree_key k_prime;
 
     /* Case:  node stays at or above minimum.
      * (The simple case.)
      */
 
-    if (get_num_keys(n) >= min_keys)
+    if (!underflows(t, n))
         return;
 
     /* Case:  node falls below minimum.
@@ -1230,66 +1803,354 @@ void delete_entry( int64_t n, int64_t key ) {
      * to the neighbor.
      */
 
-    neighbor_index = get_neighbor_index( n );
+    neighbor_index = get_neighbor_index(n);
     k_prime_index = neighbor_index == -1 ? 0 : neighbor_index;
-    k_prime = get_internal_key_at(get_parent_page(n), k_prime_index);
-    neighbor = neighbor_index == -1 ? get_internal_value_at(get_parent_page(n), 1) : 
-        get_internal_value_at(get_parent_page(n), neighbor_index);
+    k_prime = get_internal_key_at(t, get_parent(n), k_prime_index);
+    neighbor = neighbor_index == -1 ? get_internal_value_at(t, get_parent(n), 1) : 
+        get_internal_value_at(t, get_parent(n), neighbor_index);
 
-    capacity = get_is_leaf(n) ? leaf_order : order - 1;
+    /* The neighbor shares the parent latched by this
+     * operation, so it can be latched without deadlock.
+     */
+    latch_page(t, neighbor);
 
     /* Coalescence. */
 
-    if (get_num_keys(neighbor) + get_num_keys(n) < capacity) {
-        coalesce_nodes(n, neighbor, neighbor_index, k_prime);
+    if (fit_in_one(t, n, neighbor, neighbor_index, k_prime)) {
+        coalesce_nodes(t, n, neighbor, neighbor_index, k_prime);
         return;
     }
 
     /* Redistribution. */
 
     else {
-        redistribute_nodes(n, neighbor, neighbor_index, k_prime_index, k_prime);
+        redistribute_nodes(t, n, neighbor, neighbor_index, k_prime_index, k_prime);
         return;
     }
 }
 
 
+/* Deletes an entry from the B+ tree.
+ * Removes the record and its key and pointer
+ * from the leaf, and then makes all appropriate
+ * changes to preserve the B+ tree properties.
+ */
+void delete_entry( table * t, int64_t n, tree_key key ) {
 
-/* Master deletion function.
+    // Remove key and pointer from node.
+
+    n = remove_entry_from_node(t, n, key);
+
+    /* Case:  deletion from the root. 
+     */
+
+    if (n == get_root(t)) {
+        adjust_root(t, n);
+        return;
+    }
+
+
+    /* Case:  deletion from a node below the root.
+     */
+
+    rebalance_node(t, n);
+}
+
+
+
+/* Deletes a key with the path from the root latched, for the
+ * operation in progress, when the leaf may have to merge.
+ * Returns -1 if the key is not found, and 0 otherwise.
  */
-int delete( int64_t key ) {
+static int delete_on_path( table * t, tree_key key ) {
 
     int64_t key_leaf;
-    char * key_record;
+    int i;
+    leaf_page_t * p;
+
+    key_leaf = latch_path(t, key, true);
+    if (key_leaf == 0)
+        return -1;
+    p = (leaf_page_t *)latch_page(t, key_leaf)->data;
+    i = search_leaf(p, key);
+    if (i == p->num_keys || leaf_key(p, i) != key)
+        return -1;
+
+    delete_entry(t, key_leaf, key);
+    return 0;
+}
+
 
-    key_record = find(key);
-    key_leaf = find_leaf(key);
-    if (key_record != NULL && key_leaf != 0) {
-        delete_entry(key_leaf, key);
-        free(key_record);
+/* Master deletion function.
+ * Returns -1 if the key is not found.
+ */
+static int tree_delete( table * t, bpt_key key ) {
+
+    int i, result;
+    bool safe;
+    tree_key k = KEY_IN(key);
+    buf_frame * f;
+    leaf_page_t * p;
+
+    if (!KEY_FITS(key))
+        return -1;
+
+    begin_op(t);
+
+    /* Case:  the leaf stays at or above minimum.
+     * Only the leaf is latched.
+     */
+
+    f = find_leaf(t, k, true);
+    if (f == NULL) {
+        end_op(t);
+        return -1;
     }
+    p = (leaf_page_t *)f->data;
+    i = search_leaf(p, k);
+
     // The value with key is not found.
-    if (key_record == NULL) {
+    if (i == p->num_keys || leaf_key(p, i) != k) {
+        unlatch(t, f);
+        end_op(t);
         return -1;
     }
+    safe = f->page == get_root(t) ? p->num_keys > 1 :
+        leaf_is_safe(p, leaf_length(p, i), true);
+    if (safe) {
+        hold_latch(f);
+        delete_entry(t, f->page, k);
+        return end_op(t);
+    }
+    unlatch(t, f);
+
+    /* Otherwise latch the path from the root,
+     * which may have changed in the meantime.
+     */
+
+    result = delete_on_path(t, k);
+    return end_op(t) == 0 ? result : -1;
+}
 
-    fd = fileno(data_file);
-    fdatasync(fd);
+
+// BATCHED WRITES
+
+/* Orders the operations of a batch by key, and the
+ * operations on one key as they were given.
+ */
+static int compare_ops( const void * a, const void * b ) {
+    const write_op * x = *(const write_op * const *)a;
+    const write_op * y = *(const write_op * const *)b;
+
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return x < y ? -1 : x > y;
+}
+
+
+/* Applies to a leaf, latched exclusively, the sorted operations
+ * from ops[0] on that leaf, below high, as long as they change it
+ * without a split or a merge.  An insertion of a key the leaf holds,
+ * or a deletion or an update of one it does not, fails without
+ * changing it.  An update replaces the value in place.
+ * Returns the number of operations done; the one after them, if it
+ * is on the leaf, needs the path from the root latched.
+ */
+static int apply_to_leaf( table * t, buf_frame * f, write_op * ops[], int num_ops,
+        tree_key high, bool has_high ) {
+    leaf_page_t * p = (leaf_page_t *)f->data;
+    bool dirty = false, found;
+    int n, i, length = 0;
+
+    for (n = 0; n < num_ops && (!has_high || KEY_IN(ops[n]->key) < high); n++) {
+        i = search_leaf(p, KEY_IN(ops[n]->key));
+        found = i < p->num_keys && leaf_key(p, i) == KEY_IN(ops[n]->key);
+        if (found != (ops[n]->type != WRITE_INSERT)) {
+            ops[n]->result = -1;
+            continue;
+        }
+
+        if (ops[n]->type == WRITE_INSERT) {
+            length = strlen(ops[n]->value) + 1;
+            if (!leaf_fits(p, KEY_IN(ops[n]->key), length))
+                break;
+        }
+        else if (ops[n]->type == WRITE_UPDATE) {
+            length = strlen(ops[n]->value) + 1;
+            if (!leaf_can_replace(p, i, length))
+                break;
+        }
+        else if (f->page == get_root(t) ? p->num_keys == 1 :
+                !leaf_is_safe(p, leaf_length(p, i), true))
+            break;
+
+        if (!dirty) {
+            buf_mark_dirty(t->pool, f);
+            p = (leaf_page_t *)f->data;
+            dirty = true;
+        }
+        if (ops[n]->type != WRITE_INSERT)
+            leaf_remove_at(p, i);
+        if (ops[n]->type != WRITE_DELETE)
+            leaf_insert_at(p, i, KEY_IN(ops[n]->key), ops[n]->value, length);
+        ops[n]->result = 0;
+    }
+
+    return n;
+}
+
+
+/* Updates the value of a key with the path from the root latched,
+ * for the operation in progress, when the leaf may have to split
+ * or merge.  The record is replaced within the one operation, so no
+ * other ever finds the key missing.  growing tells whether the new
+ * value is expected to be the longer one, which decides how the path
+ * is latched; if the value has changed since, the path is released
+ * and latched again the other way before anything is changed.
+ * Returns -1 if the key is not found, and 0 otherwise.
+ */
+static int update_on_path( table * t, tree_key key, char * value, bool growing ) {
+
+    int64_t leaf;
+    int i, length = strlen(value) + 1;
+    buf_frame * f;
+    leaf_page_t * p;
+
+    for (;;) {
+        leaf = latch_path(t, key, !growing);
+        if (leaf == 0)
+            return -1;
+        f = latch_page(t, leaf);
+        p = (leaf_page_t *)f->data;
+        i = search_leaf(p, key);
+        if (i == p->num_keys || leaf_key(p, i) != key)
+            return -1;
+        if (leaf_can_replace(p, i, length) || (length > leaf_length(p, i)) == growing)
+            break;
+        commit_op(t);
+        begin_op(t);
+        growing = !growing;
+    }
+
+    buf_mark_dirty(t->pool, f);
+    p = (leaf_page_t *)f->data;
+    leaf_remove_at(p, i);
+    if (leaf_fits(p, key, length))
+        leaf_insert_at(p, i, key, value, length);
+
+    /* Case:  leaf must be split.
+     */
+    else
+        insert_into_leaf_after_splitting(t, leaf, key, value);
+
+    /* Case:  leaf falls below minimum.
+     */
+    if (!growing && leaf != get_root(t))
+        rebalance_node(t, leaf);
 
     return 0;
 }
 
 
+/* Applies a batch of insertions, deletions and updates.
+ * The operations are sorted by key and done leaf by leaf: the tree
+ * is descended once for each leaf they change, and the operations on
+ * a leaf are committed together.  Only an operation that splits or
+ * merges a leaf latches the path from the root, alone.  Operations
+ * on the same key are done in the order given.
+ * The log is synced once, after the whole batch, so the batch is as
+ * durable as one operation; a crash before the sync may keep any
+ * prefix of the leaves it changed.
+ * The result of each operation is set as insert, delete or update
+ * returns it.
+ * Returns the number of operations that succeeded, or -1 if the log
+ * could not be synced.
+ */
+static int tree_write_batch( table * t, write_op ops[], int num_ops ) {
+    write_op ** sorted;
+    buf_frame * f;
+    leaf_page_t * p;
+    tree_key key, high;
+    bool has_high, growing;
+    uint64_t lsn, last_lsn = 0;
+    int i, k, n, num_sorted = 0, done = 0, result = 0;
+
+    if (num_ops <= 0)
+        return 0;
+
+    sorted = (write_op **) malloc(num_ops * sizeof(write_op *));
+    if (sorted == NULL) {
+        perror("Batch operations.");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < num_ops; i++) {
+        ops[i].result = -1;
+        if (!KEY_FITS(ops[i].key))
+            continue;
+        if (ops[i].type == WRITE_DELETE || ((ops[i].type == WRITE_INSERT ||
+                        ops[i].type == WRITE_UPDATE) &&
+                    strnlen(ops[i].value, MAX_VALUE_SIZE) + 1 <= MAX_VALUE_SIZE))
+            sorted[num_sorted++] = &ops[i];
+    }
+    qsort(sorted, num_sorted, sizeof(write_op *), compare_ops);
+
+    for (i = 0; i < num_sorted; i += n) {
+        begin_op(t);
+
+        n = 0;
+        f = find_leaf_bounded(t, KEY_IN(sorted[i]->key), true, &high, &has_high);
+        if (f != NULL)
+            n = apply_to_leaf(t, f, &sorted[i], num_sorted - i, high, has_high);
+
+        if (n > 0)
+            hold_latch(f);
+        else {
+            // The first operation splits or merges the leaf.
+            key = KEY_IN(sorted[i]->key);
+            growing = true;
+            if (f != NULL) {
+                p = (leaf_page_t *)f->data;
+                k = search_leaf(p, key);
+                if (k < p->num_keys && leaf_key(p, k) == key)
+                    growing = (int)strlen(sorted[i]->value) + 1 > leaf_length(p, k);
+                unlatch(t, f);
+            }
+            if (sorted[i]->type == WRITE_INSERT)
+                sorted[i]->result = insert_on_path(t, key, sorted[i]->value);
+            else if (sorted[i]->type == WRITE_DELETE)
+                sorted[i]->result = delete_on_path(t, key);
+            else
+                sorted[i]->result = update_on_path(t, key, sorted[i]->value, growing);
+            n = 1;
+        }
+
+        lsn = commit_op(t);
+        if (lsn > last_lsn)
+            last_lsn = lsn;
+        if (checkpoint_if_full(t) != 0)
+            result = -1;
+    }
+    free(sorted);
+
+    if (wal_commit(t->log, last_lsn) != 0 || result != 0)
+        return -1;
+    for (i = 0; i < num_ops; i++)
+        if (ops[i].result == 0)
+            done++;
+    return done;
+}
+
+
 // TODO : destroy tree in disk efficiently
 /*
 void destroy_tree_nodes(int64_t root) {
     int i;
-    if (get_is_leaf(root))
-        for (i = 0; i < get_num_keys(root); i++)
+    if (get_is_leaf(t, root))
+        for (i = 0; i < get_num_keys(t, root); i++)
             free(root->pointers[i]);
     else
-        for (i = 0; i < get_num_keys(root) + 1; i++)
-            destroy_tree_nodes(get_internal_value_at(root, i));
+        for (i = 0; i < get_num_keys(t, root) + 1; i++)
+            destroy_tree_nodes(get_internal_value_at(t, root, i));
     
     free(root->pointers);
     free(root->keys);
@@ -1306,170 +2167,147 @@ node * destroy_tree(node * root) {
 
 // GETTERS & SETTERS
 
-// Getters of header page
-
-int64_t get_free_page( void ) {
-    int64_t page;
-
-    fseek(data_file, 0, SEEK_SET);
-    fread(&page, sizeof(int64_t), 1, data_file);
-    return page;
-}
-
-int64_t get_root( void ) {
-    int64_t page;
-
-    fseek(data_file, 8, SEEK_SET);
-    fread(&page, sizeof(int64_t), 1, data_file);
-    return page;
-}
-
-int64_t get_num_pages( void ) {
-    int64_t num;
-    
-    fseek(data_file, 16, SEEK_SET);
-    fread(&num, sizeof(int64_t), 1, data_file);
-    return num;
-}
+/* Every getter and setter pins the page holding the field,
+ * reads or writes the field through the page structs,
+ * and unpins the page again.
+ */
 
 // Getters of node pages
 
-int64_t get_parent_page(int64_t page) {
-    int64_t parent;
-
-    fseek(data_file, page, SEEK_SET);
-    fread(&parent, sizeof(int64_t), 1, data_file);
-    return parent;
-}
-
-int32_t get_is_leaf (int64_t leaf) {
-    int32_t bit;
-
-    fseek(data_file, leaf + 8, SEEK_SET);
-    fread(&bit, sizeof(int32_t), 1, data_file);
+int32_t get_is_leaf (table * t, int64_t leaf) {
+    buf_frame * f = buf_get_page(t->pool, leaf);
+    int32_t bit = ((leaf_page_t *)f->data)->is_leaf;
+    buf_put_page(t->pool, f);
     return bit;
 }
 
-int32_t get_num_keys(int64_t page) {
-    int32_t num;
-
-    fseek(data_file, page + 12, SEEK_SET);
-    fread(&num, sizeof(int32_t), 1, data_file);
+int32_t get_num_keys(table * t, int64_t page) {
+    buf_frame * f = buf_get_page(t->pool, page);
+    int32_t num = ((leaf_page_t *)f->data)->num_keys;
+    buf_put_page(t->pool, f);
     return num;
 }
 
-int64_t get_right_sibling(int64_t leaf) {
-    int64_t page;
-
-    fseek(data_file, leaf + 120, SEEK_SET);
-    fread(&page, sizeof(int64_t), 1, data_file);
+int64_t get_right_sibling(table * t, int64_t leaf) {
+    buf_frame * f = buf_get_page(t->pool, leaf);
+    int64_t page = ((leaf_page_t *)f->data)->right_sibling;
+    buf_put_page(t->pool, f);
     return page;
 }
 
-int64_t get_leaf_key_at(int64_t leaf, int index) {
-    int64_t key;
-
-    fseek(data_file, leaf + ((index + 1) * 128), SEEK_SET);
-    fread(&key, sizeof(int64_t), 1, data_file);
+tree_key get_leaf_key_at(table * t, int64_t leaf, int index) {
+    buf_frame * f = buf_get_page(t->pool, leaf);
+    tree_key key = leaf_key((leaf_page_t *)f->data, index);
+    buf_put_page(t->pool, f);
     return key;
 }
 
-char * get_leaf_value_at(int64_t leaf, int index) {
-    char * value;
-    value = (char *) malloc(sizeof(char) * 120);
-
-    fseek(data_file, leaf + ((index + 1) * 128) + 8, SEEK_SET);
-    fread(value, sizeof(char), 120, data_file);
-    return value;
-}
-
-int64_t get_internal_key_at(int64_t page, int index) {
-    int64_t key;
-
-    fseek(data_file, page + (index * 16) + 128, SEEK_SET);
-    fread(&key, sizeof(int64_t), 1, data_file);
+tree_key get_internal_key_at(table * t, int64_t page, int index) {
+    buf_frame * f = buf_get_page(t->pool, page);
+    tree_key key = node_key((internal_page_t *)f->data, index);
+    buf_put_page(t->pool, f);
     return key;
 }
 
-int64_t get_internal_value_at(int64_t page, int index) {
-    int64_t value;
-
-    fseek(data_file, page + (index * 16) + 120, SEEK_SET);
-    fread(&value, sizeof(int64_t), 1, data_file);
+/* Returns the index-th child pointer of an internal page.
+ * The leftmost child is kept apart from the entries.
+ */
+int64_t get_internal_value_at(table * t, int64_t page, int index) {
+    buf_frame * f = buf_get_page(t->pool, page);
+    int64_t value = node_child((internal_page_t *)f->data, index);
+    buf_put_page(t->pool, f);
     return value;
 }
 
-int64_t get_next_free_page(int64_t page) {
-    int64_t next;
-
-    fseek(data_file, page, SEEK_SET);
-    fread(&next, sizeof(int64_t), 1, data_file);
-    return next;
-}
-
 // Setters
 
-// Setters of header page
+// Setters of node pages
 
-void set_free_page(int64_t page) {
-    fseek(data_file, 0, SEEK_SET);
-    fwrite(&page, sizeof(int64_t), 1, data_file);
+void set_is_leaf(table * t, int64_t page, int32_t bit) {
+    buf_frame * f = buf_get_page(t->pool, page);
+    buf_mark_dirty(t->pool, f);
+    ((leaf_page_t *)f->data)->is_leaf = bit;
+    buf_put_page(t->pool, f);
 }
 
-void set_root(int64_t page) {
-    fseek(data_file, 8, SEEK_SET);
-    fwrite(&page, sizeof(int64_t), 1, data_file);
+void set_num_keys(table * t, int64_t page, int32_t num) {
+    buf_frame * f = buf_get_page(t->pool, page);
+    buf_mark_dirty(t->pool, f);
+    ((leaf_page_t *)f->data)->num_keys = num;
+    buf_put_page(t->pool, f);
 }
 
-void set_num_pages(int64_t num) {
-    fseek(data_file, 16, SEEK_SET);
-    fwrite(&num, sizeof(int64_t), 1, data_file);
+void set_right_sibling(table * t, int64_t leaf, int64_t page) {
+    buf_frame * f = buf_get_page(t->pool, leaf);
+    buf_mark_dirty(t->pool, f);
+    ((leaf_page_t *)f->data)->right_sibling = page;
+    buf_put_page(t->pool, f);
 }
 
-// Setters of node pages
-
-void set_parent_page(int64_t child, int64_t parent) {
-    fseek(data_file, child, SEEK_SET);
-    fwrite(&parent, sizeof(int64_t), 1, data_file);
-}
-
-void set_is_leaf(int64_t page, int32_t bit) {
-    fseek(data_file, page + 8, SEEK_SET);
-    fwrite(&bit, sizeof(int32_t), 1, data_file);
+/* Replaces the key of a record.  The new key must keep
+ * the records in order.
+ */
+void set_leaf_key_at(table * t, int64_t leaf, int index, tree_key key) {
+    buf_frame * f = buf_get_page(t->pool, leaf);
+    leaf_page_t * p = (leaf_page_t *)f->data;
+    char value[MAX_VALUE_SIZE];
+    int length = leaf_length(p, index);
+    buf_mark_dirty(t->pool, f);
+    memcpy(value, leaf_value(p, index), length);
+    leaf_remove_at(p, index);
+    leaf_insert_at(p, index, key, value, length);
+    buf_put_page(t->pool, f);
 }
 
-void set_num_keys(int64_t page, int32_t num) {
-    fseek(data_file, page + 12, SEEK_SET);
-    fwrite(&num, sizeof(int32_t), 1, data_file);
+/* Replaces the value of a record.  The new value must fit
+ * in the leaf once the old one is gone.
+ */
+void set_leaf_value_at(table * t, int64_t leaf, int index, char * value) {
+    buf_frame * f = buf_get_page(t->pool, leaf);
+    leaf_page_t * p = (leaf_page_t *)f->data;
+    tree_key key = leaf_key(p, index);
+    buf_mark_dirty(t->pool, f);
+    leaf_remove_at(p, index);
+    leaf_insert_at(p, index, key, value, strlen(value) + 1);
+    buf_put_page(t->pool, f);
 }
 
-void set_right_sibling(int64_t leaf, int64_t page) {
-    fseek(data_file, leaf + 120, SEEK_SET);
-    fwrite(&page, sizeof(int64_t), 1, data_file);
+void set_leaf_empty(table * t, int64_t leaf) {
+    buf_frame * f = buf_get_page(t->pool, leaf);
+    buf_mark_dirty(t->pool, f);
+    leaf_init((leaf_page_t *)f->data, t->page_size);
+    buf_put_page(t->pool, f);
 }
 
-void set_leaf_key_at(int64_t leaf, int index, int64_t key) {
-    fseek(data_file, leaf + ((index + 1) * 128), SEEK_SET);
-    fwrite(&key, sizeof(int64_t), 1, data_file);
+void set_node_empty(table * t, int64_t page) {
+    buf_frame * f = buf_get_page(t->pool, page);
+    buf_mark_dirty(t->pool, f);
+    node_init((internal_page_t *)f->data, t->page_size);
+    buf_put_page(t->pool, f);
 }
 
-void set_leaf_value_at(int64_t leaf, int index, char * value) {
-    fseek(data_file, leaf + ((index + 1) * 128) + 8, SEEK_SET);
-    fwrite(value, sizeof(char), 120, data_file);
+/* Replaces the index-th key of an internal page.  The page
+ * must be able to hold the new key with the others.
+ */
+void set_internal_key_at(table * t, int64_t page, int index, tree_key key) {
+    buf_frame * f = buf_get_page(t->pool, page);
+    buf_mark_dirty(t->pool, f);
+    node_set_key((internal_page_t *)f->data, index, key);
+    buf_put_page(t->pool, f);
 }
 
-void set_internal_key_at(int64_t page, int index, int64_t key) {
-    fseek(data_file, page + (index * 16) + 128, SEEK_SET);
-    fwrite(&key, sizeof(int64_t), 1, data_file);
+void set_internal_value_at(table * t, int64_t page, int index, int64_t offset) {
+    buf_frame * f = buf_get_page(t->pool, page);
+    buf_mark_dirty(t->pool, f);
+    node_set_child((internal_page_t *)f->data, index, offset);
+    buf_put_page(t->pool, f);
 }
 
-void set_internal_value_at(int64_t page, int index, int64_t offset) {
-    fseek(data_file, page + (index * 16) + 120, SEEK_SET);
-    fwrite(&offset, sizeof(int64_t), 1, data_file);
-}
 
-void set_next_free_page(int64_t page, int64_t next) {
-    fseek(data_file, page, SEEK_SET);
-    fwrite(&next, sizeof(int64_t), 1, data_file);
-}
+// KEY TYPE
 
+const tree_ops KEYED(tree_ops) = {
+    KEY_TYPE, KEY_SIZE, init_leaf, rebuild_space, tree_print_leaves, tree_print_tree,
+    tree_find_view, tree_find_many, tree_cursor_seek, tree_cursor_next, tree_find_at,
+    tree_insert, tree_delete, tree_write_batch, tree_bulk_load, tree_compaction_step
+};
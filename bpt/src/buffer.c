@@ -0,0 +1,879 @@
+/*
+ *  buffer.c
+ *
+ *  Buffer manager of the disk-based B+ tree.
+ *  Pages of the data file are cached in a fixed number of frames.
+ *  Callers pin a page with buf_get_page and unpin it with buf_put_page.
+ *  In IO_MMAP mode a clean page is used in place in a read-only mapping
+ *  of the file, and a changed page is copied to the frame first, so
+ *  pages still reach the file only when written back.
+ *  A frame whose pin count is 0 can be evicted by the clock policy;
+ *  dirty frames are written back to the file before eviction.
+ *  When a log is attached, the pages changed by an operation are kept
+ *  in the pool until buf_commit logs the changed byte ranges, and no
+ *  page is written back before the log records that changed it.
+ *  Each thread runs one operation at a time, and the pages it changes
+ *  must be latched exclusively by it until buf_commit returns.
+ *  With a compressed page store, pages it keeps are decompressed when
+ *  read into a frame and compressed when written back.
+ */
+
+#include <errno.h>
+#include "buffer.h"
+
+/* Frames changed by the operation in progress on this thread.
+ */
+static __thread buf_frame * op_frames = NULL;
+
+// UTILITIES
+
+static int hash_index( buf_pool * pool, int64_t page ) {
+    return (int)((page / pool->page_size) & pool->hash_mask);
+}
+
+static void hash_insert( buf_pool * pool, buf_frame * frame ) {
+    int h = hash_index(pool, frame->page);
+    frame->next_hash = pool->hash[h];
+    pool->hash[h] = frame;
+}
+
+static void hash_remove( buf_pool * pool, buf_frame * frame ) {
+    buf_frame ** p = &pool->hash[hash_index(pool, frame->page)];
+    while (*p != frame)
+        p = &(*p)->next_hash;
+    *p = frame->next_hash;
+    frame->next_hash = NULL;
+}
+
+static buf_frame * hash_find( buf_pool * pool, int64_t page ) {
+    buf_frame * f = pool->hash[hash_index(pool, page)];
+    while (f != NULL && f->page != page)
+        f = f->next_hash;
+    return f;
+}
+
+/* Extends the mapping of the file up to the current file size.
+ * New pages reach the file only when written back, so the
+ * mapping grows as the file does.
+ */
+static void grow_map( buf_pool * pool ) {
+    struct stat st;
+    size_t len;
+
+    if (fstat(pool->fd, &st) != 0)
+        return;
+    len = (size_t)st.st_size / pool->page_size * pool->page_size;
+    if (len > MMAP_RESERVE)
+        len = MMAP_RESERVE;
+    if (len <= pool->map_len)
+        return;
+
+    if (mmap(pool->map + pool->map_len, len - pool->map_len, PROT_READ,
+                MAP_SHARED | MAP_FIXED, pool->fd, pool->map_len) != MAP_FAILED)
+        pool->map_len = len;
+}
+
+/* Points a frame at its page in the mapping of the file,
+ * growing the mapping if needed.  Called with the pool locked.
+ * Returns false if the page is not used in place, in which case
+ * it must be read into the memory of the frame.
+ */
+static bool map_page( buf_pool * pool, buf_frame * frame ) {
+    frame->data = frame->buffer;
+    if (pool->io_mode != IO_MMAP)
+        return false;
+
+    if ((size_t)frame->page + pool->page_size > pool->map_len)
+        grow_map(pool);
+    if ((size_t)frame->page + pool->page_size > pool->map_len)
+        return false;
+    frame->data = pool->map + frame->page;
+    return true;
+}
+
+/* Reads a whole page from the file, or from the compressed page
+ * store if it keeps the page, into the memory of a frame.
+ * A page beyond the end of the file reads as zeros.
+ */
+static void read_page( buf_pool * pool, buf_frame * frame ) {
+    ssize_t n;
+    size_t done = 0;
+
+    if (pool->store != NULL &&
+            (n = zstore_read(pool->store, frame->page, frame->buffer)) > 0) {
+        __atomic_add_fetch(&pool->read_bytes, n, __ATOMIC_RELAXED);
+        return;
+    }
+    while (done < pool->page_size) {
+        n = pread(pool->fd, frame->buffer + done, pool->page_size - done,
+                frame->page + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    __atomic_add_fetch(&pool->read_bytes, done, __ATOMIC_RELAXED);
+    if (done < pool->page_size)
+        memset(frame->buffer + done, 0, pool->page_size - done);
+}
+
+/* Writes a page back to the file, or to the compressed page store
+ * if it keeps the page, after the log records that changed it.
+ * Returns 0, or -1 if the page could not be written, in which case
+ * it stays dirty.
+ */
+static int write_page( buf_pool * pool, buf_frame * frame ) {
+    ssize_t n;
+    size_t done = 0;
+
+    if (pool->log != NULL && frame->page_lsn > 0 &&
+            wal_flush(pool->log, frame->page_lsn) != 0)
+        return -1;
+    if (pool->store != NULL &&
+            (n = zstore_write(pool->store, frame->page, frame->data)) != 0) {
+        if (n < 0)
+            return -1;
+        frame->is_dirty = false;
+        return 0;
+    }
+    while (done < pool->page_size) {
+        n = pwrite(pool->fd, frame->data + done, pool->page_size - done,
+                frame->page + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    frame->is_dirty = false;
+    return 0;
+}
+
+/* Writes back the page of a dirty frame chosen for eviction.
+ * The pool lock is released for the write, so that the write-back,
+ * with the log flush it may wait for, holds up no other thread.
+ * Meanwhile the frame is marked writing, so no other thread takes
+ * it, and latched shared, so its page is not changed; it is still
+ * found by its page.  An unpinned frame has no latch holder.
+ * Called with the pool locked.  Returns true if the frame is still
+ * free for reuse afterwards, clean and not used in the meantime.
+ */
+static bool write_back( buf_pool * pool, buf_frame * f ) {
+    int result;
+
+    if (pthread_rwlock_tryrdlock(&f->latch) != 0)
+        return false;
+    f->writing = true;
+    pthread_mutex_unlock(&pool->lock);
+    result = write_page(pool, f);
+    pthread_rwlock_unlock(&f->latch);
+    pthread_mutex_lock(&pool->lock);
+    f->writing = false;
+    pthread_cond_broadcast(&pool->loaded);
+
+    if (result != 0) {
+        perror("Page write back.");
+        exit(EXIT_FAILURE);
+    }
+    return __atomic_load_n(&f->pin_count, __ATOMIC_ACQUIRE) == 0 &&
+        !f->in_op && !f->is_dirty && !f->ref_bit;
+}
+
+/* Chooses a frame to hold a new page by the clock policy.
+ * A referenced frame gets a second chance, and a pinned frame
+ * is never chosen.  A dirty frame is written back first, for which
+ * the pool lock is released: the caller looks the page up again.
+ * Called with the pool locked.  Returns NULL if every frame is pinned.
+ */
+static buf_frame * try_victim( buf_pool * pool ) {
+    int i;
+    buf_frame * f;
+
+    for (i = 0; i < 2 * pool->num_frames; i++) {
+        f = &pool->frames[pool->clock_hand];
+        pool->clock_hand = (pool->clock_hand + 1) % pool->num_frames;
+
+        if (__atomic_load_n(&f->pin_count, __ATOMIC_ACQUIRE) > 0 || f->in_op ||
+                f->writing)
+            continue;
+        if (f->ref_bit) {
+            f->ref_bit = false;
+            continue;
+        }
+        if (!f->is_dirty || write_back(pool, f))
+            return f;
+    }
+    return NULL;
+}
+
+/* Chooses a frame to hold a new page as try_victim does, waiting
+ * for the frames other threads are writing back if there is no other.
+ */
+static buf_frame * find_victim( buf_pool * pool ) {
+    buf_frame * f;
+    int i;
+
+    while ((f = try_victim(pool)) == NULL) {
+        for (i = 0; i < pool->num_frames && !pool->frames[i].writing; i++)
+            ;
+        if (i == pool->num_frames) {
+            fprintf(stderr, "Every frame of the buffer pool is pinned "
+                    "or changed by the current operation.\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_cond_wait(&pool->loaded, &pool->lock);
+    }
+    return f;
+}
+
+/* Gives a victim frame to a new page and pins it.
+ * The victim is clean, so the old page is on disk before anyone
+ * can miss it.
+ * Called with the pool locked.  Returns true if the page
+ * still has to be read into the frame.
+ */
+static bool claim_frame( buf_pool * pool, buf_frame * f, int64_t page ) {
+    if (f->page != -1)
+        hash_remove(pool, f);
+    f->page = page;
+    f->logged = false;
+    f->page_lsn = 0;
+    __atomic_add_fetch(&f->pin_count, 1, __ATOMIC_ACQUIRE);
+    hash_insert(pool, f);
+    if (map_page(pool, f))
+        return false;
+    f->loading = true;
+    return true;
+}
+
+/* Reads the pages of a list of frames that the compressed page store
+ * keeps, as one batch.  The frames left to read from the file are
+ * moved to the front of the list, in their order.
+ * Returns the number of them.
+ */
+static int read_compressed( buf_pool * pool, buf_frame * frames[], int num_frames ) {
+    buf_frame ** done;
+    int64_t * pages;
+    char ** out;
+    bool * found;
+    int i, m = 0, k = 0;
+
+    pages = (int64_t *) malloc(num_frames * sizeof(int64_t));
+    out = (char **) malloc(num_frames * sizeof(char *));
+    found = (bool *) malloc(num_frames * sizeof(bool));
+    done = (buf_frame **) malloc(num_frames * sizeof(buf_frame *));
+    if (pages == NULL || out == NULL || found == NULL || done == NULL) {
+        perror("Compressed read batch.");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < num_frames; i++) {
+        pages[i] = frames[i]->page;
+        out[i] = frames[i]->buffer;
+    }
+    __atomic_add_fetch(&pool->read_bytes, zstore_read_batch(pool->store, pool->aio,
+                pages, out, num_frames, found), __ATOMIC_RELAXED);
+
+    for (i = 0; i < num_frames; i++) {
+        if (found[i])
+            done[k++] = frames[i];
+        else
+            frames[m++] = frames[i];
+    }
+    memcpy(frames + m, done, k * sizeof(buf_frame *));
+
+    free(done);
+    free(found);
+    free(out);
+    free(pages);
+    return m;
+}
+
+/* Writes the pages of a list of frames that the compressed page
+ * store keeps, as batches.  The frames left to write to the file
+ * are moved to the front of the list.
+ * Returns the number of them, or -1 if a page could not be written.
+ */
+static int write_compressed( buf_pool * pool, buf_frame * frames[], int num_frames ) {
+    buf_frame ** done;
+    int64_t * pages;
+    char ** images;
+    bool * stored;
+    int i, m = 0, k = 0, result;
+
+    pages = (int64_t *) malloc(num_frames * sizeof(int64_t));
+    images = (char **) malloc(num_frames * sizeof(char *));
+    stored = (bool *) malloc(num_frames * sizeof(bool));
+    done = (buf_frame **) malloc(num_frames * sizeof(buf_frame *));
+    if (pages == NULL || images == NULL || stored == NULL || done == NULL) {
+        perror("Compressed write batch.");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < num_frames; i++) {
+        pages[i] = frames[i]->page;
+        images[i] = frames[i]->data;
+    }
+    result = zstore_write_batch(pool->store, pool->aio, pages, images, num_frames, stored);
+
+    for (i = 0; i < num_frames; i++) {
+        if (stored[i])
+            done[k++] = frames[i];
+        else
+            frames[m++] = frames[i];
+    }
+    memcpy(frames + m, done, k * sizeof(buf_frame *));
+
+    free(done);
+    free(stored);
+    free(images);
+    free(pages);
+    return result != 0 ? -1 : m;
+}
+
+// BUFFER POOL
+
+/* Creates a buffer pool of num_frames frames over an open file
+ * of pages of page_size bytes.
+ * io_mode chooses how pages are read and written.  If the address
+ * space for a mapping cannot be reserved, IO_BUFFERED is used.
+ * Frames are aligned to the page size, as IO_DIRECT requires.
+ */
+buf_pool * buf_init( int fd, int num_frames, int io_mode, int page_size ) {
+    buf_pool * pool;
+    int i, hash_size;
+
+    if (num_frames <= 0)
+        num_frames = DEFAULT_BUF_NUM;
+
+    pool = (buf_pool *) malloc(sizeof(buf_pool));
+    if (pool == NULL) {
+        perror("Buffer pool creation.");
+        exit(EXIT_FAILURE);
+    }
+
+    hash_size = 1;
+    while (hash_size < num_frames)
+        hash_size <<= 1;
+
+    pool->fd = fd;
+    pool->page_size = page_size;
+    pool->io_mode = io_mode == IO_MMAP ? IO_BUFFERED : io_mode;
+    pool->map = NULL;
+    pool->map_len = 0;
+    pool->log = NULL;
+    pool->versions = NULL;
+    pool->store = NULL;
+    pool->read_bytes = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->loaded, NULL);
+    pool->aio = aio_open(AIO_DEPTH, true);
+    pool->num_frames = num_frames;
+    pool->clock_hand = 0;
+    pool->hash_mask = hash_size - 1;
+    pool->frames = (buf_frame *) calloc(num_frames, sizeof(buf_frame));
+    if (posix_memalign((void **)&pool->pages, page_size, (size_t)num_frames * page_size) != 0)
+        pool->pages = NULL;
+    pool->hash = (buf_frame **) calloc(hash_size, sizeof(buf_frame *));
+    if (pool->frames == NULL || pool->pages == NULL || pool->hash == NULL) {
+        perror("Buffer pool frames.");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < num_frames; i++) {
+        pool->frames[i].buffer = pool->pages + (size_t)i * pool->page_size;
+        pool->frames[i].data = pool->frames[i].buffer;
+        pool->frames[i].page = -1;
+        pthread_rwlock_init(&pool->frames[i].latch, NULL);
+    }
+
+    if (io_mode == IO_MMAP) {
+        pool->map = (char *) mmap(NULL, MMAP_RESERVE, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (pool->map != MAP_FAILED) {
+            pool->io_mode = IO_MMAP;
+            grow_map(pool);
+        }
+        else
+            pool->map = NULL;
+    }
+
+    return pool;
+}
+
+
+/* Writes back every dirty page and frees the buffer pool.
+ */
+int buf_shutdown( buf_pool * pool ) {
+    int i, result;
+
+    if (pool == NULL)
+        return 0;
+
+    result = buf_flush_all(pool);
+
+    for (i = 0; i < pool->num_frames; i++)
+        pthread_rwlock_destroy(&pool->frames[i].latch);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->loaded);
+    aio_close(pool->aio);
+    if (pool->map != NULL)
+        munmap(pool->map, MMAP_RESERVE);
+    free(pool->hash);
+    free(pool->pages);
+    free(pool->frames);
+    free(pool);
+
+    return result;
+}
+
+
+/* Pins the page at the given offset, reading it from
+ * the file if it is not cached yet.
+ * The page is read without the pool locked, so threads missing
+ * different pages read them at once; a thread asking for a page
+ * being read waits for it.
+ * Returns the frame holding the page.  Pinning does not latch:
+ * the caller latches the frame before using the page if other
+ * threads may change it.
+ */
+buf_frame * buf_get_page( buf_pool * pool, int64_t page ) {
+    buf_frame * f, * victim = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    f = hash_find(pool, page);
+    if (f == NULL) {
+        // Another thread may load the page while a victim is written back.
+        victim = find_victim(pool);
+        f = hash_find(pool, page);
+    }
+    if (f != NULL) {
+        __atomic_add_fetch(&f->pin_count, 1, __ATOMIC_ACQUIRE);
+        f->ref_bit = true;
+        while (f->loading)
+            pthread_cond_wait(&pool->loaded, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+        return f;
+    }
+
+    f = victim;
+    f->ref_bit = true;
+    if (!claim_frame(pool, f, page)) {
+        pthread_mutex_unlock(&pool->lock);
+        return f;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    read_page(pool, f);
+
+    pthread_mutex_lock(&pool->lock);
+    f->loading = false;
+    pthread_cond_broadcast(&pool->loaded);
+    pthread_mutex_unlock(&pool->lock);
+    return f;
+}
+
+
+/* Loads into the pool the pages of a list that are not cached yet,
+ * reading them as one batch through the I/O context of the pool.
+ * Pages adjacent in the file and in the list, as bulk loading lays
+ * out leaves, are read by one request into a staging buffer.
+ * Pages the compressed page store keeps are read from it first.
+ * Pages are loaded only into frames free for reuse, at most a
+ * quarter of the pool per call, and are left unpinned and
+ * unreferenced, so the clock evicts them first if they go unused.
+ * Returns the number of pages read.
+ */
+int buf_prefetch( buf_pool * pool, const int64_t pages[], int num_pages ) {
+    buf_frame ** frames, * f;
+    aio_req * reqs;
+    int * starts;
+    int i, j, k, m, n = 0, num_reqs = 0;
+
+    if (num_pages > pool->num_frames / 4)
+        num_pages = pool->num_frames / 4;
+    if (num_pages <= 0)
+        return 0;
+
+    frames = (buf_frame **) malloc(num_pages * sizeof(buf_frame *));
+    reqs = (aio_req *) malloc(num_pages * sizeof(aio_req));
+    starts = (int *) malloc((num_pages + 1) * sizeof(int));
+    if (frames == NULL || reqs == NULL || starts == NULL) {
+        perror("Prefetch batch.");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    for (i = 0; i < num_pages; i++) {
+        if (hash_find(pool, pages[i]) != NULL)
+            continue;
+        if ((f = try_victim(pool)) == NULL)
+            break;
+        if (hash_find(pool, pages[i]) != NULL)
+            continue;
+        if (claim_frame(pool, f, pages[i]))
+            frames[n++] = f;
+        else
+            __atomic_sub_fetch(&f->pin_count, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    m = pool->store != NULL ? read_compressed(pool, frames, n) : n;
+
+    // Group adjacent pages; a single page is read straight into its frame.
+    for (j = 0; j < m; j = k) {
+        for (k = j + 1; k < m && k - j < PREFETCH_RUN &&
+                frames[k]->page == frames[k - 1]->page + pool->page_size; k++)
+            ;
+        starts[num_reqs] = j;
+        reqs[num_reqs].offset = frames[j]->page;
+        reqs[num_reqs].len = (k - j) * pool->page_size;
+        if (k - j == 1)
+            reqs[num_reqs].buf = frames[j]->buffer;
+        else if (posix_memalign((void **)&reqs[num_reqs].buf, pool->page_size,
+                    reqs[num_reqs].len) != 0) {
+            perror("Prefetch buffer.");
+            exit(EXIT_FAILURE);
+        }
+        num_reqs++;
+    }
+    starts[num_reqs] = m;
+
+    // A page that cannot be read in the batch is read again alone.
+    if (aio_submit(pool->aio, pool->fd, AIO_READ, reqs, num_reqs) != 0)
+        for (j = 0; j < m; j++)
+            read_page(pool, frames[j]);
+    else {
+        __atomic_add_fetch(&pool->read_bytes, (uint64_t)m * pool->page_size,
+                __ATOMIC_RELAXED);
+        for (i = 0; i < num_reqs; i++)
+            for (j = starts[i]; starts[i + 1] - starts[i] > 1 && j < starts[i + 1]; j++)
+                memcpy(frames[j]->buffer, reqs[i].buf +
+                        (size_t)(j - starts[i]) * pool->page_size, pool->page_size);
+    }
+    for (i = 0; i < num_reqs; i++)
+        if (starts[i + 1] - starts[i] > 1)
+            free(reqs[i].buf);
+
+    pthread_mutex_lock(&pool->lock);
+    for (j = 0; j < n; j++) {
+        frames[j]->loading = false;
+        __atomic_sub_fetch(&frames[j]->pin_count, 1, __ATOMIC_RELEASE);
+    }
+    pthread_cond_broadcast(&pool->loaded);
+    pthread_mutex_unlock(&pool->lock);
+
+    free(starts);
+    free(reqs);
+    free(frames);
+    return n;
+}
+
+
+/* Unpins a frame pinned by buf_get_page.
+ * A frame is never evicted while pinned, so unpinning
+ * needs no lock.
+ */
+void buf_put_page( buf_pool * pool, buf_frame * frame ) {
+    (void)pool;
+    __atomic_sub_fetch(&frame->pin_count, 1, __ATOMIC_RELEASE);
+}
+
+
+/* Marks a pinned frame as modified.
+ * Must be called before the page image is changed.
+ * With a log attached, the first change of a page in an operation
+ * adds the frame to the operation, keeping a copy of the page to
+ * find the changed bytes at commit and to keep as an older version.
+ */
+void buf_mark_dirty( buf_pool * pool, buf_frame * frame ) {
+    if (frame->in_op)
+        return;
+
+    /* A page used in place in the mapping is copied to the frame,
+     * which holds it until it is evicted.  Readers of the root do
+     * not latch the header page, so the image is switched atomically.
+     */
+    if (frame->data != frame->buffer) {
+        memcpy(frame->buffer, frame->data, pool->page_size);
+        __atomic_store_n(&frame->data, frame->buffer, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    frame->is_dirty = true;
+    frame->in_op = pool->log != NULL;
+    pthread_mutex_unlock(&pool->lock);
+    if (pool->log == NULL)
+        return;
+
+    if (frame->logged || pool->versions != NULL) {
+        frame->before = (char *) malloc(pool->page_size);
+        if (frame->before == NULL) {
+            perror("Page before image.");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(frame->before, frame->data, pool->page_size);
+    }
+    frame->next_op = op_frames;
+    op_frames = frame;
+}
+
+
+/* Writes back every dirty page that is not part of the operation
+ * in progress, as one batch after a single flush of the log.
+ * Pages the compressed page store keeps go to it in batches of their own.
+ * The pool lock is released for the flush and the writes, as it is
+ * by write_back: the frames are marked writing and latched shared
+ * meanwhile.  Pages other threads are writing back are waited for.
+ * Returns 0, or -1 if a page could not be written.
+ */
+int buf_flush_all( buf_pool * pool ) {
+    buf_frame ** frames, * f;
+    aio_req * reqs;
+    uint64_t lsn = 0;
+    int i, m, n = 0, result = 0;
+
+    frames = (buf_frame **) malloc(pool->num_frames * sizeof(buf_frame *));
+    reqs = (aio_req *) malloc(pool->num_frames * sizeof(aio_req));
+    if (frames == NULL || reqs == NULL) {
+        perror("Write back batch.");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    for (i = 0; i < pool->num_frames; i++) {
+        if (pool->frames[i].writing) {
+            pthread_cond_wait(&pool->loaded, &pool->lock);
+            i = -1;
+        }
+    }
+    for (i = 0; i < pool->num_frames; i++) {
+        f = &pool->frames[i];
+        if (f->page == -1 || !f->is_dirty || f->in_op)
+            continue;
+        if (f->page_lsn > lsn)
+            lsn = f->page_lsn;
+        f->writing = true;
+        frames[n++] = f;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < n; i++)
+        pthread_rwlock_rdlock(&frames[i]->latch);
+
+    if (pool->log != NULL && lsn > 0 && wal_flush(pool->log, lsn) != 0)
+        m = -1;
+    else
+        m = pool->store != NULL ? write_compressed(pool, frames, n) : n;
+    for (i = 0; i < m; i++) {
+        reqs[i].buf = frames[i]->data;
+        reqs[i].offset = frames[i]->page;
+        reqs[i].len = pool->page_size;
+    }
+    if (m < 0 || aio_submit(pool->aio, pool->fd, AIO_WRITE, reqs, m) != 0)
+        result = -1;
+
+    pthread_mutex_lock(&pool->lock);
+    for (i = 0; i < n; i++) {
+        if (result == 0)
+            frames[i]->is_dirty = false;
+        frames[i]->writing = false;
+        pthread_rwlock_unlock(&frames[i]->latch);
+    }
+    pthread_cond_broadcast(&pool->loaded);
+    pthread_mutex_unlock(&pool->lock);
+
+    free(reqs);
+    free(frames);
+    return result;
+}
+
+
+/* Finds the bytes of a page changed by the current operation.
+ * A page not logged since the last checkpoint is logged whole,
+ * so that replay does not depend on a page torn by a crash.
+ */
+static void changed_range( buf_pool * pool, buf_frame * frame, int * lo, int * hi ) {
+    const uint64_t * now = (const uint64_t *)frame->data;
+    const uint64_t * old = (const uint64_t *)frame->before;
+    int a = 0, b = pool->page_size / 8;
+
+    if (!frame->logged) {
+        *lo = 0;
+        *hi = pool->page_size;
+        return;
+    }
+    while (a < b && now[a] == old[a])
+        a++;
+    while (b > a && now[b - 1] == old[b - 1])
+        b--;
+    *lo = a * 8;
+    *hi = b * 8;
+}
+
+
+/* Commits the operation in progress on this thread.
+ * The byte ranges it changed are appended to the log as one record,
+ * and the pages of the operation become evictable again.
+ * The operation also takes the next timestamp of the version store,
+ * which keeps the replaced page images that open snapshots still see.
+ * Returns the LSN of the record, or 0 if nothing was logged.
+ * The caller may release its latches once this returns, and then
+ * makes the record durable with wal_commit.
+ */
+uint64_t buf_commit( buf_pool * pool ) {
+    buf_frame * f;
+    wal_record * header;
+    wal_range range;
+    char * rec;
+    size_t len, cap;
+    uint64_t lsn, ts;
+    int lo, hi;
+
+    if (pool->log == NULL || op_frames == NULL)
+        return 0;
+
+    cap = sizeof(wal_record);
+    for (f = op_frames; f != NULL; f = f->next_op)
+        cap += sizeof(wal_range) + pool->page_size;
+    rec = (char *) malloc(cap);
+    if (rec == NULL) {
+        perror("Log record buffer.");
+        exit(EXIT_FAILURE);
+    }
+
+    len = sizeof(wal_record);
+    for (f = op_frames; f != NULL; f = f->next_op) {
+        changed_range(pool, f, &lo, &hi);
+        if (lo == hi)
+            continue;
+        range.page = f->page;
+        range.offset = lo;
+        range.size = hi - lo;
+        memcpy(rec + len, &range, sizeof(wal_range));
+        memcpy(rec + len + sizeof(wal_range), f->data + lo, hi - lo);
+        len += sizeof(wal_range) + range.size;
+    }
+    header = (wal_record *)rec;
+    header->length = (uint32_t)len;
+
+    lsn = wal_append(pool->log, rec, len);
+    free(rec);
+
+    if (pool->versions != NULL) {
+        ts = mvcc_tick(pool->versions);
+        for (f = op_frames; f != NULL; f = f->next_op)
+            if (f->before != NULL && mvcc_keep(pool->versions, f->page, f->before, ts))
+                f->before = NULL;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while ((f = op_frames) != NULL) {
+        op_frames = f->next_op;
+        f->next_op = NULL;
+        f->in_op = false;
+        f->logged = true;
+        f->page_lsn = lsn;
+        free(f->before);
+        f->before = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return lsn;
+}
+
+
+/* Copies a page as the snapshot taken at ts sees it.
+ * The page is latched shared only while it is copied.
+ */
+void buf_read_version( buf_pool * pool, int64_t page, uint64_t ts, char * out ) {
+    buf_frame * f = buf_get_page(pool, page);
+
+    pthread_rwlock_rdlock(&f->latch);
+    if (pool->versions == NULL || !mvcc_read(pool->versions, page, ts, out, pool->page_size))
+        memcpy(out, f->data, pool->page_size);
+    pthread_rwlock_unlock(&f->latch);
+    buf_put_page(pool, f);
+}
+
+
+/* Cuts the data file to its first len bytes, which must be a whole
+ * number of pages, after dropping the pages past them from the pool
+ * unwritten: they must be free pages.  The mapping of the file is
+ * cut back as well.
+ * Returns 0, or -1 if a page past len is pinned or part of the
+ * operation in progress, in which case nothing is done, or if the
+ * file cannot be cut.
+ */
+int buf_truncate( buf_pool * pool, int64_t len ) {
+    buf_frame * f;
+    int i, result = 0;
+
+    // Pages past len being written back are waited for first.
+    pthread_mutex_lock(&pool->lock);
+    for (i = 0; i < pool->num_frames; i++) {
+        f = &pool->frames[i];
+        if (f->page >= len && f->writing) {
+            pthread_cond_wait(&pool->loaded, &pool->lock);
+            i = -1;
+        }
+    }
+    for (i = 0; i < pool->num_frames; i++) {
+        f = &pool->frames[i];
+        if (f->page >= len && (__atomic_load_n(&f->pin_count, __ATOMIC_ACQUIRE) > 0 ||
+                    f->in_op || f->loading)) {
+            pthread_mutex_unlock(&pool->lock);
+            return -1;
+        }
+    }
+    for (i = 0; i < pool->num_frames; i++) {
+        f = &pool->frames[i];
+        if (f->page < len)
+            continue;
+        hash_remove(pool, f);
+        f->page = -1;
+        f->data = f->buffer;
+        f->is_dirty = false;
+        f->ref_bit = false;
+    }
+
+    if (pool->map != NULL && pool->map_len > (size_t)len) {
+        mmap(pool->map + len, pool->map_len - len, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        pool->map_len = len;
+    }
+    if (ftruncate(pool->fd, len) != 0)
+        result = -1;
+    pthread_mutex_unlock(&pool->lock);
+
+    return result;
+}
+
+
+/* Makes the data file hold every committed change.
+ * The log is synced, every dirty page is written back and the data
+ * file and its compressed page store are synced; the log is then no
+ * longer needed and is emptied.
+ * No operation may be in progress on any thread.
+ */
+int buf_checkpoint( buf_pool * pool ) {
+    int i, result = 0;
+
+    if (pool->log != NULL && wal_flush(pool->log, pool->log->next_lsn) != 0)
+        result = -1;
+    if (buf_flush_all(pool) != 0)
+        result = -1;
+    if (pool->store != NULL && zstore_sync(pool->store) != 0)
+        result = -1;
+    if (fdatasync(pool->fd) != 0)
+        result = -1;
+
+    if (result == 0 && pool->log != NULL) {
+        if (wal_truncate(pool->log) != 0)
+            return -1;
+        pthread_mutex_lock(&pool->lock);
+        for (i = 0; i < pool->num_frames; i++)
+            pool->frames[i].logged = false;
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return result;
+}
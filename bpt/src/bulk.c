@@ -0,0 +1,381 @@
+/*
+ *  bulk.c
+ *
+ *  Bottom-up bulk loading of an empty B+ tree.
+ *  Records are sorted if needed, packed into leaves by bytes at a fill
+ *  factor and written sequentially at the end of the file.  The internal levels are
+ *  then built bottom-up from the first key of each child, each node filled
+ *  as far as the width of its keys allows.  Every page
+ *  position is computed before anything is written, so child pointers and
+ *  sibling links are known when a page is written and no page is revisited.
+ *  The new pages are not logged: they are synced, with the map of the
+ *  compressed page store if the table has one, before the header page
+ *  points to them, and only the header change is committed to the log.
+ *  Write operations wait for the whole load, while readers keep seeing
+ *  the empty tree until the root is switched.
+ */
+
+#include "tree.h"
+
+// Number of pages written to the file at once.
+#define BULK_BATCH 64
+
+/* Type describing one level of the tree being built.
+ * Level 0 is the leaves.  Node i of a level holds the items
+ * starts[i] to starts[i + 1] - 1 of the level below, or the
+ * records for the leaves.
+ */
+typedef struct bulk_level {
+    int64_t first_page;
+    int64_t num_nodes;
+    int64_t * starts;
+} bulk_level;
+
+/* Type of the sequential page writer.
+ * With a compressed page store, pages go to it where it keeps them.
+ */
+typedef struct bulk_writer {
+    int fd;
+    int page_size;
+    zstore * store;
+    aio * aio;
+    char * pages;
+    int num_pages;
+    int64_t next_page;
+    bool failed;
+} bulk_writer;
+
+
+// UTILITIES
+
+static int compare_records( const void * a, const void * b ) {
+    bpt_key ka = ((const record *)a)->key;
+    bpt_key kb = ((const record *)b)->key;
+    return ka < kb ? -1 : ka > kb;
+}
+
+// Returns the bytes the value of a record takes in a leaf.
+static int value_size( const record * r ) {
+    return (int)strnlen(r->value, VALUE_SIZE - 1) + 1;
+}
+
+/* Returns whether records first to end - 1 fit in one leaf
+ * of page_size bytes.
+ */
+static bool leaf_holds( int page_size, const record * records, int64_t first, int64_t end ) {
+    int64_t i, used;
+
+    if (end - first > LEAF_ORDER(page_size) - 1)
+        return false;
+    used = (end - first) * leaf_slot_size(KEY_IN(records[first].key), KEY_IN(records[end - 1].key));
+    for (i = first; i < end; i++)
+        used += value_size(&records[i]);
+    return used <= NODE_SPACE(page_size);
+}
+
+/* Packs the records into leaves of page_size bytes, each filled
+ * until it reaches target bytes or target_keys records, or the next
+ * record does not fit.  Leaf i starts at record starts[i], and starts[num_leaves]
+ * is num_records.  The last leaf is evened out with the one before
+ * it when both still fit, so that it is not left nearly empty.
+ * Returns the number of leaves.
+ */
+static int64_t plan_leaves( int page_size, const record * records, int64_t num_records,
+        int target, int target_keys, int64_t * starts ) {
+    int64_t i, first = 0, n = 0, keys = 0, total;
+    int used = 0, values = 0, size;
+
+    for (i = 0; i < num_records; i++) {
+        size = value_size(&records[i]);
+        if (keys > 0 && (used >= target || keys == target_keys ||
+                    (keys + 1) * leaf_slot_size(KEY_IN(records[first].key), KEY_IN(records[i].key)) +
+                    values + size > NODE_SPACE(page_size))) {
+            values = 0;
+            keys = 0;
+        }
+        if (keys == 0)
+            starts[n++] = first = i;
+        values += size;
+        keys++;
+        used = (int)keys * leaf_slot_size(KEY_IN(records[first].key), KEY_IN(records[i].key)) + values;
+    }
+    starts[n] = num_records;
+
+    if (n > 1) {
+        first = starts[n - 2];
+        total = 0;
+        for (i = first; i < num_records; i++)
+            total += MAX_SLOT_SIZE + value_size(&records[i]);
+        used = 0;
+        for (i = first; i < num_records - 1 && used < total / 2; i++)
+            used += MAX_SLOT_SIZE + value_size(&records[i]);
+        if (leaf_holds(page_size, records, first, i) &&
+                leaf_holds(page_size, records, i, num_records) &&
+                i - first <= target_keys && num_records - i <= target_keys)
+            starts[n - 1] = i;
+    }
+    return n;
+}
+
+/* Returns whether children first to end - 1, whose smallest keys
+ * are in keys, fit in one internal node of page_size bytes.
+ */
+static bool node_holds( int page_size, const tree_key * keys, int64_t first, int64_t end ) {
+    return end - first < 2 ||
+        end - first - 1 <= node_capacity(page_size, keys[first + 1], keys[end - 1]);
+}
+
+/* Packs count children, whose smallest keys are in keys, into
+ * internal nodes of page_size bytes, each filled to fill_factor percent of what the
+ * width of its keys allows.  Node i starts at child starts[i].
+ * The last node is evened out with the one before it as for leaves.
+ * Returns the number of nodes.
+ */
+static int64_t plan_nodes( int page_size, const tree_key * keys, int64_t count,
+        int fill_factor, int64_t * starts ) {
+    int64_t i, first = 0, n = 0, size = 0, target;
+
+    for (i = 0; i < count; i++) {
+        if (size > 1) {
+            target = (node_capacity(page_size, keys[first + 1], keys[i - 1]) *
+                    fill_factor + 50) / 100;
+            if (size - 1 >= (target < 2 ? 2 : target) ||
+                    !node_holds(page_size, keys, first, i + 1))
+                size = 0;
+        }
+        if (size == 0)
+            starts[n++] = first = i;
+        size++;
+    }
+    starts[n] = count;
+
+    if (n > 1) {
+        first = starts[n - 2];
+        i = first + (count - first) / 2;
+        if (node_holds(page_size, keys, first, i) && node_holds(page_size, keys, i, count))
+            starts[n - 1] = i;
+    }
+    return n;
+}
+
+/* Writes the buffered pages past the stream of the buffer pool,
+ * which readers may be using meanwhile.
+ */
+static int flush_writer( bulk_writer * w ) {
+    size_t len = (size_t)w->num_pages * w->page_size;
+    int64_t pages[BULK_BATCH];
+    char * images[BULK_BATCH];
+    bool stored[BULK_BATCH];
+    int i;
+
+    if (w->num_pages == 0)
+        return 0;
+    if (w->store != NULL) {
+        for (i = 0; i < w->num_pages; i++) {
+            pages[i] = (w->next_page - w->num_pages + i) * w->page_size;
+            images[i] = w->pages + (size_t)i * w->page_size;
+        }
+        if (zstore_write_batch(w->store, w->aio, pages, images, w->num_pages, stored) != 0)
+            return -1;
+        for (i = 0; i < w->num_pages; i++)
+            if (!stored[i] && pwrite(w->fd, images[i], w->page_size, pages[i]) != w->page_size)
+                return -1;
+        w->num_pages = 0;
+        return 0;
+    }
+    if (pwrite(w->fd, w->pages, len, (w->next_page - w->num_pages) * w->page_size)
+            != (ssize_t)len)
+        return -1;
+    w->num_pages = 0;
+    return 0;
+}
+
+/* Returns a zeroed page buffer for the next page of the file.
+ */
+static char * next_writer_page( bulk_writer * w ) {
+    char * page;
+
+    if (w->num_pages == BULK_BATCH && flush_writer(w) != 0) {
+        w->failed = true;
+        w->num_pages = 0;
+    }
+    page = w->pages + (size_t)w->num_pages * w->page_size;
+    memset(page, 0, w->page_size);
+    w->num_pages++;
+    w->next_page++;
+    return page;
+}
+
+
+// BULK LOADING
+
+/* Builds the tree of a table from num_records records.
+ * The tree must be empty, and no write operation runs during the
+ * load.  The records are sorted in place when they are not sorted
+ * already; for a duplicated key only the first record in sorted order
+ * is kept, and a key not of the type of the tree is dropped.
+ * fill_factor is the percentage of each node to fill, from 1 to 100.
+ * Returns the number of records loaded, or -1 if the tree is not empty
+ * or the pages could not be written and synced.
+ */
+int64_t tree_bulk_load( table * t, record * records, int64_t num_records, int fill_factor ) {
+    bulk_level levels[64];
+    bulk_writer w;
+    int64_t i, j, n, child, leaf_target;
+    int64_t * starts;
+    tree_key * min_keys;
+    int64_t old_root;
+    int height, h;
+    leaf_page_t * leaf;
+    internal_page_t * node;
+    entry * entries;
+
+    pthread_rwlock_wrlock(&t->op_lock);
+    old_root = get_root(t);
+    if (old_root != 0 && get_num_keys(t, old_root) > 0) {
+        pthread_rwlock_unlock(&t->op_lock);
+        return -1;
+    }
+    if (num_records <= 0) {
+        pthread_rwlock_unlock(&t->op_lock);
+        return 0;
+    }
+
+    if (fill_factor < 1 || fill_factor > 100)
+        fill_factor = DEFAULT_FILL_FACTOR;
+
+    // Sort and drop duplicates and keys of another type.
+    for (i = 1; i < num_records; i++)
+        if (records[i - 1].key > records[i].key)
+            break;
+    if (i < num_records)
+        qsort(records, num_records, sizeof(record), compare_records);
+    for (i = 0, n = 0; i < num_records; i++)
+        if (KEY_FITS(records[i].key) && (n == 0 || records[i].key != records[n - 1].key))
+            records[n++] = records[i];
+    num_records = n;
+    if (num_records == 0) {
+        pthread_rwlock_unlock(&t->op_lock);
+        return 0;
+    }
+
+    leaf_target = ((LEAF_ORDER(t->page_size) - 1) * fill_factor + 50) / 100;
+    if (leaf_target < 1)
+        leaf_target = 1;
+
+    starts = (int64_t *) malloc((num_records + 1) * sizeof(int64_t));
+    entries = (entry *) malloc(INTERNAL_ORDER(t->page_size) * sizeof(entry));
+    if (starts == NULL || entries == NULL) {
+        perror("Bulk loading buffers.");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Plan every level and the page each node will occupy.
+     * New pages are appended after the current end of the file.
+     * min_keys holds the smallest key of each node of the level
+     * being planned on.
+     */
+    levels[0].first_page = get_num_pages(t);
+    levels[0].starts = starts;
+    levels[0].num_nodes = plan_leaves(t->page_size, records, num_records,
+            (NODE_SPACE(t->page_size) * fill_factor + 50) / 100, (int)leaf_target, starts);
+
+    min_keys = (tree_key *) malloc(levels[0].num_nodes * sizeof(tree_key));
+    if (min_keys == NULL) {
+        perror("Bulk loading buffers.");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < levels[0].num_nodes; i++)
+        min_keys[i] = KEY_IN(records[starts[i]].key);
+
+    for (height = 0; levels[height].num_nodes > 1; height++) {
+        levels[height + 1].first_page = levels[height].first_page + levels[height].num_nodes;
+        levels[height + 1].starts = (int64_t *)
+            malloc((levels[height].num_nodes + 1) * sizeof(int64_t));
+        if (levels[height + 1].starts == NULL) {
+            perror("Bulk loading buffers.");
+            exit(EXIT_FAILURE);
+        }
+        levels[height + 1].num_nodes = plan_nodes(t->page_size, min_keys,
+                levels[height].num_nodes, fill_factor, levels[height + 1].starts);
+        for (i = 0; i < levels[height + 1].num_nodes; i++)
+            min_keys[i] = min_keys[levels[height + 1].starts[i]];
+    }
+
+    if (posix_memalign((void **)&w.pages, t->page_size,
+                (size_t)BULK_BATCH * t->page_size) != 0) {
+        perror("Bulk loading buffers.");
+        exit(EXIT_FAILURE);
+    }
+    w.fd = t->fd;
+    w.page_size = t->page_size;
+    w.store = t->store;
+    w.aio = t->pool->aio;
+    w.num_pages = 0;
+    w.next_page = levels[0].first_page;
+    w.failed = false;
+
+    // Leaves.
+    for (i = 0; i < levels[0].num_nodes; i++) {
+        leaf = (leaf_page_t *)next_writer_page(&w);
+        leaf->is_leaf = 1;
+        leaf_init(leaf, t->page_size);
+        for (j = starts[i]; j < starts[i + 1]; j++) {
+            records[j].value[VALUE_SIZE - 1] = '\0';
+            leaf_insert_at(leaf, leaf->num_keys, KEY_IN(records[j].key), records[j].value,
+                    value_size(&records[j]));
+        }
+        leaf->right_sibling = i + 1 < levels[0].num_nodes ?
+            (levels[0].first_page + i + 1) * t->page_size : 0;
+        min_keys[i] = KEY_IN(records[starts[i]].key);
+    }
+
+    // Internal levels, bottom-up.
+    for (h = 1; h <= height; h++) {
+        for (i = 0; i < levels[h].num_nodes; i++) {
+            node = (internal_page_t *)next_writer_page(&w);
+            node_init(node, t->page_size);
+            child = levels[h].starts[i];
+            n = levels[h].starts[i + 1] - child - 1;
+            node->one_more_page = (levels[h - 1].first_page + child) * t->page_size;
+            for (j = 0; j < n; j++) {
+                entries[j].key = min_keys[child + j + 1];
+                entries[j].page = (levels[h - 1].first_page + child + j + 1) * t->page_size;
+            }
+            node_write(node, entries, (int)n);
+            min_keys[i] = min_keys[child];
+        }
+    }
+    if (flush_writer(&w) != 0)
+        w.failed = true;
+
+    free(w.pages);
+    free(min_keys);
+    free(entries);
+    for (h = 0; h <= height; h++)
+        free(levels[h].starts);
+
+    if (w.failed || fdatasync(t->fd) != 0 ||
+            (t->store != NULL && zstore_sync(t->store) != 0)) {
+        pthread_rwlock_unlock(&t->op_lock);
+        return -1;
+    }
+
+    /* The empty root leaf made by open_table is freed, the new pages
+     * join the space map in use, and the header is written once.
+     * The header is latched, as readers may still be looking at the
+     * empty tree.
+     */
+    latch_page(t, 0);
+    if (old_root != 0)
+        free_node(t, old_root);
+    space_extend(t->space, w.next_page);
+    set_root(t, levels[height].first_page * t->page_size);
+    set_num_pages(t, w.next_page);
+
+    // Ends the operation and releases the table.
+    if (end_op(t) != 0)
+        return -1;
+
+    return num_records;
+}
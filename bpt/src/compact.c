@@ -0,0 +1,415 @@
+/*
+ *  compact.c
+ *
+ *  Online compaction of the disk-based B+ tree.
+ *  After much churn the nodes of a tree lie scattered over the file,
+ *  and the file stays as large as the tree ever was.  A compaction
+ *  walks the tree in key order and moves every node to the next page
+ *  from the start of the file, each internal node just before its
+ *  subtree, so the leaves come to lie in key order with the few nodes
+ *  above them in between.  The leaves under each parent are first
+ *  repacked to a fill factor.  Once every node is in place, the free
+ *  pages at the end of the file are cut off.
+ *  The work is done in small steps: each holds the table against
+ *  writers for one move or a few leaves repacked, and latches the pages
+ *  it changes as a writer would, so readers go on meanwhile.  Writes
+ *  between the steps may leave some nodes out of order, which only
+ *  makes the result less tight.
+ */
+
+#include "tree.h"
+
+/* Most pairs of neighboring leaves a step repacks, so a step
+ * changes few pages of the buffer pool whatever the page size.
+ */
+#define REPACK_PAIRS 16
+
+
+// UTILITIES
+
+/* Follows key down from the root, stopping at the page target
+ * or, if target is 0, at the leaf.  Nothing is latched: the caller
+ * holds the table against writers.
+ * Returns whether the path reaches target.
+ */
+static bool descend( table * t, tree_key key, int64_t target, tree_path * path ) {
+    internal_page_t * p;
+    buf_frame * f;
+    int64_t c = get_root(t);
+
+    path->depth = 0;
+    while (c != 0 && path->depth < MAX_HEIGHT) {
+        path->pages[path->depth++] = c;
+        if (c == target)
+            return true;
+        f = buf_get_page(t->pool, c);
+        p = (internal_page_t *)f->data;
+        if (p->is_leaf) {
+            buf_put_page(t->pool, f);
+            return target == 0;
+        }
+        path->index[path->depth - 1] = search_internal(p, key);
+        c = node_child(p, path->index[path->depth - 1]);
+        buf_put_page(t->pool, f);
+    }
+    return false;
+}
+
+
+/* Finds the path to the node at page from its smallest key, or for
+ * an internal node the first key it holds, which leads through it.
+ * Returns false if the node cannot be found.
+ */
+static bool locate( table * t, int64_t page, tree_path * path ) {
+    leaf_page_t * leaf;
+    buf_frame * f;
+    tree_key key = 0;
+    bool has_key;
+
+    f = buf_get_page(t->pool, page);
+    leaf = (leaf_page_t *)f->data;
+    has_key = leaf->num_keys > 0;
+    if (has_key)
+        key = leaf->is_leaf ? leaf_key(leaf, 0) : node_key((internal_page_t *)leaf, 0);
+    buf_put_page(t->pool, f);
+
+    if (page == get_root(t))
+        return descend(t, key, page, path);
+    return has_key && descend(t, key, page, path);
+}
+
+
+/* Returns the leaf to the left of the leaf at the end of a path,
+ * or 0 if it is the leftmost.
+ */
+static int64_t left_leaf( table * t, const tree_path * path ) {
+    int64_t c;
+    int d;
+
+    for (d = path->depth - 2; d >= 0 && path->index[d] == 0; d--)
+        ;
+    if (d < 0)
+        return 0;
+    c = get_internal_value_at(t, path->pages[d], path->index[d] - 1);
+    while (!get_is_leaf(t, c))
+        c = get_internal_value_at(t, c, get_num_keys(t, c));
+    return c;
+}
+
+
+/* Moves the node at the end of a path to the free page at offset to.
+ * Its parent, or the header page for the root, and the leaf to its
+ * left are pointed at the new page, and the old page is freed.
+ */
+static void move_node( table * t, const tree_path * path, int64_t to ) {
+    int64_t from = path->pages[path->depth - 1], left;
+    buf_frame * src, * dst;
+
+    if (path->depth > 1) {
+        latch_page(t, path->pages[path->depth - 2]);
+        set_internal_value_at(t, path->pages[path->depth - 2],
+                path->index[path->depth - 2], to);
+    }
+    else
+        set_root(t, to);
+
+    if (get_is_leaf(t, from) && (left = left_leaf(t, path)) != 0) {
+        latch_page(t, left);
+        set_right_sibling(t, left, to);
+    }
+
+    src = latch_page(t, from);
+    dst = latch_page(t, to);
+    buf_mark_dirty(t->pool, dst);
+    memcpy(dst->data, src->data, t->page_size);
+
+    space_use(t->space, to);
+    free_node(t, from);
+}
+
+
+/* Collects the nodes of the group holding key in the order they are
+ * placed: the ancestors of which the group is the leftmost, the parent
+ * of the leaves and the leaves.  A tree that is a single leaf is a
+ * group of it alone.  path is left at the leaf holding key.
+ * Returns the number of nodes, or 0 if the tree is empty.
+ */
+static int group_nodes( table * t, tree_key key, tree_path * path, int64_t nodes[] ) {
+    internal_page_t * p;
+    buf_frame * f;
+    int a, d, i, n = 0;
+
+    if (!descend(t, key, 0, path) || path->depth == 0)
+        return 0;
+    if (path->depth == 1) {
+        nodes[n++] = path->pages[0];
+        return n;
+    }
+
+    for (a = path->depth - 2; a > 0 && path->index[a - 1] == 0; a--)
+        ;
+    for (d = a; d < path->depth - 1; d++)
+        nodes[n++] = path->pages[d];
+
+    f = buf_get_page(t->pool, path->pages[path->depth - 2]);
+    p = (internal_page_t *)f->data;
+    for (i = 0; i <= p->num_keys; i++)
+        nodes[n++] = node_child(p, i);
+    buf_put_page(t->pool, f);
+    return n;
+}
+
+
+/* Finds the smallest key of the group after the one of the leaf
+ * at the end of a path.  Returns false if it is the last group.
+ */
+static bool next_group( table * t, const tree_path * path, tree_key * key ) {
+    int d;
+
+    for (d = path->depth - 3; d >= 0; d--) {
+        if (path->index[d] < get_num_keys(t, path->pages[d])) {
+            *key = get_internal_key_at(t, path->pages[d], path->index[d]);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/* Repacks the leaves under the parent of the leaf at the end of
+ * a path, filling each to the fill factor of the compaction from the
+ * leaves to its right, and frees the leaves left empty.  The parent
+ * keeps at least one key.  Nothing is done unless a leaf would be
+ * freed.  Only the leaves that change are latched, at most
+ * REPACK_PAIRS pairs of them; the next step goes on from the left,
+ * past the leaves already full.
+ * Returns whether the leaves are repacked.
+ */
+static bool repack( bpt_compaction * c, const tree_path * path ) {
+    table * t = c->table;
+    int64_t parent = path->pages[path->depth - 2], left, right;
+    int target = (NODE_SPACE(t->page_size) * c->fill_factor + 50) / 100;
+    leaf_page_t * tmp, * l, * r;
+    internal_page_t * p;
+    buf_frame * pf, * lf, * rf;
+    int64_t total = 0;
+    int i, k, max, pairs = 0;
+    bool done;
+
+    pf = buf_get_page(t->pool, parent);
+    p = (internal_page_t *)pf->data;
+    for (i = 0; i <= p->num_keys; i++) {
+        lf = buf_get_page(t->pool, node_child(p, i));
+        total += leaf_used((leaf_page_t *)lf->data);
+        buf_put_page(t->pool, lf);
+    }
+    if ((total + target - 1) / target >= p->num_keys + 1) {
+        buf_put_page(t->pool, pf);
+        return true;
+    }
+
+    tmp = (leaf_page_t *) malloc(t->page_size);
+    if (tmp == NULL) {
+        perror("Leaves for repacking.");
+        exit(EXIT_FAILURE);
+    }
+
+    left = node_child(p, 0);
+    for (i = 1; i <= ((internal_page_t *)pf->data)->num_keys && pairs < REPACK_PAIRS; ) {
+        p = (internal_page_t *)pf->data;
+        right = node_child(p, i);
+        lf = buf_get_page(t->pool, left);
+        rf = buf_get_page(t->pool, right);
+        l = (leaf_page_t *)lf->data;
+        r = (leaf_page_t *)rf->data;
+
+        // Fill a copy of the left leaf from the front of the right one.
+        memcpy(tmp, l, t->page_size);
+        max = p->num_keys > 1 ? r->num_keys : r->num_keys - 1;
+        for (k = 0; k < max && leaf_used(tmp) + tmp->key_width + 4 + leaf_length(r, k) <= target &&
+                leaf_fits(tmp, leaf_key(r, k), leaf_length(r, k)); k++)
+            leaf_insert_at(tmp, tmp->num_keys, leaf_key(r, k), leaf_value(r, k),
+                    leaf_length(r, k));
+        if (k > 0 && k < r->num_keys && !node_can_set_key(p, i - 1, leaf_key(r, k)))
+            k = 0;
+        buf_put_page(t->pool, rf);
+        buf_put_page(t->pool, lf);
+        if (k == 0) {
+            left = right;
+            i++;
+            continue;
+        }
+
+        latch_page(t, parent);
+        lf = latch_page(t, left);
+        rf = latch_page(t, right);
+        buf_mark_dirty(t->pool, pf);
+        buf_mark_dirty(t->pool, lf);
+        buf_mark_dirty(t->pool, rf);
+        p = (internal_page_t *)pf->data;
+        l = (leaf_page_t *)lf->data;
+        r = (leaf_page_t *)rf->data;
+        pairs++;
+
+        if (k == r->num_keys) {
+            tmp->right_sibling = r->right_sibling;
+            memcpy(l, tmp, t->page_size);
+            node_remove_at(p, i - 1);
+            free_node(t, right);
+            c->freed++;
+            continue;
+        }
+
+        memcpy(l, tmp, t->page_size);
+        memcpy(tmp, r, t->page_size);
+        leaf_init(r, t->page_size);
+        for (; k < tmp->num_keys; k++)
+            leaf_insert_at(r, r->num_keys, leaf_key(tmp, k), leaf_value(tmp, k),
+                    leaf_length(tmp, k));
+        node_set_key(p, i - 1, leaf_key(r, 0));
+        left = right;
+        i++;
+    }
+    done = i > ((internal_page_t *)pf->data)->num_keys;
+
+    buf_put_page(t->pool, pf);
+    free(tmp);
+    return done;
+}
+
+
+/* Places the node at offset page at the offset dest.  A node in the
+ * way is moved out first, to the first free page after dest; that is
+ * the whole step then, and the node is placed by the next one.
+ * Returns whether the node is placed, or given up if it or the node in
+ * the way cannot be found.
+ */
+static bool place( bpt_compaction * c, int64_t page, int64_t dest ) {
+    table * t = c->table;
+    tree_path path;
+
+    if (!space_is_free(t->space, dest)) {
+        if (!locate(t, dest, &path))
+            return true;
+        move_node(t, &path, make_node(t, dest));
+        c->moved++;
+        return false;
+    }
+    if (locate(t, page, &path)) {
+        move_node(t, &path, dest);
+        c->moved++;
+    }
+    return true;
+}
+
+
+/* Cuts off the free pages at the end of the file.  The cut is
+ * skipped while a snapshot is open, as it may still read the pages;
+ * a later compaction cuts them.
+ * The moves that freed the pages must reach the disk before the file
+ * is cut, or a crash would leave the tree on disk pointing past its
+ * end, so a checkpoint is taken first with every writer kept out.
+ * A page kept compressed frees the sectors of its block instead of
+ * a page of the data file, which is a hole there.
+ * Returns 0, or -1 on error, in which case nothing is cut.
+ */
+static int cut_file( bpt_compaction * c ) {
+    table * t = c->table;
+    int64_t end, num_pages, page, freed;
+
+    pthread_rwlock_wrlock(&t->op_lock);
+    end = space_end(t->space);
+    num_pages = t->space->num_pages;
+    if (end == num_pages || mvcc_in_use(t->versions)) {
+        pthread_rwlock_unlock(&t->op_lock);
+        return 0;
+    }
+    if (checkpoint(t) != 0) {
+        pthread_rwlock_unlock(&t->op_lock);
+        return -1;
+    }
+
+    latch_page(t, 0);
+    if (buf_truncate(t->pool, end * t->page_size) == 0) {
+        space_truncate(t->space, end);
+        set_num_pages(t, end);
+        for (page = end; page < num_pages; page++) {
+            freed = t->store != NULL ? zstore_drop(t->store, page * t->page_size) : 0;
+            c->reclaimed += freed > 0 ? freed : t->page_size;
+        }
+    }
+    return end_op(t);
+}
+
+
+// COMPACTION
+
+/* Runs one step of a compaction: leaves of a group are repacked,
+ * or one node is moved into place, or the end of the file is cut off.
+ * Writers wait for the step, which changes the pages of one move or
+ * of REPACK_PAIRS pairs of leaves at most.
+ * Returns 1 if there is more to do, 0 once the compaction is done,
+ * or -1 on error.
+ */
+int tree_compaction_step( bpt_compaction * c ) {
+    table * t = c->table;
+    tree_key key = KEY_AT_LEAST(c->next_key);
+    tree_path path;
+    int64_t * nodes, freed;
+    int n;
+
+    if (c->done)
+        return 0;
+
+    // The end of the file is cut once every group is placed.
+    if (c->placed_all) {
+        if (cut_file(c) != 0)
+            return -1;
+        c->done = true;
+        return 0;
+    }
+
+    nodes = (int64_t *) malloc((MAX_HEIGHT + INTERNAL_ORDER(t->page_size)) * sizeof(int64_t));
+    if (nodes == NULL) {
+        perror("Compaction group.");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_rwlock_wrlock(&t->op_lock);
+    latch_page(t, 0);
+
+    n = group_nodes(t, key, &path, nodes);
+    if (n > 0 && !c->repacked && path.depth > 1) {
+        freed = c->freed;
+        c->repacked = repack(c, &path);
+
+        // Leaves freed change the group, which the next step finds.
+        if (!c->repacked || c->freed > freed)
+            n = -1;
+    }
+
+    // Nodes already in place are passed over within the step.
+    if (n > 0) {
+        while (c->placed < n && nodes[c->placed] == (c->dest + c->placed) * t->page_size)
+            c->placed++;
+        if (c->placed < n) {
+            if (place(c, nodes[c->placed], (c->dest + c->placed) * t->page_size))
+                c->placed++;
+        }
+        else {
+            c->dest += n;
+            c->placed = 0;
+            c->repacked = false;
+            if (!next_group(t, &path, &key))
+                n = 0;
+            c->next_key = KEY_OUT(key);
+        }
+    }
+    if (n == 0)
+        c->placed_all = true;
+    free(nodes);
+
+    if (end_op(t) != 0)
+        return -1;
+    return 1;
+}
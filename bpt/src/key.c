@@ -0,0 +1,162 @@
+/*
+ *  key.c
+ *
+ *  Keys of the disk-based B+ tree, as text and as bytes.
+ *  Integer keys are written in decimal.  A UUID is written in its
+ *  usual form of 32 hex digits in groups of 8-4-4-4-12, and is read
+ *  with or without the dashes.  A string key is written as the string,
+ *  and a longer string is refused rather than cut.
+ */
+
+#include <errno.h>
+#include "key.h"
+
+// UTILITIES
+
+static int hex_digit( char c ) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// KEYS
+
+/* Returns the bytes of a key of a type at full width,
+ * or -1 if there is no such type.
+ */
+int key_size( int key_type ) {
+    switch (key_type) {
+    case KEY_INT64:
+        return 8;
+    case KEY_INT32:
+        return 4;
+    case KEY_UUID:
+    case KEY_STR16:
+        return 16;
+    default:
+        return -1;
+    }
+}
+
+
+/* Returns the type of key named int64, int32, uuid or str16,
+ * or -1 for any other name.
+ */
+int key_type_parse( const char * name ) {
+    static const char * names[NUM_KEY_TYPES] = { "int64", "int32", "uuid", "str16" };
+    int i;
+
+    for (i = 0; i < NUM_KEY_TYPES; i++)
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    return -1;
+}
+
+
+/* Reads a key from the bytes of a key of the type,
+ * the most significant first.
+ */
+bpt_key key_from_bytes( int key_type, const unsigned char * bytes ) {
+    unsigned __int128 key = 0;
+    int i, size = key_size(key_type);
+
+    for (i = 0; i < size; i++)
+        key = key << 8 | bytes[i];
+    if (key_type == KEY_INT64)
+        return (int64_t)key;
+    if (key_type == KEY_INT32)
+        return (int32_t)key;
+    return (bpt_key)(key ^ KEY_BIAS);
+}
+
+
+void key_to_bytes( int key_type, bpt_key key, unsigned char * bytes ) {
+    unsigned __int128 k = (unsigned __int128)key;
+    int i;
+
+    if (key_type == KEY_UUID || key_type == KEY_STR16)
+        k ^= KEY_BIAS;
+    for (i = key_size(key_type) - 1; i >= 0; i--) {
+        bytes[i] = (unsigned char)k;
+        k >>= 8;
+    }
+}
+
+
+/* Writes the text of a key of the type into buf, which has room
+ * for KEY_TEXT_SIZE bytes, and returns buf.
+ */
+char * key_format( int key_type, bpt_key key, char * buf ) {
+    unsigned char bytes[16];
+    char * p = buf;
+    int i;
+
+    switch (key_type) {
+    case KEY_UUID:
+        key_to_bytes(key_type, key, bytes);
+        for (i = 0; i < 16; i++) {
+            if (i == 4 || i == 6 || i == 8 || i == 10)
+                *p++ = '-';
+            p += sprintf(p, "%02x", bytes[i]);
+        }
+        break;
+    case KEY_STR16:
+        key_to_bytes(key_type, key, (unsigned char *)buf);
+        buf[16] = '\0';
+        break;
+    default:
+        snprintf(buf, KEY_TEXT_SIZE, "%lld", (long long)key);
+        break;
+    }
+    return buf;
+}
+
+
+/* Reads a key of the type from text.
+ * Returns 0 on success, -1 if text is not such a key.
+ */
+int key_parse( int key_type, const char * text, bpt_key * key ) {
+    unsigned char bytes[16] = { 0 };
+    size_t length;
+    char * end;
+    long long value;
+    int i, hi, lo;
+
+    switch (key_type) {
+    case KEY_UUID:
+        for (i = 0; i < 16; i++) {
+            if (*text == '-' && (i == 4 || i == 6 || i == 8 || i == 10))
+                text++;
+            if ((hi = hex_digit(text[0])) < 0 || (lo = hex_digit(text[1])) < 0)
+                return -1;
+            bytes[i] = (unsigned char)(hi << 4 | lo);
+            text += 2;
+        }
+        if (*text != '\0')
+            return -1;
+        break;
+    case KEY_STR16:
+        length = strlen(text);
+        if (length > 16)
+            return -1;
+        memcpy(bytes, text, length);
+        break;
+    case KEY_INT64:
+    case KEY_INT32:
+        errno = 0;
+        value = strtoll(text, &end, 10);
+        if (end == text || *end != '\0' || errno == ERANGE ||
+                (key_type == KEY_INT32 && (value < INT32_MIN || value > INT32_MAX)))
+            return -1;
+        *key = value;
+        return 0;
+    default:
+        return -1;
+    }
+    *key = key_from_bytes(key_type, bytes);
+    return 0;
+}
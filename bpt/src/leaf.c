@@ -0,0 +1,268 @@
+/*
+ *  leaf.c
+ *
+ *  Slotted leaf pages of the disk-based B+ tree.
+ *  A leaf begins with the node header and a directory of slots in key
+ *  order, each holding a key and the place of its value.  The values
+ *  are kept in a heap that grows down from the end of the page, so a
+ *  leaf holds as many records as their values leave room for.
+ *  Keys are stored as distances from the base key of the leaf, so a
+ *  slot takes 6, 8, 12 or 20 bytes depending on how far apart the keys
+ *  of the leaf are.  A key that does not fit the width of the leaf
+ *  rewrites the slots with a new base and width.
+ *  Removing a record leaves a hole in the heap; holes are squeezed out
+ *  only when a new value does not fit between the slots and the heap.
+ *  A leaf is full when either its slots or its space run out, and
+ *  underflows when both are less than half used.
+ */
+
+#include <stddef.h>
+#include "tree.h"
+
+// UTILITIES
+
+static char * slot_at( const leaf_page_t * leaf, int index ) {
+    return (char *)leaf->slots + (size_t)index * (leaf->key_width + 4);
+}
+
+/* Returns the first byte after the slots of a leaf
+ * holding num_keys records.
+ */
+static int slots_end( const leaf_page_t * leaf, int num_keys ) {
+    return (int)offsetof(leaf_page_t, slots) + num_keys * (leaf->key_width + 4);
+}
+
+static void set_slot( leaf_page_t * leaf, int index, tree_key key, int offset, int length ) {
+    char * s = slot_at(leaf, index);
+    uint16_t place[2] = { (uint16_t)offset, (uint16_t)length };
+
+    store_delta(s, leaf->key_width, (tree_ukey)key - (tree_ukey)leaf->key_base);
+    memcpy(s + leaf->key_width, place, sizeof(place));
+}
+
+/* Finds the base and width a leaf needs to hold key as well.
+ * They are the ones it has now when key fits them.
+ */
+static void encoding_for( const leaf_page_t * leaf, tree_key key,
+        tree_key * base, int * width ) {
+    tree_ukey delta = (tree_ukey)key - (tree_ukey)leaf->key_base;
+    tree_key first, last;
+
+    *base = leaf->key_base;
+    *width = leaf->key_width;
+    if (leaf->num_keys > 0 && key >= leaf->key_base &&
+            (*width == KEY_SIZE || delta >> (8 * *width) == 0))
+        return;
+
+    if (leaf->num_keys == 0) {
+        *base = key;
+        *width = key_width(key, key);
+        return;
+    }
+    first = leaf_key(leaf, 0);
+    last = leaf_key(leaf, leaf->num_keys - 1);
+    *base = key < first ? key : first;
+    *width = key_width(*base, key > last ? key : last);
+}
+
+/* Rewrites every slot of a leaf with a new base and width, and
+ * moves every value to the end of the page, leaving no hole in the heap.
+ */
+static void rebuild( leaf_page_t * leaf, tree_key base, int width ) {
+    char copy[MAX_PAGE_SIZE];
+    leaf_page_t * old = (leaf_page_t *)copy;
+    int i, length, top = leaf->page_size;
+
+    memcpy(copy, leaf, leaf->page_size);
+    leaf->key_base = base;
+    leaf->key_width = width;
+    for (i = 0; i < old->num_keys; i++) {
+        length = leaf_length(old, i);
+        top -= length;
+        memcpy((char *)leaf + top, leaf_value(old, i), length);
+        set_slot(leaf, i, leaf_key(old, i), top, length);
+    }
+    leaf->heap_start = top;
+    leaf->heap_free = 0;
+}
+
+// LEAF PAGES
+
+/* Empties a leaf of page_size bytes.  The other header fields
+ * are left as they are.
+ */
+void leaf_init( leaf_page_t * leaf, int page_size ) {
+    leaf->page_size = page_size;
+    leaf->num_keys = 0;
+    leaf->heap_start = page_size;
+    leaf->heap_free = 0;
+    leaf->key_base = 0;
+    leaf->key_width = key_width(0, 0);
+}
+
+
+/* Returns the bytes a slot takes in a leaf whose smallest key
+ * is min_key and largest max_key.
+ */
+int leaf_slot_size( tree_key min_key, tree_key max_key ) {
+    return key_width(min_key, max_key) + 4;
+}
+
+
+tree_key leaf_key( const leaf_page_t * leaf, int index ) {
+    return (tree_key)((tree_ukey)leaf->key_base + load_delta(slot_at(leaf, index), leaf->key_width));
+}
+
+
+/* Returns the value of the index-th record of a leaf,
+ * a string inside the page.
+ */
+char * leaf_value( const leaf_page_t * leaf, int index ) {
+    uint16_t offset;
+
+    memcpy(&offset, slot_at(leaf, index) + leaf->key_width, sizeof(offset));
+    return (char *)leaf + offset;
+}
+
+
+/* Returns the size of the index-th value with its terminating null.
+ */
+int leaf_length( const leaf_page_t * leaf, int index ) {
+    uint16_t length;
+
+    memcpy(&length, slot_at(leaf, index) + leaf->key_width + 2, sizeof(length));
+    return length;
+}
+
+
+/* Returns the bytes of a leaf taken by its slots and values.
+ */
+int leaf_used( const leaf_page_t * leaf ) {
+    return leaf->num_keys * (leaf->key_width + 4) +
+        leaf->page_size - leaf->heap_start - leaf->heap_free;
+}
+
+
+/* Returns whether a record with key and a value of length bytes
+ * can be added to a leaf without splitting it.
+ */
+bool leaf_fits( const leaf_page_t * leaf, tree_key key, int length ) {
+    tree_key base;
+    int width;
+
+    encoding_for(leaf, key, &base, &width);
+    return leaf->num_keys < LEAF_ORDER(leaf->page_size) - 1 &&
+        leaf_used(leaf) + leaf->num_keys * (width - leaf->key_width) +
+        width + 4 + length <= NODE_SPACE(leaf->page_size);
+}
+
+
+/* Returns whether a leaf below the root holds too little
+ * and must take records from or give them to a neighbor.
+ */
+bool leaf_underflows( const leaf_page_t * leaf ) {
+    return leaf->num_keys < cut(LEAF_ORDER(leaf->page_size) - 1) &&
+        leaf_used(leaf) < NODE_SPACE(leaf->page_size) / 2;
+}
+
+
+/* Returns whether adding a record with a value of length bytes
+ * to a leaf, or removing one, leaves the leaf without a split
+ * or an underflow.  An added key may be any, so the slots are
+ * counted at full width.
+ */
+bool leaf_is_safe( const leaf_page_t * leaf, int length, bool deleting ) {
+    int space = NODE_SPACE(leaf->page_size);
+
+    if (!deleting)
+        return leaf->num_keys < LEAF_ORDER(leaf->page_size) - 1 &&
+            leaf_used(leaf) + leaf->num_keys * (KEY_SIZE - leaf->key_width) +
+            MAX_SLOT_SIZE + length <= space;
+    return leaf->num_keys - 1 >= cut(LEAF_ORDER(leaf->page_size) - 1) ||
+        leaf_used(leaf) - (leaf->key_width + 4) - length >= space / 2;
+}
+
+
+/* Returns whether the value at index can be replaced by one of
+ * length bytes without a split, and without an underflow unless
+ * the leaf already held no more.
+ */
+bool leaf_can_replace( const leaf_page_t * leaf, int index, int length ) {
+    int used = leaf_used(leaf) - leaf_length(leaf, index) + length;
+
+    return used <= NODE_SPACE(leaf->page_size) && (used >= leaf_used(leaf) ||
+            leaf->num_keys >= cut(LEAF_ORDER(leaf->page_size) - 1) ||
+            used >= NODE_SPACE(leaf->page_size) / 2);
+}
+
+
+/* Returns whether the records of two leaves fit in one.
+ * Either may take the other's records, keeping its own width
+ * while the keys fit it, so the wider of the two is assumed.
+ */
+bool leaf_can_merge( const leaf_page_t * leaf, const leaf_page_t * other ) {
+    tree_key first, last;
+    int n = leaf->num_keys + other->num_keys;
+    int order = LEAF_ORDER(leaf->page_size), space = NODE_SPACE(leaf->page_size);
+    int values = leaf_used(leaf) - leaf->num_keys * (leaf->key_width + 4) +
+        leaf_used(other) - other->num_keys * (other->key_width + 4);
+    int size;
+
+    if (leaf->num_keys == 0 || other->num_keys == 0)
+        return n <= order - 1 && leaf_used(leaf) + leaf_used(other) <= space;
+    first = leaf_key(leaf, 0) < leaf_key(other, 0) ? leaf_key(leaf, 0) : leaf_key(other, 0);
+    last = leaf_key(leaf, leaf->num_keys - 1);
+    if (leaf_key(other, other->num_keys - 1) > last)
+        last = leaf_key(other, other->num_keys - 1);
+    size = leaf_slot_size(first, last);
+    if (leaf->key_width + 4 > size)
+        size = leaf->key_width + 4;
+    if (other->key_width + 4 > size)
+        size = other->key_width + 4;
+    return n <= order - 1 && n * size + values <= space;
+}
+
+
+/* Inserts a record at index, shifting the later slots right.
+ * The record must fit; the slots are rewritten if the key does not
+ * fit their width, and the heap is compacted if the value does not
+ * fit in the gap above it.
+ */
+void leaf_insert_at( leaf_page_t * leaf, int index, tree_key key,
+        const char * value, int length ) {
+    tree_key base;
+    int width;
+
+    encoding_for(leaf, key, &base, &width);
+    if (base != leaf->key_base || width != leaf->key_width)
+        rebuild(leaf, base, width);
+    if (leaf->heap_start - length < slots_end(leaf, leaf->num_keys + 1))
+        rebuild(leaf, base, width);
+
+    leaf->heap_start -= length;
+    memcpy((char *)leaf + leaf->heap_start, value, length);
+
+    memmove(slot_at(leaf, index + 1), slot_at(leaf, index),
+            (size_t)(leaf->num_keys - index) * (width + 4));
+    set_slot(leaf, index, key, leaf->heap_start, length);
+    leaf->num_keys++;
+}
+
+
+/* Removes the record at index, shifting the later slots left.
+ * Its value becomes a hole unless it lies at the start of the heap.
+ */
+void leaf_remove_at( leaf_page_t * leaf, int index ) {
+    int length = leaf_length(leaf, index);
+
+    if (leaf_value(leaf, index) == (char *)leaf + leaf->heap_start)
+        leaf->heap_start += length;
+    else
+        leaf->heap_free += length;
+
+    memmove(slot_at(leaf, index), slot_at(leaf, index + 1),
+            (size_t)(leaf->num_keys - index - 1) * (leaf->key_width + 4));
+    leaf->num_keys--;
+    if (leaf->num_keys == 0)
+        leaf_init(leaf, leaf->page_size);
+}
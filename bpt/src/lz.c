@@ -0,0 +1,184 @@
+/*
+ *  lz.c
+ *
+ *  Page compression of the disk-based B+ tree.
+ *  A fast LZ77 codec writing the block format of LZ4: each sequence is
+ *  a token holding the number of literals and the length of the match
+ *  that follow, in 4 bits each and extended by bytes of 255, then the
+ *  literals, then the 16-bit distance back to the match.  The last
+ *  sequence has literals only.  Matches are found through a table of
+ *  the last position of each hash of 4 bytes, as in LZ4 at its fastest
+ *  setting; the decompressor checks every length and distance, so a
+ *  damaged block is refused rather than read past its ends.
+ */
+
+#include "lz.h"
+
+// Last bytes of a block that are always literals, as LZ4 requires.
+#define LAST_LITERALS 5
+
+// Matches begin at least this many bytes before the end of a block.
+#define MATCH_LIMIT 12
+
+// UTILITIES
+
+static uint32_t read32( const uint8_t * p ) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static int hash( uint32_t v ) {
+    return (int)((v * 2654435761u) >> (32 - LZ_HASH_BITS));
+}
+
+/* Writes the part of a length beyond what its token holds.
+ */
+static uint8_t * put_length( uint8_t * op, size_t n ) {
+    for (; n >= 255; n -= 255)
+        *op++ = 255;
+    *op++ = (uint8_t)n;
+    return op;
+}
+
+/* Reads the part of a length beyond what its token holds.
+ * Returns false if the block ends first.
+ */
+static bool get_length( const uint8_t ** ip, const uint8_t * end, size_t * n ) {
+    uint8_t b;
+
+    do {
+        if (*ip >= end)
+            return false;
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+    return true;
+}
+
+/* Appends one sequence: the literals from anchor up to match,
+ * then a match of match_len bytes at the given distance, if any.
+ * Returns the end of the output, or NULL if it does not fit.
+ */
+static uint8_t * put_sequence( uint8_t * op, uint8_t * out_end, const uint8_t * anchor,
+        size_t num_literals, size_t offset, size_t match_len ) {
+    uint8_t * token;
+
+    if ((size_t)(out_end - op) < 1 + num_literals / 255 + 1 + num_literals +
+            (offset > 0 ? 2 + match_len / 255 + 1 : 0))
+        return NULL;
+
+    token = op++;
+    *token = (uint8_t)((num_literals >= 15 ? 15 : num_literals) << 4);
+    if (num_literals >= 15)
+        op = put_length(op, num_literals - 15);
+    memcpy(op, anchor, num_literals);
+    op += num_literals;
+    if (offset == 0)
+        return op;
+
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+    match_len -= LZ_MIN_MATCH;
+    *token |= (uint8_t)(match_len >= 15 ? 15 : match_len);
+    if (match_len >= 15)
+        op = put_length(op, match_len - 15);
+    return op;
+}
+
+// CODEC
+
+/* Compresses len bytes of src into at most cap bytes of dst.
+ * Returns the length of the compressed block, or 0 if it would
+ * not fit in cap bytes.
+ */
+int lz_compress( const char * src, int len, char * dst, int cap ) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    const uint8_t * in = (const uint8_t *)src;
+    const uint8_t * end = in + len;
+    const uint8_t * ip = in, * anchor = in, * ref, * m;
+    uint8_t * op = (uint8_t *)dst, * out_end = op + cap;
+    int h;
+
+    memset(table, 0, sizeof(table));
+    while (len > MATCH_LIMIT && ip < end - MATCH_LIMIT) {
+        h = hash(read32(ip));
+        ref = in + table[h];
+        table[h] = (uint32_t)(ip - in);
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != read32(ip)) {
+            // Step faster through bytes that do not match.
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+            ip--;
+            ref--;
+        }
+        for (m = ip + LZ_MIN_MATCH; m < end - LAST_LITERALS && *m == ref[m - ip]; m++)
+            ;
+
+        op = put_sequence(op, out_end, anchor, ip - anchor, ip - ref, m - ip);
+        if (op == NULL)
+            return 0;
+        anchor = ip = m;
+        if (ip - 2 > in)
+            table[hash(read32(ip - 2))] = (uint32_t)(ip - 2 - in);
+    }
+
+    op = put_sequence(op, out_end, anchor, end - anchor, 0, 0);
+    if (op == NULL)
+        return 0;
+    return (int)(op - (uint8_t *)dst);
+}
+
+
+/* Decompresses a block of len bytes into at most cap bytes of dst.
+ * Returns the length of the output, or -1 if the block is damaged
+ * or its output does not fit.
+ */
+int lz_decompress( const char * src, int len, char * dst, int cap ) {
+    const uint8_t * ip = (const uint8_t *)src, * in_end = ip + len;
+    uint8_t * out = (uint8_t *)dst, * op = out, * out_end = out + cap;
+    const uint8_t * ref;
+    size_t num_literals, match_len, offset, n;
+    uint8_t token;
+
+    while (ip < in_end) {
+        token = *ip++;
+        num_literals = token >> 4;
+        if (num_literals == 15 && !get_length(&ip, in_end, &num_literals))
+            return -1;
+        if (num_literals > (size_t)(in_end - ip) || num_literals > (size_t)(out_end - op))
+            return -1;
+        memcpy(op, ip, num_literals);
+        ip += num_literals;
+        op += num_literals;
+        if (ip == in_end)
+            break;
+
+        if (in_end - ip < 2)
+            return -1;
+        offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        match_len = token & 15;
+        if (match_len == 15 && !get_length(&ip, in_end, &match_len))
+            return -1;
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - out) || match_len > (size_t)(out_end - op))
+            return -1;
+
+        // A match may overlap its own output: copy it a period at a time.
+        ref = op - offset;
+        while (match_len > 0) {
+            n = op - ref;
+            if (n > match_len)
+                n = match_len;
+            memcpy(op, ref, n);
+            op += n;
+            match_len -= n;
+        }
+    }
+
+    return (int)(op - out);
+}
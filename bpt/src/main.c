@@ -1,29 +1,90 @@
 #include "bpt.h"
 
+/* Reads a key of the type written as key_format writes it.
+ * Returns whether a key was read.
+ */
+static bool scan_key( FILE * fp, int key_type, bpt_key * key ) {
+    char text[KEY_TEXT_SIZE];
+
+    return fscanf(fp, "%39s", text) == 1 && key_parse(key_type, text, key) == 0;
+}
+
 // MAIN
 
 int main( int argc, char ** argv ) {
 
     char * input_file;
     FILE * fp;
-    int input, range2;
-    char input2[120];
+    bpt_key input, range2;
+    char input2[MAX_VALUE_SIZE];
+    char value[VALUE_SIZE];
     char instruction;
     char license_part;
     char pathname[150];
-    int result;
+    int result, table_id, key_type = KEY_INT64;
+    record * records;
+    int64_t num_records, max_records, reclaimed;
+    char text[KEY_TEXT_SIZE];
 
     license_notice();
     usage_1();  
     usage_2();
 
+    if (argc > 2 && strcmp(argv[1], "-k") == 0) {
+        key_type = key_type_parse(argv[2]);
+        if (key_type < 0) {
+            printf("Unknown type of key %s.\n", argv[2]);
+            exit(EXIT_FAILURE);
+        }
+        argc -= 2;
+        argv += 2;
+    }
+
+    table_id = -1;
     if (argc > 1) {
-        if (open_db(argv[1]) != 0) {
+        table_id = open_table(argv[1], DEFAULT_BUF_NUM, DURABILITY_COMMIT, IO_BUFFERED, 0, key_type);
+        if (table_id < 0) {
             perror("Failure open db file.");
         }
     }
 
-    if (argc > 2) {
+    if (argc > 3 && strcmp(argv[2], "-b") == 0) {
+        fp = fopen(argv[3], "r");
+        if (fp == NULL) {
+            perror("Failure  open input file.");
+            exit(EXIT_FAILURE);
+        }
+        num_records = 0;
+        max_records = 1024;
+        records = (record *) malloc(max_records * sizeof(record));
+        while (records != NULL &&
+                fscanf(fp, "i %39s %119s\n", text, value) == 2) {
+            if (num_records == max_records) {
+                max_records *= 2;
+                records = (record *) realloc(records, max_records * sizeof(record));
+                if (records == NULL)
+                    break;
+            }
+            if (key_parse(key_type, text, &records[num_records].key) != 0)
+                continue;
+            snprintf(records[num_records].value, VALUE_SIZE, "%s", value);
+            num_records++;
+        }
+        if (records == NULL) {
+            perror("Failure read input file.");
+            exit(EXIT_FAILURE);
+        }
+        fclose(fp);
+        num_records = bulk_load(table_id, records, num_records,
+                argc > 4 ? atoi(argv[4]) : DEFAULT_FILL_FACTOR);
+        free(records);
+        if (num_records < 0)
+            printf("Failure bulk loading : the table is not open, the tree "
+                    "is not empty, or the pages could not be written.\n");
+        else
+            printf("Bulk loaded %ld records.\n", num_records);
+    }
+    else if (argc > 2) {
         input_file = argv[2];
         fp = fopen(input_file, "r");
         if (fp == NULL) {
@@ -31,11 +92,12 @@ int main( int argc, char ** argv ) {
             exit(EXIT_FAILURE);
         }
         while (!feof(fp)) {
-            fscanf(fp, "i %d %s\n", &input, input2);
-            insert(input, input2);
+            if (fscanf(fp, "i %39s %1023s\n", text, input2) == 2 &&
+                    key_parse(key_type, text, &input) == 0)
+                insert(table_id, input, input2);
         }
         fclose(fp);
-        print_tree();
+        print_tree(table_id);
     }
 
     if (argc == 1) {
@@ -47,7 +109,8 @@ int main( int argc, char ** argv ) {
             printf("> ");
         }
         scanf("%s", pathname);
-        if (open_db(pathname) != 0) {
+        table_id = open_table(pathname, DEFAULT_BUF_NUM, DURABILITY_COMMIT, IO_BUFFERED, 0, key_type);
+        if (table_id < 0) {
             perror("Failure open db file.");
         }
         while (getchar() != (int)'\n');
@@ -56,46 +119,67 @@ int main( int argc, char ** argv ) {
     printf("> ");
     while (scanf("%c", &instruction) != EOF) {
         switch (instruction) {
+        case 'o':
+            scanf("%s", pathname);
+            result = open_table(pathname, DEFAULT_BUF_NUM, DURABILITY_COMMIT, IO_BUFFERED, 0, key_type);
+            if (result < 0)
+                perror("Failure open db file.");
+            else {
+                table_id = result;
+                printf("Table %d opened.\n", table_id);
+            }
+            break;
         case 'd':
-            scanf("%d", &input);
-            result = delete(input);
+            if (!scan_key(stdin, key_type, &input))
+                break;
+            result = delete(table_id, input);
             if (result == 0) 
                 printf("Deletion success.\n");
             else if (result == -1)
-                printf("Failure deletion : value with key %d not found.\n", input);
+                printf("Failure deletion : value with key %s not found.\n",
+                        key_format(key_type, input, text));
             else 
                 perror("Failure deletion.");
-            print_tree();
+            print_tree(table_id);
             break;
         case 'i':
-            scanf("%d %s", &input, input2);
-            insert(input, input2);
-            print_tree();
+            if (!scan_key(stdin, key_type, &input) || scanf("%1023s", input2) != 1)
+                break;
+            insert(table_id, input, input2);
+            print_tree(table_id);
             break;
         case 'f':
-            scanf("%d", &input);
-            find_and_print(input);
+            if (scan_key(stdin, key_type, &input))
+                find_and_print(table_id, input);
             break;
         //case 'p':
         case 'r':
-            scanf("%d %d", &input, &range2);
+            if (!scan_key(stdin, key_type, &input) || !scan_key(stdin, key_type, &range2))
+                break;
             if (input > range2) {
-                int tmp = range2;
+                bpt_key tmp = range2;
                 range2 = input;
                 input = tmp;
             }
-            //find_and_print_range(root, input, range2, instruction == 'p');
+            find_and_print_range(table_id, input, range2);
             break;
         case 'l':
-            print_leaves();
+            print_leaves(table_id);
+            break;
+        case 'c':
+            reclaimed = compact_table(table_id, DEFAULT_FILL_FACTOR);
+            if (reclaimed < 0)
+                perror("Failure compaction.");
+            else
+                printf("Compaction reclaimed %ld bytes.\n", reclaimed);
             break;
         case 'q':
             while (getchar() != (int)'\n');
-            fclose(data_file);
+            close_all_tables();
             return EXIT_SUCCESS;
             break;
         case 't':
-            print_tree();
+            print_tree(table_id);
             break;
         /*
         case 'x':
@@ -112,6 +196,7 @@ int main( int argc, char ** argv ) {
         printf("> ");
     }
     printf("\n");
+    close_all_tables();
 
     return EXIT_SUCCESS;
 }
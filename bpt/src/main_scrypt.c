@@ -1,35 +1,40 @@
 #include "bpt.h"
 
 int main(){
-    int64_t input;
+    bpt_key input;
+    char text[KEY_TEXT_SIZE];
     char instruction;
     char buf[120];
-    char *result;
+    char value[MAX_VALUE_SIZE];
+    int table_id;
     
-   open_db("test.db");
+   table_id = open_table("test.db", DEFAULT_BUF_NUM, DURABILITY_COMMIT, IO_BUFFERED, 0, KEY_INT64);
     while(scanf("%c", &instruction) != EOF){
         switch(instruction){
             case 'i':
-                scanf("%ld %s", &input, buf);
-                insert(input, buf);
+                if (scanf("%39s %119s", text, buf) == 2 &&
+                        key_parse(KEY_INT64, text, &input) == 0)
+                    insert(table_id, input, buf);
                 
                break;
             case 'f':
-                scanf("%ld", &input);
-                result = find(input);
-                if (result) {
-                    printf("Key: %ld, Value: %s\n", input, result);
+                if (scanf("%39s", text) == 1 &&
+                        key_parse(KEY_INT64, text, &input) == 0 &&
+                        find_into(table_id, input, value, sizeof(value)) >= 0) {
+                    printf("Key: %s, Value: %s\n", key_format(KEY_INT64, input, text), value);
                 } else
                     printf("Not Exists\n");
 
                 fflush(stdout);
                 break;
             case 'd':
-                scanf("%ld", &input);
-                delete(input);
+                if (scanf("%39s", text) == 1 &&
+                        key_parse(KEY_INT64, text, &input) == 0)
+                    delete(table_id, input);
                 break;
             case 'q':
                 while (getchar() != (int)'\n');
+                close_table(table_id);
                 return EXIT_SUCCESS;
                 break;   
 
@@ -37,5 +42,6 @@ int main(){
         while (getchar() != (int)'\n');
     }
     printf("\n");
+    close_table(table_id);
     return 0;
 }
\ No newline at end of file
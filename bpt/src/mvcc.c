@@ -0,0 +1,207 @@
+/*
+ *  mvcc.c
+ *
+ *  Page versions for snapshot reads of the disk-based B+ tree.
+ *  Writers change pages in place.  When an operation commits while an
+ *  older snapshot is open, the images its pages had before it are kept
+ *  in memory, stamped with the commit timestamp.  A snapshot reads each
+ *  page as the oldest kept version replaced after it was taken, or as
+ *  the current page if no such version exists.  Versions that no open
+ *  snapshot can see are freed when a snapshot ends.
+ */
+
+#include "mvcc.h"
+
+// UTILITIES
+
+static page_version ** bucket( mvcc * m, int64_t page ) {
+    return &m->hash[(page >> 12) & (MVCC_HASH_SIZE - 1)];
+}
+
+/* Frees a version and every version older than it.
+ */
+static void free_versions( page_version * v ) {
+    page_version * older;
+
+    for (; v != NULL; v = older) {
+        older = v->older;
+        free(v->image);
+        free(v);
+    }
+}
+
+/* Frees the versions that no open snapshot can see:
+ * those replaced at or before the oldest open snapshot.
+ */
+static void collect( mvcc * m ) {
+    page_version ** p, * v, * keep;
+    uint64_t min_ts;
+    int i;
+
+    min_ts = m->oldest != NULL ? m->oldest->ts : UINT64_MAX;
+    for (i = 0; i < MVCC_HASH_SIZE; i++) {
+        p = &m->hash[i];
+        while ((v = *p) != NULL) {
+            // Versions are chained newest first.
+            if (v->end_ts <= min_ts) {
+                *p = v->next_hash;
+                free_versions(v);
+                continue;
+            }
+            for (keep = v; keep->older != NULL && keep->older->end_ts > min_ts; )
+                keep = keep->older;
+            free_versions(keep->older);
+            keep->older = NULL;
+            p = &v->next_hash;
+        }
+    }
+}
+
+// VERSION STORE
+
+mvcc * mvcc_create( void ) {
+    mvcc * m;
+
+    m = (mvcc *) calloc(1, sizeof(mvcc));
+    if (m == NULL) {
+        perror("Version store creation.");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&m->lock, NULL);
+    return m;
+}
+
+
+/* Frees the version store.  No snapshot may be open.
+ */
+void mvcc_destroy( mvcc * m ) {
+    if (m == NULL)
+        return;
+    m->oldest = NULL;
+    collect(m);
+    pthread_mutex_destroy(&m->lock);
+    free(m);
+}
+
+
+/* Returns the timestamp of an operation that is committing.
+ */
+uint64_t mvcc_tick( mvcc * m ) {
+    uint64_t ts;
+
+    pthread_mutex_lock(&m->lock);
+    ts = ++m->clock;
+    pthread_mutex_unlock(&m->lock);
+    return ts;
+}
+
+
+/* Keeps the image a page had before the commit with timestamp end_ts,
+ * if a snapshot taken before that commit is open.
+ * The caller must hold the page latched exclusively.
+ * Returns true if the store took the image, which the caller
+ * must then not free.
+ */
+bool mvcc_keep( mvcc * m, int64_t page, char * image, uint64_t end_ts ) {
+    page_version ** p, * v;
+
+    pthread_mutex_lock(&m->lock);
+    if (m->oldest == NULL || m->oldest->ts >= end_ts) {
+        pthread_mutex_unlock(&m->lock);
+        return false;
+    }
+
+    v = (page_version *) malloc(sizeof(page_version));
+    if (v == NULL) {
+        perror("Page version.");
+        exit(EXIT_FAILURE);
+    }
+    v->page = page;
+    v->end_ts = end_ts;
+    v->image = image;
+    v->older = NULL;
+
+    p = bucket(m, page);
+    while (*p != NULL && (*p)->page != page)
+        p = &(*p)->next_hash;
+    if (*p != NULL) {
+        v->older = *p;
+        v->next_hash = (*p)->next_hash;
+        (*p)->next_hash = NULL;
+    }
+    else
+        v->next_hash = NULL;
+    *p = v;
+
+    pthread_mutex_unlock(&m->lock);
+    return true;
+}
+
+
+/* Copies the image of a page as a snapshot taken at ts sees it.
+ * The caller must hold the page latched, at least shared.
+ * Returns false if the current page is that image, in which case
+ * nothing is copied.
+ */
+bool mvcc_read( mvcc * m, int64_t page, uint64_t ts, char * out, size_t size ) {
+    page_version * v, * found = NULL;
+
+    pthread_mutex_lock(&m->lock);
+    for (v = *bucket(m, page); v != NULL && v->page != page; v = v->next_hash)
+        ;
+    for (; v != NULL && v->end_ts > ts; v = v->older)
+        found = v;
+    if (found != NULL)
+        memcpy(out, found->image, size);
+    pthread_mutex_unlock(&m->lock);
+
+    return found != NULL;
+}
+
+
+/* Opens a snapshot of every operation committed so far.
+ */
+void mvcc_begin( mvcc * m, mvcc_snapshot * snapshot ) {
+    pthread_mutex_lock(&m->lock);
+    snapshot->ts = m->clock;
+    snapshot->prev = m->newest;
+    snapshot->next = NULL;
+    if (m->newest != NULL)
+        m->newest->next = snapshot;
+    else
+        m->oldest = snapshot;
+    m->newest = snapshot;
+    pthread_mutex_unlock(&m->lock);
+}
+
+
+/* Closes a snapshot and frees the versions only it could see.
+ */
+void mvcc_end( mvcc * m, mvcc_snapshot * snapshot ) {
+    pthread_mutex_lock(&m->lock);
+    if (snapshot->prev != NULL)
+        snapshot->prev->next = snapshot->next;
+    else
+        m->oldest = snapshot->next;
+    if (snapshot->next != NULL)
+        snapshot->next->prev = snapshot->prev;
+    else
+        m->newest = snapshot->prev;
+
+    // Only the oldest snapshot holds back versions no other needs.
+    if (snapshot->prev == NULL)
+        collect(m);
+    pthread_mutex_unlock(&m->lock);
+}
+
+
+/* Returns whether a snapshot is open.
+ */
+bool mvcc_in_use( mvcc * m ) {
+    bool in_use;
+
+    pthread_mutex_lock(&m->lock);
+    in_use = m->oldest != NULL;
+    pthread_mutex_unlock(&m->lock);
+    return in_use;
+}
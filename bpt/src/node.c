@@ -0,0 +1,358 @@
+/*
+ *  node.c
+ *
+ *  Compressed keys and internal pages of the disk-based B+ tree.
+ *  A node stores its keys by frame of reference: the page keeps a base
+ *  key, and each key as its distance from the base in 2, 4, 8 or 16
+ *  bytes, the fewest that hold the widest distance, and never more than
+ *  a key of the type the tree is built for takes.  The keys of a node near the
+ *  leaves are usually close, so such a node holds several times more
+ *  entries than with full keys.  A key that does not fit the width of a
+ *  node rewrites the node with a new base and width.
+ *  An internal page keeps its keys in one array from the start of the
+ *  page and the page numbers of its children, 4 bytes each, in another
+ *  at the end, so the search compares runs of keys at once.  How many
+ *  entries an internal page holds thus depends on the width of its keys.
+ */
+
+#include "tree.h"
+
+// UTILITIES
+
+/* Returns the number of entries an internal page of page_size
+ * bytes has room for with keys of the given width.
+ */
+static int room( int page_size, int width ) {
+    return NODE_SPACE(page_size) / (width + 4);
+}
+
+/* Returns the number of keys an internal page of page_size bytes
+ * may hold with keys of the given width.
+ */
+static int capacity( int page_size, int width ) {
+    int order = INTERNAL_ORDER(page_size);
+
+    return room(page_size, width) < order - 1 ? room(page_size, width) : order - 1;
+}
+
+static char * key_at( const internal_page_t * p, int index ) {
+    return (char *)p->entries + (size_t)index * p->key_width;
+}
+
+// Returns the page numbers of the children right of each key.
+static uint32_t * children( const internal_page_t * p ) {
+    return (uint32_t *)((char *)p + p->page_size) - room(p->page_size, p->key_width);
+}
+
+/* Returns room for the entries of an internal page, read out.
+ */
+static entry * alloc_entries( const internal_page_t * p ) {
+    entry * entries = (entry *) malloc(INTERNAL_ORDER(p->page_size) * sizeof(entry));
+
+    if (entries == NULL) {
+        perror("Node entries.");
+        exit(EXIT_FAILURE);
+    }
+    return entries;
+}
+
+/* Returns whether key can be stored with the base and width
+ * a page has now.
+ */
+static bool encodes( const internal_page_t * p, tree_key key ) {
+    tree_ukey delta = (tree_ukey)key - (tree_ukey)p->key_base;
+
+    if (p->num_keys == 0 || key < p->key_base)
+        return false;
+    return p->key_width == KEY_SIZE || delta >> (8 * p->key_width) == 0;
+}
+
+/* Inserts an entry by rewriting the whole page,
+ * which takes the base and width of the new key set.
+ */
+static void rewrite_insert( internal_page_t * p, int index, tree_key key, int64_t child ) {
+    entry * entries = alloc_entries(p);
+    int n = node_read(p, entries);
+
+    memmove(&entries[index + 1], &entries[index], (n - index) * sizeof(entry));
+    entries[index].key = key;
+    entries[index].page = child;
+    node_write(p, entries, n + 1);
+    free(entries);
+}
+
+// COMPRESSED KEYS
+
+/* Returns the width in bytes of the keys of a node
+ * whose smallest key is min_key and largest max_key.
+ */
+int key_width( tree_key min_key, tree_key max_key ) {
+    tree_ukey range = (tree_ukey)max_key - (tree_ukey)min_key;
+    int width = 2;
+
+    if (!compress_keys)
+        return KEY_SIZE;
+    while (width < KEY_SIZE && range >> (8 * width) != 0)
+        width *= 2;
+    return width;
+}
+
+
+/* Reads a distance of width bytes, which need not be aligned.
+ */
+tree_ukey load_delta( const char * p, int width ) {
+    uint16_t d16;
+    uint32_t d32;
+    uint64_t d64;
+    tree_ukey d;
+
+    switch (width) {
+    case 2:
+        memcpy(&d16, p, 2);
+        return d16;
+    case 4:
+        memcpy(&d32, p, 4);
+        return d32;
+    case 8:
+        memcpy(&d64, p, 8);
+        return (tree_ukey)d64;
+    default:
+        memcpy(&d, p, KEY_SIZE);
+        return d;
+    }
+}
+
+
+void store_delta( char * p, int width, tree_ukey delta ) {
+    uint16_t d16 = (uint16_t)delta;
+    uint32_t d32 = (uint32_t)delta;
+    uint64_t d64 = (uint64_t)delta;
+
+    switch (width) {
+    case 2:
+        memcpy(p, &d16, 2);
+        break;
+    case 4:
+        memcpy(p, &d32, 4);
+        break;
+    case 8:
+        memcpy(p, &d64, 8);
+        break;
+    default:
+        memcpy(p, &delta, KEY_SIZE);
+    }
+}
+
+// INTERNAL PAGES
+
+/* Empties an internal page of page_size bytes.  The other
+ * header fields are left as they are.
+ */
+void node_init( internal_page_t * p, int page_size ) {
+    p->page_size = page_size;
+    p->num_keys = 0;
+    p->key_base = 0;
+    p->key_width = key_width(0, 0);
+}
+
+
+/* Returns the number of keys an internal page of page_size bytes
+ * may hold when its smallest key is min_key and its largest max_key.
+ */
+int node_capacity( int page_size, tree_key min_key, tree_key max_key ) {
+    return capacity(page_size, key_width(min_key, max_key));
+}
+
+
+tree_key node_key( const internal_page_t * p, int index ) {
+    return (tree_key)((tree_ukey)p->key_base + load_delta(key_at(p, index), p->key_width));
+}
+
+
+/* Returns the offset of the index-th child,
+ * the leftmost child being child 0.
+ */
+int64_t node_child( const internal_page_t * p, int index ) {
+    if (index == 0)
+        return p->one_more_page;
+    return (int64_t)children(p)[index - 1] * p->page_size;
+}
+
+
+/* Replaces the index-th key.  The page must be able to hold it.
+ */
+void node_set_key( internal_page_t * p, int index, tree_key key ) {
+    entry * entries;
+    int n;
+
+    if (encodes(p, key)) {
+        store_delta(key_at(p, index), p->key_width, (tree_ukey)key - (tree_ukey)p->key_base);
+        return;
+    }
+    entries = alloc_entries(p);
+    n = node_read(p, entries);
+    entries[index].key = key;
+    node_write(p, entries, n);
+    free(entries);
+}
+
+
+void node_set_child( internal_page_t * p, int index, int64_t page ) {
+    if (index == 0)
+        p->one_more_page = page;
+    else
+        children(p)[index - 1] = (uint32_t)(page / p->page_size);
+}
+
+
+/* Reads the keys of an internal page, each with the child
+ * to its right, into entries.  The leftmost child is not read.
+ * Returns the number of entries.
+ */
+int node_read( const internal_page_t * p, entry entries[] ) {
+    int i;
+
+    for (i = 0; i < p->num_keys; i++) {
+        entries[i].key = node_key(p, i);
+        entries[i].page = node_child(p, i + 1);
+    }
+    return p->num_keys;
+}
+
+
+/* Replaces the keys of an internal page and the children right of
+ * them with num_entries sorted entries, stored as narrow as they allow.
+ * The leftmost child is left as it is.
+ */
+void node_write( internal_page_t * p, const entry entries[], int num_entries ) {
+    tree_ukey base;
+    int i;
+
+    p->num_keys = num_entries;
+    if (num_entries == 0) {
+        node_init(p, p->page_size);
+        return;
+    }
+    p->key_base = entries[0].key;
+    p->key_width = key_width(entries[0].key, entries[num_entries - 1].key);
+    base = (tree_ukey)p->key_base;
+    for (i = 0; i < num_entries; i++) {
+        store_delta(key_at(p, i), p->key_width, (tree_ukey)entries[i].key - base);
+        children(p)[i] = (uint32_t)(entries[i].page / p->page_size);
+    }
+}
+
+
+/* Returns whether key can be inserted into an internal page
+ * without splitting it.
+ */
+bool node_fits( const internal_page_t * p, tree_key key ) {
+    tree_key first, last;
+
+    if (p->num_keys == 0)
+        return true;
+    if (encodes(p, key))
+        return p->num_keys < capacity(p->page_size, p->key_width);
+    first = node_key(p, 0);
+    last = node_key(p, p->num_keys - 1);
+    return p->num_keys < node_capacity(p->page_size, key < first ? key : first,
+            key > last ? key : last);
+}
+
+
+/* Returns whether the index-th key of an internal page
+ * can be replaced by key without overfilling the page.
+ */
+bool node_can_set_key( const internal_page_t * p, int index, tree_key key ) {
+    tree_key first, last;
+
+    if (encodes(p, key))
+        return true;
+    first = index == 0 ? key : node_key(p, 0);
+    last = index == p->num_keys - 1 ? key : node_key(p, p->num_keys - 1);
+    return p->num_keys <= node_capacity(p->page_size, first, last);
+}
+
+
+/* Returns whether an internal page below the root holds
+ * fewer keys than half of what its width allows.
+ */
+bool node_underflows( const internal_page_t * p ) {
+    return p->num_keys < cut(capacity(p->page_size, p->key_width) + 1) - 1;
+}
+
+
+/* Returns whether adding a key to an internal page, or removing one,
+ * leaves it without a split or an underflow.  On insertion the key
+ * may be any, so the page must have room for one more at full width.
+ */
+bool node_is_safe( const internal_page_t * p, bool deleting ) {
+    if (deleting)
+        return p->num_keys > cut(capacity(p->page_size, p->key_width) + 1) - 1;
+    return p->num_keys < capacity(p->page_size, KEY_SIZE);
+}
+
+
+/* Returns whether two neighboring internal pages, with k_prime
+ * between them, fit in one.
+ */
+bool node_can_merge( const internal_page_t * left, tree_key k_prime,
+        const internal_page_t * right ) {
+    tree_key first = left->num_keys > 0 ? node_key(left, 0) : k_prime;
+    tree_key last = right->num_keys > 0 ? node_key(right, right->num_keys - 1) : k_prime;
+
+    return left->num_keys + right->num_keys + 1 <= node_capacity(left->page_size, first, last);
+}
+
+
+/* Returns where to split num_entries sorted entries of an internal
+ * page of page_size bytes that overflows: the first split - 1 stay,
+ * the key of the next moves up and the rest go to a new page.  The
+ * halves are even unless the keys of one need a width that leaves it
+ * too little room.
+ */
+int node_split( int page_size, const entry entries[], int num_entries ) {
+    int split = cut(num_entries);
+
+    while (split < num_entries - 1 && num_entries - split >
+            node_capacity(page_size, entries[split].key, entries[num_entries - 1].key))
+        split++;
+    while (split > 2 && split - 1 >
+            node_capacity(page_size, entries[0].key, entries[split - 2].key))
+        split--;
+    return split;
+}
+
+
+/* Inserts a key at index with the child to its right,
+ * shifting the later entries right.  The page must be able to hold it.
+ */
+void node_insert_at( internal_page_t * p, int index, tree_key key, int64_t child ) {
+    uint32_t * c;
+    int w;
+
+    if (!encodes(p, key)) {
+        rewrite_insert(p, index, key, child);
+        return;
+    }
+    w = p->key_width;
+    c = children(p);
+    memmove(key_at(p, index + 1), key_at(p, index), (size_t)(p->num_keys - index) * w);
+    memmove(&c[index + 1], &c[index], (p->num_keys - index) * sizeof(uint32_t));
+    store_delta(key_at(p, index), w, (tree_ukey)key - (tree_ukey)p->key_base);
+    c[index] = (uint32_t)(child / p->page_size);
+    p->num_keys++;
+}
+
+
+/* Removes the index-th key with the child to its right.
+ * The other keys keep their base and width.
+ */
+void node_remove_at( internal_page_t * p, int index ) {
+    uint32_t * c = children(p);
+    int w = p->key_width;
+
+    memmove(key_at(p, index), key_at(p, index + 1), (size_t)(p->num_keys - index - 1) * w);
+    memmove(&c[index], &c[index + 1], (p->num_keys - index - 1) * sizeof(uint32_t));
+    p->num_keys--;
+}
@@ -0,0 +1,324 @@
+/*
+ *  search.c
+ *
+ *  Key search inside a single node page.
+ *  Keys are searched as distances from the base key of the node, in the
+ *  width the node stores them, by code generated for each width.
+ *  Leaves are searched by a branchless binary search over the slots.
+ *  Internal pages are narrowed by the same binary search down to a small
+ *  window of keys, which is then counted by a compare-and-count kernel
+ *  for the width of the keys.
+ *  The kernels are chosen at run time: AVX2 or SSE4.2 when the CPU has
+ *  them, scalar code otherwise.
+ */
+
+#include "tree.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEARCH_X86
+#endif
+
+// Number of keys left to the kernel after binary search.
+#define SEARCH_WINDOW 16
+
+/* Type representing the kernels for each key width.
+ * Each counts the keys less than or equal to key.
+ */
+typedef struct search_kernels {
+    int (*count16)(const uint16_t * keys, int n, uint16_t key);
+    int (*count32)(const uint32_t * keys, int n, uint32_t key);
+    int (*count64)(const uint64_t * keys, int n, uint64_t key);
+} search_kernels;
+
+/* The kernels used by search_internal, picked for this CPU on
+ * the first search.  Threads may race on that first search,
+ * so the pointer is read and written atomically.
+ */
+static const search_kernels * kernels;
+
+
+// KERNELS
+
+static int count16_scalar(const uint16_t * keys, int n, uint16_t key) {
+    int i, count = 0;
+
+    for (i = 0; i < n; i++)
+        count += keys[i] <= key;
+    return count;
+}
+
+static int count32_scalar(const uint32_t * keys, int n, uint32_t key) {
+    int i, count = 0;
+
+    for (i = 0; i < n; i++)
+        count += keys[i] <= key;
+    return count;
+}
+
+static int count64_scalar(const uint64_t * keys, int n, uint64_t key) {
+    int i, count = 0;
+
+    for (i = 0; i < n; i++)
+        count += keys[i] <= key;
+    return count;
+}
+
+static const search_kernels scalar_kernels = {
+    count16_scalar, count32_scalar, count64_scalar
+};
+
+#ifdef SEARCH_X86
+
+/* The keys are unsigned.  A key is less than or equal to the search
+ * key exactly when the smaller of the two is the key itself.  There
+ * is no unsigned 64-bit compare, so both sides are offset by 2^63
+ * and compared signed.
+ */
+__attribute__((target("sse4.2")))
+static int count16_sse42(const uint16_t * keys, int n, uint16_t key) {
+    int i, count = 0;
+    __m128i k = _mm_set1_epi16((short)key);
+    __m128i v;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        v = _mm_loadu_si128((const __m128i *)&keys[i]);
+        v = _mm_cmpeq_epi16(_mm_min_epu16(v, k), v);
+        count += __builtin_popcount(_mm_movemask_epi8(v)) / 2;
+    }
+    return count + count16_scalar(keys + i, n - i, key);
+}
+
+__attribute__((target("sse4.2")))
+static int count32_sse42(const uint32_t * keys, int n, uint32_t key) {
+    int i, count = 0;
+    __m128i k = _mm_set1_epi32((int)key);
+    __m128i v;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        v = _mm_loadu_si128((const __m128i *)&keys[i]);
+        v = _mm_cmpeq_epi32(_mm_min_epu32(v, k), v);
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(v)));
+    }
+    return count + count32_scalar(keys + i, n - i, key);
+}
+
+__attribute__((target("sse4.2")))
+static int count64_sse42(const uint64_t * keys, int n, uint64_t key) {
+    int i, count = 0;
+    __m128i bias = _mm_set1_epi64x(INT64_MIN);
+    __m128i k = _mm_xor_si128(_mm_set1_epi64x((int64_t)key), bias);
+    __m128i v;
+
+    for (i = 0; i + 2 <= n; i += 2) {
+        v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&keys[i]), bias);
+        v = _mm_cmpgt_epi64(v, k);
+        count += 2 - __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(v)));
+    }
+    return count + count64_scalar(keys + i, n - i, key);
+}
+
+static const search_kernels sse42_kernels = {
+    count16_sse42, count32_sse42, count64_sse42
+};
+
+// Same as the SSE4.2 kernels, with twice the keys per compare.
+
+__attribute__((target("avx2")))
+static int count16_avx2(const uint16_t * keys, int n, uint16_t key) {
+    int i, count = 0;
+    __m256i k = _mm256_set1_epi16((short)key);
+    __m256i v;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        v = _mm256_loadu_si256((const __m256i *)&keys[i]);
+        v = _mm256_cmpeq_epi16(_mm256_min_epu16(v, k), v);
+        count += __builtin_popcount(_mm256_movemask_epi8(v)) / 2;
+    }
+    return count + count16_scalar(keys + i, n - i, key);
+}
+
+__attribute__((target("avx2")))
+static int count32_avx2(const uint32_t * keys, int n, uint32_t key) {
+    int i, count = 0;
+    __m256i k = _mm256_set1_epi32((int)key);
+    __m256i v;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        v = _mm256_loadu_si256((const __m256i *)&keys[i]);
+        v = _mm256_cmpeq_epi32(_mm256_min_epu32(v, k), v);
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(v)));
+    }
+    return count + count32_scalar(keys + i, n - i, key);
+}
+
+__attribute__((target("avx2")))
+static int count64_avx2(const uint64_t * keys, int n, uint64_t key) {
+    int i, count = 0;
+    __m256i bias = _mm256_set1_epi64x(INT64_MIN);
+    __m256i k = _mm256_xor_si256(_mm256_set1_epi64x((int64_t)key), bias);
+    __m256i v;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&keys[i]), bias);
+        v = _mm256_cmpgt_epi64(v, k);
+        count += 4 - __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(v)));
+    }
+    return count + count64_scalar(keys + i, n - i, key);
+}
+
+static const search_kernels avx2_kernels = {
+    count16_avx2, count32_avx2, count64_avx2
+};
+
+#endif
+
+static const search_kernels * get_kernels( void ) {
+    const search_kernels * k = __atomic_load_n(&kernels, __ATOMIC_ACQUIRE);
+
+    if (k != NULL)
+        return k;
+    k = &scalar_kernels;
+#ifdef SEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        k = &avx2_kernels;
+    else if (__builtin_cpu_supports("sse4.2"))
+        k = &sse42_kernels;
+#endif
+    __atomic_store_n(&kernels, k, __ATOMIC_RELEASE);
+    return k;
+}
+
+/* Narrows keys to the window and counts it with the kernel for
+ * their width.  One search is generated for each width of key a
+ * node of this build may store, so each compares keys of its own
+ * type inline.
+ */
+#define DEFINE_SEARCH(name, type, count) \
+static int name( const type * keys, int len, type key ) { \
+    const type * base = keys; \
+    int half; \
+ \
+    while (len > SEARCH_WINDOW) { \
+        half = len / 2; \
+        base = base[half - 1] <= key ? base + half : base; \
+        len -= half; \
+    } \
+    return (int)(base - keys) + count(base, len, key); \
+}
+
+DEFINE_SEARCH(search16, uint16_t, get_kernels()->count16)
+DEFINE_SEARCH(search32, uint32_t, get_kernels()->count32)
+#if KEY_SIZE >= 8
+DEFINE_SEARCH(search64, uint64_t, get_kernels()->count64)
+#endif
+#if KEY_SIZE == 16
+static int count128( const tree_ukey * keys, int n, tree_ukey key ) {
+    int i, count = 0;
+
+    for (i = 0; i < n; i++)
+        count += keys[i] <= key;
+    return count;
+}
+
+DEFINE_SEARCH(search128, tree_ukey, count128)
+#endif
+
+/* Returns the index of the first of len slots, stride bytes apart,
+ * whose key is greater than or equal to delta.  One search is
+ * generated for each width, so the slots are read as keys of that
+ * width without asking the width on every probe.  The comparison
+ * result moves the base without a branch.
+ */
+#define DEFINE_LEAF_SEARCH(name, type) \
+static int name( const char * slots, int len, type delta ) { \
+    const int stride = sizeof(type) + 4; \
+    int base = 0, half; \
+    type k; \
+ \
+    while (len > 1) { \
+        half = len / 2; \
+        memcpy(&k, slots + (base + half - 1) * stride, sizeof(type)); \
+        base = k < delta ? base + half : base; \
+        len -= half; \
+    } \
+    memcpy(&k, slots + base * stride, sizeof(type)); \
+    return base + (len == 1 && k < delta); \
+}
+
+DEFINE_LEAF_SEARCH(leaf_search16, uint16_t)
+DEFINE_LEAF_SEARCH(leaf_search32, uint32_t)
+#if KEY_SIZE >= 8
+DEFINE_LEAF_SEARCH(leaf_search64, uint64_t)
+#endif
+#if KEY_SIZE == 16
+DEFINE_LEAF_SEARCH(leaf_search128, tree_ukey)
+#endif
+
+
+// SEARCH
+
+/* Returns the index of the first slot whose key is
+ * greater than or equal to key, or num_keys if there is none.
+ */
+int search_leaf( const leaf_page_t * leaf, tree_key key ) {
+    int width = leaf->key_width, len = leaf->num_keys;
+    tree_ukey delta;
+
+    if (len == 0 || key < leaf->key_base)
+        return 0;
+    delta = (tree_ukey)key - (tree_ukey)leaf->key_base;
+    if (width < KEY_SIZE && delta >> (8 * width) != 0)
+        return len;
+
+    switch (width) {
+    case 2:
+        return leaf_search16(leaf->slots, len, (uint16_t)delta);
+    case 4:
+        return leaf_search32(leaf->slots, len, (uint32_t)delta);
+#if KEY_SIZE >= 8
+    case 8:
+        return leaf_search64(leaf->slots, len, (uint64_t)delta);
+#endif
+#if KEY_SIZE == 16
+    case 16:
+        return leaf_search128(leaf->slots, len, delta);
+#endif
+    default:
+        return len;
+    }
+}
+
+
+/* Returns the number of keys of an internal page that are
+ * less than or equal to key, which is the index of the child
+ * to follow for key.
+ */
+int search_internal( const internal_page_t * page, tree_key key ) {
+    int n = page->num_keys, width = page->key_width;
+    tree_ukey delta;
+
+    if (n == 0 || key < page->key_base)
+        return 0;
+    delta = (tree_ukey)key - (tree_ukey)page->key_base;
+    if (width < KEY_SIZE && delta >> (8 * width) != 0)
+        return n;
+
+    switch (width) {
+    case 2:
+        return search16((const uint16_t *)page->entries, n, (uint16_t)delta);
+    case 4:
+        return search32((const uint32_t *)page->entries, n, (uint32_t)delta);
+#if KEY_SIZE >= 8
+    case 8:
+        return search64((const uint64_t *)page->entries, n, (uint64_t)delta);
+#endif
+#if KEY_SIZE == 16
+    case 16:
+        return search128((const tree_ukey *)page->entries, n, delta);
+#endif
+    default:
+        return n;
+    }
+}
@@ -0,0 +1,943 @@
+/*
+ *  table.c
+ *
+ *  Tables of the disk-based B+ tree.
+ *  A table is a data file with its buffer pool, log, version store and
+ *  space map, and the tree for the type of its keys, which its header
+ *  page records.  The tree is built once for each type of key, and
+ *  every operation on a table id goes to the tree of that table, so
+ *  tables with keys of different types are served side by side.
+ *  Whatever does not depend on the keys is done here once for all.
+ */
+
+#define OriginalVersion "1.14"
+#define Version "1.0"
+
+// O_DIRECT
+#define _GNU_SOURCE
+#include "bpt.h"
+
+// GLOBALS.
+
+// Keys are stored as narrow as they allow unless this is cleared.
+bool compress_keys = true;
+
+
+/* The open tables, indexed by table id.
+ * The lock is held only while a table is opened or closed.
+ */
+table * tables[MAX_TABLES];
+pthread_mutex_t tables_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// The tree for each type of key, indexed by the type.
+static const tree_ops * const trees[NUM_KEY_TYPES] = {
+    &tree_ops_int64, &tree_ops_int32, &tree_ops_uuid, &tree_ops_str16
+};
+
+
+// FUNCTION DEFINITIONS.
+
+// FILE I/O
+
+/* Returns the open table with the given id,
+ * or NULL if there is none.
+ */
+table * get_table( int table_id ) {
+    if (table_id < 0 || table_id >= MAX_TABLES)
+        return NULL;
+    return tables[table_id];
+}
+
+
+/* Closes whatever part of a table has been opened
+ * and frees it.
+ */
+static void free_table( table * t ) {
+    if (t->log != NULL)
+        wal_close(t->log);
+    if (t->pool != NULL)
+        buf_shutdown(t->pool);
+    zstore_close(t->store);
+    space_close(t->space);
+    mvcc_destroy(t->versions);
+    if (t->fd >= 0)
+        close(t->fd);
+    pthread_rwlock_destroy(&t->op_lock);
+    free(t);
+}
+
+
+/* Returns a new string of the path of a data file
+ * followed by a suffix.
+ */
+static char * path_with( const char * pathname, const char * suffix ) {
+    char * path;
+
+    path = (char *) malloc(strlen(pathname) + strlen(suffix) + 1);
+    if (path == NULL) {
+        perror("File path.");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(path, pathname);
+    strcat(path, suffix);
+    return path;
+}
+
+
+/* Returns whether a page size is one a file can be created with.
+ */
+static bool valid_page_size( int64_t page_size ) {
+    return page_size >= MIN_PAGE_SIZE && page_size <= MAX_PAGE_SIZE &&
+        (page_size & (page_size - 1)) == 0;
+}
+
+
+/* Reads the page size and the type of the keys of an existing data
+ * file from its header page.  A header that records no page size is
+ * of a file of PAGE_SIZE pages, and one that records no key size of
+ * a file of KEY_INT64 keys.
+ * Returns -1 if the header cannot be read or is not valid.
+ */
+static int read_header( int fd, int * page_size, int * key_type ) {
+    header_page_t * header;
+    int result = -1;
+
+    // The buffer is aligned for a file opened with O_DIRECT.
+    if (posix_memalign((void **)&header, MIN_PAGE_SIZE, MIN_PAGE_SIZE) != 0) {
+        perror("Header page.");
+        exit(EXIT_FAILURE);
+    }
+    if (pread(fd, header, MIN_PAGE_SIZE, 0) == MIN_PAGE_SIZE) {
+        *page_size = header->page_size == 0 ? PAGE_SIZE : header->page_size;
+        if (header->key_size == 0 && header->key_type == KEY_INT64)
+            *key_type = KEY_INT64;
+        else if (key_size(header->key_type) == header->key_size)
+            *key_type = header->key_type;
+        else
+            *key_type = -1;
+        if (valid_page_size(*page_size) && *key_type >= 0)
+            result = 0;
+    }
+    free(header);
+    return result;
+}
+
+
+/* Takes a checkpoint.  The space map is saved before the log is
+ * emptied, so a saved map is trusted at open only when the log is
+ * empty.  If it cannot be saved, the pages are written back but
+ * the log is kept.
+ * No operation may be in progress on any thread.
+ */
+int checkpoint( table * t ) {
+    if (space_sync(t->space) != 0) {
+        buf_flush_all(t->pool);
+        return -1;
+    }
+    return buf_checkpoint(t->pool);
+}
+
+
+/* Open file to read and write data.
+ * page_size is the size of the pages of a new file: 4, 8, 16, 32
+ * or 64 KiB, or PAGE_SIZE if it is 0.  An existing file keeps the
+ * size it was created with, which its header page records.
+ * key_type is the type of the keys of the table: KEY_INT64,
+ * KEY_INT32, KEY_UUID or KEY_STR16.  A new file records it in its
+ * header page, and an existing file is refused unless it was
+ * created with the same type.
+ * buf_num is the number of pages the buffer pool of the table
+ * can hold in memory, at least MIN_BUF_NUM of its page size.
+ * durability is DURABILITY_COMMIT to sync the log at every commit,
+ * DURABILITY_NONE to sync it only at checkpoints, or the interval
+ * in milliseconds at which it is synced in the background.
+ * io_mode is IO_BUFFERED to read and write pages at their offset,
+ * IO_MMAP to read clean pages in place from a mapping of the file,
+ * or IO_DIRECT to bypass the page cache of the kernel.  A file
+ * system that does not support O_DIRECT falls back to IO_BUFFERED.
+ * Adding IO_COMPRESS keeps the pages that compress well, mostly the
+ * leaves, in a compressed page store next to the data file.  A data
+ * file that has a store always uses it, with or without the flag.
+ * The log of an existing file is replayed before anything else.
+ * The map of its free pages is then loaded as saved at the last
+ * checkpoint, or rebuilt from the tree if the log was not empty.
+ * Each table has its own file, buffer pool and log, so operations
+ * on different tables never touch the same state.
+ *
+ * @return the table id   if the table is opened
+ *         -1             if the file cannot be opened, is already
+ *                        open, or MAX_TABLES tables are open,
+ *                        page_size is not a valid size, or the
+ *                        keys of the file are not of key_type
+ */
+int open_table( char * pathname, int buf_num, int durability, int io_mode,
+        int page_size, int key_type ) {
+    char * log_path, * store_path, * space_path;
+    bool is_new, compress;
+    struct stat st;
+    table * t;
+    int i, table_id, file_key_type, replayed = 0;
+    pthread_rwlockattr_t attr;
+
+    if (page_size == 0)
+        page_size = PAGE_SIZE;
+    if (!valid_page_size(page_size) || key_size(key_type) < 0)
+        return -1;
+
+    t = (table *) calloc(1, sizeof(table));
+    if (t == NULL) {
+        perror("Table creation.");
+        exit(EXIT_FAILURE);
+    }
+    t->fd = -1;
+
+    // A waiting checkpoint must not starve behind new operations.
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&t->op_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    compress = (io_mode & IO_COMPRESS) != 0;
+    io_mode &= ~IO_COMPRESS;
+    if (io_mode == IO_DIRECT &&
+            (t->fd = open(pathname, O_RDWR | O_CREAT | O_DIRECT, 0644)) < 0)
+        io_mode = IO_BUFFERED;
+    if (t->fd < 0 && (t->fd = open(pathname, O_RDWR | O_CREAT, 0644)) < 0) {
+        free_table(t);
+        return -1;
+    }
+    fstat(t->fd, &st);
+    t->dev = st.st_dev;
+    t->ino = st.st_ino;
+
+    // Reserve a slot, refusing a file that is open already.
+    pthread_mutex_lock(&tables_lock);
+    table_id = -1;
+    for (i = MAX_TABLES - 1; i >= 0; i--) {
+        if (tables[i] == NULL)
+            table_id = i;
+        else if (tables[i]->dev == t->dev && tables[i]->ino == t->ino)
+            break;
+    }
+    if (i < 0 && table_id >= 0)
+        tables[table_id] = t;
+    pthread_mutex_unlock(&tables_lock);
+    if (i >= 0 || table_id < 0) {
+        free_table(t);
+        return -1;
+    }
+
+    is_new = st.st_size == 0;
+    if (!is_new && (read_header(t->fd, &page_size, &file_key_type) != 0 ||
+                file_key_type != key_type)) {
+        pthread_mutex_lock(&tables_lock);
+        tables[table_id] = NULL;
+        pthread_mutex_unlock(&tables_lock);
+        free_table(t);
+        return -1;
+    }
+    t->page_size = page_size;
+    t->ops = trees[key_type];
+
+    if (buf_num <= 0)
+        buf_num = DEFAULT_BUF_NUM;
+    if (buf_num < MIN_BUF_NUM(page_size))
+        buf_num = MIN_BUF_NUM(page_size);
+
+    // A store left behind by an earlier file of that name is stale.
+    store_path = path_with(pathname, ZSTORE_SUFFIX);
+    if (is_new)
+        unlink(store_path);
+    if (compress || access(store_path, F_OK) == 0) {
+        compress = true;
+        t->store = zstore_open(store_path, t->fd, page_size);
+        if (io_mode == IO_MMAP)
+            io_mode = IO_BUFFERED;
+    }
+    free(store_path);
+    t->pool = buf_init(t->fd, buf_num, io_mode, page_size);
+    t->pool->store = t->store;
+
+    log_path = path_with(pathname, WAL_SUFFIX);
+    t->log = wal_open(log_path, durability);
+    free(log_path);
+
+    // Holes the store leaves in the data file must not be filled.
+    space_path = path_with(pathname, SPACE_SUFFIX);
+    t->space = space_open(space_path, t->fd, page_size, t->store == NULL);
+    free(space_path);
+
+    if (t->log == NULL || (compress && t->store == NULL) || t->space == NULL ||
+            (!is_new && (replayed = wal_replay(t->log, t->pool)) < 0)) {
+        pthread_mutex_lock(&tables_lock);
+        tables[table_id] = NULL;
+        pthread_mutex_unlock(&tables_lock);
+        free_table(t);
+        return -1;
+    }
+
+    if (is_new) {
+        set_root(t, page_size);
+
+        set_num_pages(t, 2);
+        set_page_size(t, page_size);
+        set_key_type(t, key_type);
+
+/* Initializing first leaf page.
+ * is_leaf bit is on, no record is stored
+ * and the whole heap is free.  Offset of right sibling is 0.
+ */
+        t->ops->init_leaf(t, page_size);
+
+        space_reset(t->space, 2);
+        space_use(t->space, page_size);
+    }
+    else if (replayed > 0 || !space_load(t->space, get_num_pages(t)))
+        t->ops->rebuild_space(t);
+
+    // Pages written so far are the new file or the replayed log.
+    t->pool->log = t->log;
+    t->versions = mvcc_create();
+    t->pool->versions = t->versions;
+    if (checkpoint(t) != 0) {
+        close_table(table_id);
+        return -1;
+    }
+
+    return table_id;
+}
+
+
+/* Writes every modified page of a table back to the file
+ * and waits until the file reaches the disk.
+ * The log is emptied afterwards.
+ */
+int sync_table( int table_id ) {
+    table * t = get_table(table_id);
+    int result;
+
+    if (t == NULL)
+        return -1;
+    pthread_rwlock_wrlock(&t->op_lock);
+    result = checkpoint(t);
+    pthread_rwlock_unlock(&t->op_lock);
+    return result;
+}
+
+
+/* Writes back the buffer pool of a table and closes
+ * its file and its log.  The table id may then be reused.
+ * No other thread may use the table any more, and every
+ * snapshot of it must have ended.
+ */
+int close_table( int table_id ) {
+    table * t;
+    int result;
+
+    pthread_mutex_lock(&tables_lock);
+    t = get_table(table_id);
+    if (t != NULL)
+        tables[table_id] = NULL;
+    pthread_mutex_unlock(&tables_lock);
+    if (t == NULL)
+        return -1;
+
+    pthread_rwlock_wrlock(&t->op_lock);
+    result = checkpoint(t);
+    pthread_rwlock_unlock(&t->op_lock);
+    if (wal_close(t->log) != 0)
+        result = -1;
+    if (buf_shutdown(t->pool) != 0)
+        result = -1;
+    if (zstore_close(t->store) != 0)
+        result = -1;
+    if (space_close(t->space) != 0)
+        result = -1;
+    mvcc_destroy(t->versions);
+    if (close(t->fd) != 0)
+        result = -1;
+    pthread_rwlock_destroy(&t->op_lock);
+    free(t);
+
+    return result;
+}
+
+
+/* Closes every open table.
+ */
+int close_all_tables( void ) {
+    int i, result = 0;
+
+    for (i = 0; i < MAX_TABLES; i++)
+        if (tables[i] != NULL && close_table(i) != 0)
+            result = -1;
+    return result;
+}
+
+// CONCURRENCY
+
+/* Unlatches and unpins a page.
+ */
+void unlatch( table * t, buf_frame * f ) {
+    pthread_rwlock_unlock(&f->latch);
+    buf_put_page(t->pool, f);
+}
+
+/* Reads the root from the pinned header page.  Readers read
+ * it without the header latch, so it is read atomically.
+ */
+int64_t load_root( buf_frame * header ) {
+    header_page_t * p = (header_page_t *)__atomic_load_n(&header->data, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&p->root_page, __ATOMIC_ACQUIRE);
+}
+
+// OUTPUT AND UTILITIES
+
+/* Copyright and license notice to user at startup.
+ */
+void license_notice( void ) {
+    printf("Disk-Based B+ Tree Version %s\n"
+            "\t-- Copyright (C) 2017  Jeonghoon Lee  galeb716@daum.net\n"
+            "Copyright and license information of the original code is "
+            "described below.\n", Version);
+    printf("=================================================================="
+            "==============\n");
+    printf("bpt version %s -- Copyright (C) 2010  Amittai Aviram "
+            "http://www.amittai.com\n", OriginalVersion);
+    printf("This program comes with ABSOLUTELY NO WARRANTY.\n"
+            "This is free software, and you are welcome to redistribute it\n"
+            "under certain conditions.\n");
+    printf("=================================================================="
+            "==============\n\n");
+}
+
+
+/* First message to the user.
+ */
+void usage_1( void ) {
+    printf("B+ Tree of Internal Order %d and Leaf Order %d.\n",
+            INTERNAL_ORDER(PAGE_SIZE), LEAF_ORDER(PAGE_SIZE));
+    printf("To start with input from a file of newline-delimited integers, \n"
+           "start again and enter the input filename after the data filename:\n"
+           "%% bpt <datafile> <inputfile>.\n"
+           "To build a new tree from a file of \"i <key> <value>\" lines at once,\n"
+           "give -b before the input filename and optionally a fill factor:\n"
+           "%% bpt <datafile> -b <inputfile> [<fill percent>].\n"
+           "Keys are 64-bit integers unless their type is given first:\n"
+           "%% bpt -k int64|int32|uuid|str16 <datafile> ...\n");
+}
+
+
+/* Second message to the user.
+ */
+void usage_2( void ) {
+    printf("Enter any of the following commands after the prompt > :\n"
+    "\to <k>  -- Open existing data file <k> or create one if not existed,\n"
+    "\t          and use it for the following commands.\n"
+    "\ti <k1> <k2> -- Insert <k1> (an integer) as key and <k2> (a string) as value).\n"
+    "\tf <k>  -- Find the value under key <k>.\n"
+    "\tp <k>  -- Print the path from the root to key <k> and its associated "
+           "value.\n"
+    "\tr <k1> <k2> -- Print the keys and values found in the range "
+            "[<k1>, <k2>].\n"
+    "\td <k>  -- Delete key <k> and its associated value.\n"
+    //"\tx -- Destroy the whole tree.  Start again with an empty tree of the "
+    //       "same order.\n"
+    "\tt -- Print the B+ tree.\n"
+    "\tl -- Print the keys of the leaves (bottom row of the tree).\n"
+    "\tc -- Compact the data file, putting the leaves in key order.\n"
+    "\tq -- Quit. (Or use Ctl-D.)\n"
+    "\t? -- Print this help message.\n");
+}
+
+
+/* Prints the bottom row of keys of the tree.
+ */
+void print_leaves( int table_id ) {
+    table * t;
+
+    if ((t = get_table(table_id)) == NULL) {
+        printf("Table %d is not open.\n", table_id);
+        return;
+    }
+    t->ops->print_leaves(t);
+}
+
+
+/* Prints the B+ tree level by level.
+ */
+void print_tree( int table_id ) {
+    table * t;
+
+    if ((t = get_table(table_id)) == NULL) {
+        printf("Table %d is not open.\n", table_id);
+        return;
+    }
+    t->ops->print_tree(t);
+}
+
+
+/* Finds the record under a given key and prints an
+ * appropriate message to stdout.
+ */
+void find_and_print( int table_id, bpt_key key ) {
+
+    char text[KEY_TEXT_SIZE];
+    bpt_view view;
+    const char * r;
+    table * t;
+
+    if ((t = get_table(table_id)) == NULL) {
+        printf("Table %d is not open.\n", table_id);
+        return;
+    }
+    key_format(t->ops->key_type, key, text);
+    r = find_view(table_id, key, &view);
+    if (r == NULL)
+        printf("Record not found under key %s.\n", text);
+    else
+        printf("Record -- key %s, value %s.\n", text, r);
+
+    release_view(&view);
+}
+
+/* Finds and prints the keys and values within a range
+ * of keys between key_start and key_end, including both bounds.
+ */
+void find_and_print_range( int table_id, bpt_key key_start, bpt_key key_end ) {
+    int i, n, num_found;
+    bpt_key keys[LEAF_ORDER(PAGE_SIZE)];
+    char * values[LEAF_ORDER(PAGE_SIZE)];
+    char text[KEY_TEXT_SIZE];
+    bpt_cursor * cursor;
+    table * t;
+
+    if ((t = get_table(table_id)) == NULL) {
+        printf("Table %d is not open.\n", table_id);
+        return;
+    }
+    num_found = 0;
+    cursor = bpt_cursor_open(table_id, key_start);
+    while ((n = bpt_cursor_next(cursor, keys, values, LEAF_ORDER(PAGE_SIZE))) > 0) {
+        for (i = 0; i < n && keys[i] <= key_end; i++)
+            printf("Key: %s   Value: %s\n",
+                    key_format(t->ops->key_type, keys[i], text), values[i]);
+        num_found += i;
+        if (i < n)
+            break;
+    }
+    bpt_cursor_close(cursor);
+
+    if (!num_found)
+        printf("None found.\n");
+}
+
+// SEARCH
+
+/* The operations below on a table id go to the tree for the type
+ * of the keys of the table, where each is described.  A table id
+ * that is not open finds nothing and changes nothing.
+ */
+
+/* Finds keys and their values, if present, in the range specified
+ * by key_start and key_end, inclusive.  Copies at most max of them
+ * into the arrays returned_keys and returned_values, and returns
+ * the number of entries copied.  A value longer than VALUE_SIZE
+ * is cut to fit, and always ends with a null.
+ */
+int find_range( int table_id, bpt_key key_start, bpt_key key_end, int max,
+        bpt_key returned_keys[], char returned_values[][VALUE_SIZE] ) {
+    int i, n, num_found;
+    char * values[LEAF_ORDER(PAGE_SIZE)];
+    bpt_cursor * cursor;
+
+    num_found = 0;
+    cursor = bpt_cursor_open(table_id, key_start);
+    while (num_found < max) {
+        n = bpt_cursor_next(cursor, &returned_keys[num_found], values,
+                max - num_found < LEAF_ORDER(PAGE_SIZE) ?
+                max - num_found : LEAF_ORDER(PAGE_SIZE));
+        for (i = 0; i < n && returned_keys[num_found] <= key_end; i++, num_found++)
+            snprintf(returned_values[num_found], VALUE_SIZE, "%s", values[i]);
+        if (n == 0 || i < n)
+            break;
+    }
+    bpt_cursor_close(cursor);
+
+    return num_found;
+}
+
+
+const char * find_view( int table_id, bpt_key key, bpt_view * view ) {
+    view->frame = NULL;
+    view->value = NULL;
+    view->length = 0;
+    if ((view->table = get_table(table_id)) == NULL)
+        return NULL;
+    return view->table->ops->find_view(view, key);
+}
+
+
+/* Releases the leaf held by a view.
+ * A view that holds nothing is left as it is.
+ */
+void release_view( bpt_view * view ) {
+    if (view->frame != NULL)
+        unlatch(view->table, view->frame);
+    view->frame = NULL;
+    view->value = NULL;
+}
+
+
+/* Finds and returns the record to which
+ * a key refers, in a copy the caller frees.
+ */
+char * find( int table_id, bpt_key key ) {
+    bpt_view view;
+    char * value = NULL;
+
+    if (find_view(table_id, key, &view) != NULL) {
+        value = (char *) malloc(sizeof(char) * view.length);
+        if (value == NULL) {
+            perror("Found value.");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(value, view.value, view.length);
+    }
+    release_view(&view);
+
+    return value;
+}
+
+
+/* Copies the value under a key into buf, cut to fit len bytes
+ * and ended with a null as snprintf does.  Nothing is allocated.
+ * Returns the length of the whole value without its null, so a value
+ * was cut if it is len or more, or -1 if the key is not found or the
+ * table is not open.
+ */
+int find_into( int table_id, bpt_key key, char * buf, int len ) {
+    bpt_view view;
+    int result = -1;
+
+    if (find_view(table_id, key, &view) != NULL)
+        result = snprintf(buf, len, "%s", view.value);
+    release_view(&view);
+
+    return result;
+}
+
+
+/* Returns whether a key is in the table.  The value is not read.
+ */
+bool contains( int table_id, bpt_key key ) {
+    bpt_view view;
+    bool found;
+
+    found = find_view(table_id, key, &view) != NULL;
+    release_view(&view);
+
+    return found;
+}
+
+
+int find_many( int table_id, const bpt_key keys[], int num_keys,
+        char values[][VALUE_SIZE], int lengths[] ) {
+    table * t;
+
+    if ((t = get_table(table_id)) == NULL)
+        return -1;
+    return t->ops->find_many(t, keys, num_keys, values, lengths);
+}
+
+// RANGE SCAN
+
+/* Returns a new cursor over a table, or over a snapshot of it
+ * if snapshot is not NULL, before the tree positions it.
+ */
+static bpt_cursor * new_cursor( table * t, bpt_snapshot * snapshot ) {
+    bpt_cursor * cursor;
+
+    cursor = (bpt_cursor *) malloc(sizeof(bpt_cursor));
+    if (cursor == NULL) {
+        perror("Cursor creation.");
+        exit(EXIT_FAILURE);
+    }
+    cursor->table = t;
+    cursor->frame = NULL;
+    cursor->index = 0;
+    cursor->snapshot = snapshot;
+    cursor->page = NULL;
+    memset(&cursor->ra, 0, sizeof(read_ahead));
+    return cursor;
+}
+
+
+bpt_cursor * bpt_cursor_open( int table_id, bpt_key lower_bound ) {
+    bpt_cursor * cursor = new_cursor(get_table(table_id), NULL);
+
+    if (cursor->table != NULL)
+        cursor->table->ops->cursor_seek(cursor, lower_bound);
+    return cursor;
+}
+
+
+int bpt_cursor_next( bpt_cursor * cursor, bpt_key keys[], char * values[], int max ) {
+    if (cursor->table == NULL)
+        return 0;
+    return cursor->table->ops->cursor_next(cursor, keys, values, max);
+}
+
+
+/* Unlatches the current leaf and frees the cursor.
+ */
+void bpt_cursor_close( bpt_cursor * cursor ) {
+    if (cursor->frame != NULL)
+        unlatch(cursor->table, cursor->frame);
+    free(cursor->page);
+    free(cursor);
+}
+
+// SNAPSHOT READS
+
+/* Begins a snapshot of a table.  Every operation committed so far
+ * is visible through it, and nothing committed later.
+ * Writers do not wait for snapshot readers: the pages they replace
+ * are kept as older versions until the snapshots that see them end.
+ * Returns NULL if the table is not open.
+ */
+bpt_snapshot * begin_snapshot( int table_id ) {
+    bpt_snapshot * snapshot;
+    table * t;
+
+    if ((t = get_table(table_id)) == NULL)
+        return NULL;
+
+    snapshot = (bpt_snapshot *) malloc(sizeof(bpt_snapshot));
+    if (snapshot == NULL) {
+        perror("Snapshot creation.");
+        exit(EXIT_FAILURE);
+    }
+    snapshot->table = t;
+    mvcc_begin(t->versions, &snapshot->snap);
+    return snapshot;
+}
+
+
+/* Ends a snapshot.  Its cursors must be closed first.
+ */
+void end_snapshot( bpt_snapshot * snapshot ) {
+    if (snapshot == NULL)
+        return;
+    mvcc_end(snapshot->table->versions, &snapshot->snap);
+    free(snapshot);
+}
+
+
+char * find_at( bpt_snapshot * snapshot, bpt_key key ) {
+    return snapshot->table->ops->find_at(snapshot, key);
+}
+
+
+bpt_cursor * bpt_cursor_open_at( bpt_snapshot * snapshot, bpt_key lower_bound ) {
+    bpt_cursor * cursor = new_cursor(snapshot->table, snapshot);
+
+    cursor->table->ops->cursor_seek(cursor, lower_bound);
+    return cursor;
+}
+
+// INSERTION AND DELETION
+
+int insert( int table_id, bpt_key key, char * value ) {
+    table * t;
+
+    if ((t = get_table(table_id)) == NULL)
+        return -1;
+    return t->ops->insert(t, key, value);
+}
+
+
+int delete( int table_id, bpt_key key ) {
+    table * t;
+
+    if ((t = get_table(table_id)) == NULL)
+        return -1;
+    return t->ops->delete(t, key);
+}
+
+/* Replaces the value of a key, as a batch of one update.
+ * Returns 0, or -1 if the key is not found, the value is longer
+ * than MAX_VALUE_SIZE, the table is not open or the log could not
+ * be synced.
+ */
+int update( int table_id, bpt_key key, char * value ) {
+    write_op op;
+
+    op.type = WRITE_UPDATE;
+    op.key = key;
+    op.value = value;
+    return write_batch(table_id, &op, 1) == 1 ? 0 : -1;
+}
+
+// BATCHED WRITES
+
+int write_batch( int table_id, write_op ops[], int num_ops ) {
+    table * t;
+
+    if ((t = get_table(table_id)) == NULL)
+        return -1;
+    return t->ops->write_batch(t, ops, num_ops);
+}
+
+
+/* Inserts num_records records as one batch.
+ * Returns the number of records inserted, leaving out keys already
+ * in the tree, or -1 if the table is not open or the log could not
+ * be synced.
+ */
+int insert_batch( int table_id, record * records, int num_records ) {
+    write_op * ops;
+    int i, result;
+
+    if (num_records <= 0)
+        return get_table(table_id) == NULL ? -1 : 0;
+    ops = (write_op *) malloc(num_records * sizeof(write_op));
+    if (ops == NULL) {
+        perror("Batch operations.");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < num_records; i++) {
+        ops[i].type = WRITE_INSERT;
+        ops[i].key = records[i].key;
+        ops[i].value = records[i].value;
+    }
+    result = write_batch(table_id, ops, num_records);
+    free(ops);
+    return result;
+}
+
+// BULK LOADING
+
+int64_t bulk_load( int table_id, record * records, int64_t num_records, int fill_factor ) {
+    table * t;
+
+    if ((t = get_table(table_id)) == NULL)
+        return -1;
+    return t->ops->bulk_load(t, records, num_records, fill_factor);
+}
+
+// COMPACTION
+
+/* Begins a compaction of a table.  fill_factor is the percentage of
+ * each leaf to fill when the leaves are repacked, from 1 to 100.
+ * The compaction is then run by compaction_step, while the table goes
+ * on serving reads and writes.
+ * Returns NULL if the table is not open.
+ */
+bpt_compaction * begin_compaction( int table_id, int fill_factor ) {
+    bpt_compaction * c;
+    table * t;
+
+    if ((t = get_table(table_id)) == NULL)
+        return NULL;
+
+    c = (bpt_compaction *) calloc(1, sizeof(bpt_compaction));
+    if (c == NULL) {
+        perror("Compaction creation.");
+        exit(EXIT_FAILURE);
+    }
+    c->table = t;
+    c->fill_factor = fill_factor < 1 || fill_factor > 100 ? DEFAULT_FILL_FACTOR : fill_factor;
+    c->next_key = BPT_KEY_MIN;
+    c->dest = 1;
+    return c;
+}
+
+
+int compaction_step( bpt_compaction * c ) {
+    return c->table->ops->compaction_step(c);
+}
+
+
+/* Ends a compaction, done or not, and frees it.
+ * Returns the bytes it freed by cutting off the end of the file.
+ */
+int64_t end_compaction( bpt_compaction * c ) {
+    int64_t reclaimed = c->reclaimed;
+
+    free(c);
+    return reclaimed;
+}
+
+
+/* Compacts a table in one go, step by step.
+ * Returns the bytes freed by cutting off the end of the file, or -1
+ * on error.
+ */
+int64_t compact_table( int table_id, int fill_factor ) {
+    bpt_compaction * c;
+    int result;
+
+    if ((c = begin_compaction(table_id, fill_factor)) == NULL)
+        return -1;
+    while ((result = compaction_step(c)) > 0)
+        ;
+    if (result < 0) {
+        end_compaction(c);
+        return -1;
+    }
+    return end_compaction(c);
+}
+
+// GETTERS & SETTERS
+
+/* Every getter and setter of the header page pins the page,
+ * reads or writes the field, and unpins the page again.
+ * The root is read without the header latch by readers,
+ * so it is read and written atomically.
+ */
+
+int64_t get_root( table * t ) {
+    buf_frame * f = buf_get_page(t->pool, 0);
+    int64_t page = load_root(f);
+    buf_put_page(t->pool, f);
+    return page;
+}
+
+int64_t get_num_pages( table * t ) {
+    buf_frame * f = buf_get_page(t->pool, 0);
+    int64_t num = ((header_page_t *)f->data)->num_pages;
+    buf_put_page(t->pool, f);
+    return num;
+}
+
+void set_root(table * t, int64_t page) {
+    buf_frame * f = buf_get_page(t->pool, 0);
+    buf_mark_dirty(t->pool, f);
+    __atomic_store_n(&((header_page_t *)f->data)->root_page, page, __ATOMIC_RELEASE);
+    buf_put_page(t->pool, f);
+}
+
+void set_num_pages(table * t, int64_t num) {
+    buf_frame * f = buf_get_page(t->pool, 0);
+    buf_mark_dirty(t->pool, f);
+    ((header_page_t *)f->data)->num_pages = num;
+    buf_put_page(t->pool, f);
+}
+
+void set_page_size(table * t, int32_t size) {
+    buf_frame * f = buf_get_page(t->pool, 0);
+    buf_mark_dirty(t->pool, f);
+    ((header_page_t *)f->data)->page_size = size;
+    buf_put_page(t->pool, f);
+}
+
+// Records the type of the keys and their size at full width.
+void set_key_type(table * t, int32_t key_type) {
+    buf_frame * f = buf_get_page(t->pool, 0);
+    buf_mark_dirty(t->pool, f);
+    ((header_page_t *)f->data)->key_type = key_type;
+    ((header_page_t *)f->data)->key_size = key_size(key_type);
+    buf_put_page(t->pool, f);
+}
@@ -0,0 +1,377 @@
+/*
+ *  wal.c
+ *
+ *  Write-ahead log of the disk-based B+ tree.
+ *  Each operation appends one redo record holding the byte ranges it
+ *  changed in every page.  Committers share log syncs (group commit):
+ *  the first committer to find the log idle writes and syncs everything
+ *  buffered so far, and the others wait for it.  Data pages are written
+ *  back lazily by the buffer pool, never before the log records that
+ *  describe them.  A checkpoint writes every dirty page, syncs the data
+ *  file and truncates the log.  Opening a data file replays its log.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "buffer.h"
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+
+// UTILITIES
+
+static void make_crc_table( void ) {
+    uint32_t c;
+    int i, k;
+
+    for (i = 0; i < 256; i++) {
+        c = (uint32_t)i;
+        for (k = 0; k < 8; k++)
+            c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+/* Returns the CRC-32 of a byte string.
+ */
+uint32_t wal_checksum( const char * data, size_t len ) {
+    uint32_t c = 0xffffffff;
+    size_t i;
+
+    pthread_once(&crc_once, make_crc_table);
+    for (i = 0; i < len; i++)
+        c = crc_table[(c ^ (uint8_t)data[i]) & 0xff] ^ (c >> 8);
+    return c ^ 0xffffffff;
+}
+
+static int write_all( int fd, const char * data, size_t len ) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Writes every buffered record to the log file and syncs it if asked.
+ * Called with the lock held when no other thread is writing.
+ * The buffers are swapped so that other threads can keep appending
+ * while the lock is released for the write and the sync.
+ * The records are not written again after a failure, which marks
+ * the log failed instead.
+ */
+static int write_buffered( wal * log, bool sync ) {
+    char * data;
+    size_t len, cap;
+    uint64_t end;
+    int result = 0;
+
+    log->writing = true;
+    data = log->buffer;
+    len = log->buffer_len;
+    cap = log->buffer_cap;
+    log->buffer = log->spare;
+    log->buffer_cap = log->spare_cap;
+    log->buffer_len = 0;
+    log->spare = data;
+    log->spare_cap = cap;
+    end = log->next_lsn;
+
+    pthread_mutex_unlock(&log->lock);
+    if (len > 0 && write_all(log->fd, data, len) != 0)
+        result = -1;
+    if (sync && result == 0 && fdatasync(log->fd) != 0)
+        result = -1;
+    pthread_mutex_lock(&log->lock);
+
+    if (result == 0) {
+        log->written_lsn = end;
+        if (sync)
+            log->flushed_lsn = end;
+    }
+    else
+        log->failed = true;
+    log->writing = false;
+    pthread_cond_broadcast(&log->flushed);
+    return result;
+}
+
+/* Syncs the log every durability milliseconds.
+ */
+static void * flusher_main( void * arg ) {
+    wal * log = (wal *)arg;
+    struct timespec ts;
+    uint64_t lsn;
+
+    pthread_mutex_lock(&log->lock);
+    while (!log->stop) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += log->durability / 1000;
+        ts.tv_nsec += (long)(log->durability % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&log->wakeup, &log->lock, &ts);
+        if (log->stop)
+            break;
+
+        lsn = log->next_lsn;
+        pthread_mutex_unlock(&log->lock);
+        wal_flush(log, lsn);
+        pthread_mutex_lock(&log->lock);
+    }
+    pthread_mutex_unlock(&log->lock);
+    return NULL;
+}
+
+
+// LOG
+
+/* Opens or creates the log file at pathname.
+ * durability is DURABILITY_COMMIT, DURABILITY_NONE
+ * or a sync interval in milliseconds.
+ */
+wal * wal_open( const char * pathname, int durability ) {
+    wal * log;
+
+    log = (wal *) calloc(1, sizeof(wal));
+    if (log == NULL) {
+        perror("Log creation.");
+        exit(EXIT_FAILURE);
+    }
+
+    log->fd = open(pathname, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (log->fd < 0) {
+        free(log);
+        return NULL;
+    }
+
+    log->durability = durability;
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->flushed, NULL);
+    pthread_cond_init(&log->wakeup, NULL);
+
+    if (durability > 0) {
+        if (pthread_create(&log->flusher, NULL, flusher_main, log) == 0)
+            log->has_flusher = true;
+        else
+            log->durability = DURABILITY_COMMIT;
+    }
+
+    return log;
+}
+
+
+/* Syncs every appended record, stops the flusher and closes the log.
+ */
+int wal_close( wal * log ) {
+    int result;
+
+    if (log == NULL)
+        return 0;
+
+    result = wal_flush(log, log->next_lsn);
+
+    if (log->has_flusher) {
+        pthread_mutex_lock(&log->lock);
+        log->stop = true;
+        pthread_cond_signal(&log->wakeup);
+        pthread_mutex_unlock(&log->lock);
+        pthread_join(log->flusher, NULL);
+    }
+
+    if (close(log->fd) != 0)
+        result = -1;
+    pthread_cond_destroy(&log->wakeup);
+    pthread_cond_destroy(&log->flushed);
+    pthread_mutex_destroy(&log->lock);
+    free(log->buffer);
+    free(log->spare);
+    free(log);
+
+    return result;
+}
+
+
+/* Appends a record built by the caller and returns its LSN.
+ * The lsn and checksum fields of the record are filled in here.
+ * Unless every commit syncs, a full buffer is written out at once.
+ */
+uint64_t wal_append( wal * log, const char * rec, size_t len ) {
+    wal_record * header;
+    uint64_t lsn;
+    size_t cap;
+
+    pthread_mutex_lock(&log->lock);
+
+    if (log->buffer_len + len > log->buffer_cap) {
+        cap = log->buffer_cap == 0 ? WAL_BUFFER_SIZE : log->buffer_cap;
+        while (cap < log->buffer_len + len)
+            cap *= 2;
+        log->buffer = (char *) realloc(log->buffer, cap);
+        if (log->buffer == NULL) {
+            perror("Log buffer.");
+            exit(EXIT_FAILURE);
+        }
+        log->buffer_cap = cap;
+    }
+
+    header = (wal_record *)(log->buffer + log->buffer_len);
+    memcpy(header, rec, len);
+    log->buffer_len += len;
+    log->next_lsn += len;
+    lsn = log->next_lsn;
+    header->lsn = lsn;
+    header->checksum = wal_checksum((char *)header + sizeof(uint32_t),
+            len - sizeof(uint32_t));
+
+    if (log->durability != DURABILITY_COMMIT &&
+            log->buffer_len >= WAL_BUFFER_SIZE && !log->writing && !log->failed)
+        write_buffered(log, false);
+
+    pthread_mutex_unlock(&log->lock);
+    return lsn;
+}
+
+
+/* Waits until every record up to lsn is synced to disk.
+ * If nobody is writing the log, the caller becomes the leader and
+ * syncs all buffered records, including those of other committers.
+ * Returns -1 if the log has failed.
+ */
+int wal_flush( wal * log, uint64_t lsn ) {
+    int result = 0;
+
+    pthread_mutex_lock(&log->lock);
+    while (log->flushed_lsn < lsn && result == 0) {
+        if (log->failed)
+            result = -1;
+        else if (log->writing)
+            pthread_cond_wait(&log->flushed, &log->lock);
+        else
+            result = write_buffered(log, true);
+    }
+    pthread_mutex_unlock(&log->lock);
+
+    return result;
+}
+
+
+/* Makes a committed record as durable as the durability level asks.
+ */
+int wal_commit( wal * log, uint64_t lsn ) {
+    if (log->durability != DURABILITY_COMMIT)
+        return 0;
+    return wal_flush(log, lsn);
+}
+
+
+/* Returns the number of log bytes appended since the last checkpoint.
+ */
+uint64_t wal_size( wal * log ) {
+    uint64_t size;
+
+    pthread_mutex_lock(&log->lock);
+    size = log->next_lsn - log->checkpoint_lsn;
+    pthread_mutex_unlock(&log->lock);
+    return size;
+}
+
+
+/* Empties the log after a checkpoint.
+ * Every record must already be synced and applied to the data file.
+ */
+int wal_truncate( wal * log ) {
+    int result = 0;
+
+    pthread_mutex_lock(&log->lock);
+    while (log->writing)
+        pthread_cond_wait(&log->flushed, &log->lock);
+    if (ftruncate(log->fd, 0) != 0 || fsync(log->fd) != 0)
+        result = -1;
+    else
+        log->checkpoint_lsn = log->next_lsn;
+    pthread_mutex_unlock(&log->lock);
+
+    return result;
+}
+
+
+/* Applies every complete record of the log to the pages in the
+ * buffer pool.  Replay stops at the first torn or corrupt record.
+ * Returns the number of records applied, or -1 on error.
+ */
+int wal_replay( wal * log, buf_pool * pool ) {
+    struct stat st;
+    char * data, * p, * end;
+    wal_record header;
+    wal_range range;
+    buf_frame * f;
+    size_t pos;
+    ssize_t n;
+    int count = 0;
+
+    if (fstat(log->fd, &st) != 0)
+        return -1;
+    if (st.st_size == 0)
+        return 0;
+
+    data = (char *) malloc(st.st_size);
+    if (data == NULL) {
+        perror("Log replay buffer.");
+        exit(EXIT_FAILURE);
+    }
+    for (pos = 0; pos < (size_t)st.st_size; pos += n) {
+        n = pread(log->fd, data + pos, st.st_size - pos, pos);
+        if (n <= 0) {
+            free(data);
+            return -1;
+        }
+    }
+
+    for (pos = 0; pos + sizeof(wal_record) <= (size_t)st.st_size; pos += header.length) {
+        memcpy(&header, data + pos, sizeof(wal_record));
+        if (header.length < sizeof(wal_record) || header.length > st.st_size - pos)
+            break;
+        if (header.checksum != wal_checksum(data + pos + sizeof(uint32_t),
+                    header.length - sizeof(uint32_t)))
+            break;
+
+        // Check every range before applying any of them.
+        end = data + pos + header.length;
+        for (p = data + pos + sizeof(wal_record); p + sizeof(wal_range) <= end;
+                p += sizeof(wal_range) + range.size) {
+            memcpy(&range, p, sizeof(wal_range));
+            if (range.page < 0 || range.page % pool->page_size != 0 ||
+                    range.offset + range.size > pool->page_size ||
+                    p + sizeof(wal_range) + range.size > end)
+                break;
+        }
+        if (p != end)
+            break;
+
+        for (p = data + pos + sizeof(wal_record); p < end;
+                p += sizeof(wal_range) + range.size) {
+            memcpy(&range, p, sizeof(wal_range));
+            f = buf_get_page(pool, range.page);
+            buf_mark_dirty(pool, f);
+            memcpy(f->data + range.offset, p + sizeof(wal_range), range.size);
+            buf_put_page(pool, f);
+        }
+        count++;
+    }
+
+    free(data);
+    return count;
+}
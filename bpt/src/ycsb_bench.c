@@ -0,0 +1,624 @@
+/*
+ *  ycsb_bench.c
+ *
+ *  Runs the core workloads of YCSB against a table and reports the
+ *  throughput and the latency percentiles of each kind of operation.
+ *  The table is first loaded with records numbered from 0, by all the
+ *  threads at once, and each workload asked for then runs on it in
+ *  turn, for a fixed time or number of operations:
+ *    A  50% reads, 50% updates
+ *    B  95% reads, 5% updates
+ *    C  100% reads
+ *    D  95% reads, 5% inserts, the latest records read the most
+ *    E  95% scans of 1 to 100 records, 5% inserts
+ *    F  50% reads, 50% read-modify-writes
+ *  Keys are drawn from a scrambled zipfian distribution, or as asked,
+ *  and inserted records take the next numbers.  An update replaces
+ *  the value of a record with update.  A read or update of a key not
+ *  found is counted as missed, as YCSB does.
+ *  Latencies are kept in histograms of 128 buckets per power of two,
+ *  so the percentiles are within 1%.  The results are printed as a
+ *  table, or as CSV or JSON rows to track across versions.
+ *  Build with CFLAGS=-O2 make bench for figures worth comparing.
+ *
+ *  usage: ycsb_bench [-w workloads] [-d zipfian|uniform|latest]
+ *                    [-n records] [-v value bytes] [-t threads]
+ *                    [-s seconds] [-c operations] [-b frames]
+ *                    [-p page size] [-m io mode] [-D durability]
+ *                    [-S seed] [-f text|csv|json] [-o output] [file]
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+#include "bpt.h"
+
+// Buckets of a latency histogram: 128 for each power of two.
+#define HIST_SUB 128
+#define HIST_BUCKETS (58 * HIST_SUB)
+
+// Longest scan of workload E.
+#define MAX_SCAN 100
+
+// Skew of the zipfian distribution, as YCSB has it.
+#define ZIPF_THETA 0.99
+
+// Kinds of operation.
+#define OP_READ 0
+#define OP_UPDATE 1
+#define OP_INSERT 2
+#define OP_SCAN 3
+#define OP_RMW 4
+#define NUM_OPS 5
+
+// Distributions of the keys.
+#define DIST_ZIPFIAN 0
+#define DIST_UNIFORM 1
+#define DIST_LATEST 2
+#define DIST_ORDERED 3
+
+static const char * op_names[NUM_OPS] = {
+    "READ", "UPDATE", "INSERT", "SCAN", "READ-MODIFY-WRITE"
+};
+
+static const char * dist_names[] = { "zipfian", "uniform", "latest", "ordered" };
+
+// TYPES.
+
+/* Type of a workload: the percentage of each kind of operation
+ * and the distribution of its keys.
+ */
+typedef struct workload {
+    const char * name;
+    int mix[NUM_OPS];
+    int dist;
+} workload;
+
+static const workload workloads[] = {
+    { "A", { 50, 50, 0, 0, 0 }, DIST_ZIPFIAN },
+    { "B", { 95, 5, 0, 0, 0 }, DIST_ZIPFIAN },
+    { "C", { 100, 0, 0, 0, 0 }, DIST_ZIPFIAN },
+    { "D", { 95, 0, 5, 0, 0 }, DIST_LATEST },
+    { "E", { 0, 0, 5, 95, 0 }, DIST_ZIPFIAN },
+    { "F", { 50, 0, 0, 0, 50 }, DIST_ZIPFIAN },
+};
+
+// The load: every thread inserts the next records until all are in.
+static const workload load_workload = { "load", { 0, 0, 100, 0, 0 }, DIST_ORDERED };
+
+/* Type of a latency histogram, in nanoseconds.
+ * Values below 256 have a bucket each, and above that each power
+ * of two is split into HIST_SUB buckets.
+ */
+typedef struct histogram {
+    int64_t count;
+    int64_t missed;
+    int64_t sum;
+    int64_t max;
+    int64_t buckets[HIST_BUCKETS];
+} histogram;
+
+/* Type of a zipfian distribution over items items, drawn as in
+ * "Quickly Generating Billion-Record Synthetic Databases" by Gray
+ * et al., which YCSB follows.
+ */
+typedef struct zipfian {
+    int64_t items;
+    double zetan;
+    double alpha;
+    double eta;
+} zipfian;
+
+/* Type of a run of a workload shared by its threads.
+ * next_key is the number of the next record to insert.
+ */
+typedef struct bench {
+    int table_id;
+    const workload * w;
+    int dist;
+    int64_t records;
+    int64_t next_key;
+    int value_size;
+    double seconds;
+    int64_t max_ops;
+    zipfian zipf;
+    pthread_barrier_t start;
+} bench;
+
+/* Type of a thread of a run, with its own random state and histograms.
+ */
+typedef struct worker {
+    bench * b;
+    pthread_t thread;
+    uint64_t random;
+    char value[MAX_VALUE_SIZE];
+    char buf[MAX_VALUE_SIZE];
+    histogram hist[NUM_OPS];
+} worker;
+
+/* Type of the options of the benchmark.
+ */
+typedef struct options {
+    const char * workloads;
+    int dist;
+    int64_t records;
+    int value_size;
+    int threads;
+    double seconds;
+    int64_t ops;
+    int frames;
+    int page_size;
+    int io_mode;
+    int durability;
+    uint64_t seed;
+    const char * format;
+    FILE * out;
+    const char * path;
+} options;
+
+
+// UTILITIES
+
+static int64_t now_ns( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static char * path_with( const char * path, const char * suffix ) {
+    static char buf[4096];
+    snprintf(buf, sizeof(buf), "%s%s", path, suffix);
+    return buf;
+}
+
+static void remove_table( const char * path ) {
+    unlink(path);
+    unlink(path_with(path, WAL_SUFFIX));
+    unlink(path_with(path, ZSTORE_SUFFIX));
+    unlink(path_with(path, SPACE_SUFFIX));
+}
+
+// xorshift64*, with a state that is never 0.
+static uint64_t next_random( uint64_t * state ) {
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+// Returns a number drawn uniformly from [0, 1).
+static double next_unit( uint64_t * state ) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// FNV-1a of the bytes of a number, to scatter the zipfian ranks.
+static uint64_t fnv_hash( uint64_t n ) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        h ^= n & 0xFF;
+        h *= 0x100000001B3ULL;
+        n >>= 8;
+    }
+    return h;
+}
+
+
+// DISTRIBUTIONS
+
+static void zipf_init( zipfian * z, int64_t items ) {
+    double zeta2 = 1 + pow(0.5, ZIPF_THETA);
+    int64_t i;
+
+    z->items = items;
+    z->zetan = 0;
+    for (i = 1; i <= items; i++)
+        z->zetan += pow((double)i, -ZIPF_THETA);
+    z->alpha = 1 / (1 - ZIPF_THETA);
+    z->eta = (1 - pow(2.0 / items, 1 - ZIPF_THETA)) / (1 - zeta2 / z->zetan);
+}
+
+/* Returns a rank from 0 to items - 1, 0 being the most frequent.
+ */
+static int64_t zipf_next( const zipfian * z, uint64_t * state ) {
+    double u = next_unit(state), uz = u * z->zetan;
+    int64_t rank;
+
+    if (uz < 1)
+        return 0;
+    if (uz < 1 + pow(0.5, ZIPF_THETA))
+        return 1;
+    rank = (int64_t)(z->items * pow(z->eta * u - z->eta + 1, z->alpha));
+    return rank < z->items ? rank : z->items - 1;
+}
+
+/* Returns the key of the next operation other than an insertion.
+ * Zipfian keys are drawn among the records loaded, with the ranks
+ * scattered over them, and the others among every record inserted.
+ */
+static int64_t next_key( worker * w ) {
+    bench * b = w->b;
+    int64_t last = __atomic_load_n(&b->next_key, __ATOMIC_RELAXED) - 1, key;
+
+    switch (b->dist) {
+    case DIST_ZIPFIAN:
+        return fnv_hash(zipf_next(&b->zipf, &w->random)) % b->records;
+    case DIST_LATEST:
+        key = last - zipf_next(&b->zipf, &w->random);
+        return key > 0 ? key : 0;
+    default:
+        return next_random(&w->random) % (last + 1);
+    }
+}
+
+
+// HISTOGRAMS
+
+static int bucket_of( int64_t ns ) {
+    int e;
+
+    if (ns < 2 * HIST_SUB)
+        return ns > 0 ? (int)ns : 0;
+    e = 63 - __builtin_clzll(ns);
+    return (e - 7) * HIST_SUB + (int)(ns >> (e - 7));
+}
+
+// Returns the smallest value of a bucket.
+static int64_t bucket_value( int b ) {
+    if (b < 2 * HIST_SUB)
+        return b;
+    return (int64_t)(b % HIST_SUB + HIST_SUB) << (b / HIST_SUB - 1);
+}
+
+static void hist_add( histogram * h, int64_t ns ) {
+    h->buckets[bucket_of(ns)]++;
+    h->count++;
+    h->sum += ns;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+static void hist_merge( histogram * to, const histogram * from ) {
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+        to->buckets[i] += from->buckets[i];
+    to->count += from->count;
+    to->missed += from->missed;
+    to->sum += from->sum;
+    if (from->max > to->max)
+        to->max = from->max;
+}
+
+/* Returns the latency that a fraction p of the operations stay within,
+ * as the largest value of its bucket.
+ */
+static int64_t hist_percentile( const histogram * h, double p ) {
+    int64_t rank = (int64_t)ceil(p * h->count), seen = 0;
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS - 1; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank && seen > 0)
+            break;
+    }
+    return bucket_value(i + 1) - 1 < h->max ? bucket_value(i + 1) - 1 : h->max;
+}
+
+
+// OPERATIONS
+
+// Changes the first bytes of the value of a worker, so no two writes are alike.
+static void new_value( worker * w ) {
+    uint64_t r = next_random(&w->random);
+    int i;
+
+    for (i = 0; i < 8 && i < w->b->value_size; i++, r >>= 8)
+        w->value[i] = 'a' + (r & 0xFF) % 26;
+}
+
+static bool do_read( worker * w, int64_t key ) {
+    return find_into(w->b->table_id, key, w->buf, sizeof(w->buf)) >= 0;
+}
+
+static bool do_update( worker * w, int64_t key ) {
+    new_value(w);
+    return update(w->b->table_id, key, w->value) == 0;
+}
+
+static bool do_insert( worker * w, int64_t key ) {
+    new_value(w);
+    return insert(w->b->table_id, key, w->value) == 0;
+}
+
+static bool do_scan( worker * w, int64_t key ) {
+    bpt_key keys[MAX_SCAN];
+    char * values[MAX_SCAN];
+    bpt_cursor * cursor;
+    int len = 1 + next_random(&w->random) % MAX_SCAN, n, count = 0;
+
+    cursor = bpt_cursor_open(w->b->table_id, key);
+    while (count < len && (n = bpt_cursor_next(cursor, keys, values, len - count)) > 0)
+        count += n;
+    bpt_cursor_close(cursor);
+    return count > 0;
+}
+
+static int choose_op( worker * w ) {
+    int r = next_random(&w->random) % 100, op;
+
+    for (op = 0; op < NUM_OPS - 1; op++) {
+        if (r < w->b->w->mix[op])
+            break;
+        r -= w->b->w->mix[op];
+    }
+    return op;
+}
+
+/* Runs operations until the time or the operations of the run are
+ * spent, or for the load until every record is in.
+ */
+static void * run_worker( void * arg ) {
+    worker * w = (worker *)arg;
+    bench * b = w->b;
+    int64_t start, end, t, ops = 0, key;
+    bool found;
+    int op;
+
+    pthread_barrier_wait(&b->start);
+    start = now_ns();
+    end = b->seconds > 0 ? start + (int64_t)(b->seconds * 1e9) : INT64_MAX;
+
+    for (t = start; t < end && (b->max_ops == 0 || ops < b->max_ops); ops++) {
+        op = choose_op(w);
+        if (op == OP_INSERT) {
+            key = __atomic_fetch_add(&b->next_key, 1, __ATOMIC_RELAXED);
+            if (b->w == &load_workload && key >= b->records)
+                break;
+        }
+        else
+            key = next_key(w);
+
+        switch (op) {
+        case OP_READ:
+            found = do_read(w, key);
+            break;
+        case OP_UPDATE:
+            found = do_update(w, key);
+            break;
+        case OP_INSERT:
+            found = do_insert(w, key);
+            break;
+        case OP_SCAN:
+            found = do_scan(w, key);
+            break;
+        default:
+            found = do_read(w, key) && do_update(w, key);
+            break;
+        }
+        t = now_ns();
+        hist_add(&w->hist[op], t - start);
+        if (!found)
+            w->hist[op].missed++;
+        start = t;
+    }
+    return NULL;
+}
+
+
+// REPORT
+
+static void print_header( const options * o ) {
+    if (strcmp(o->format, "csv") == 0)
+        fprintf(o->out, "workload,distribution,records,value_size,threads,seconds,"
+                "op,count,missed,ops_per_sec,mean_us,p50_us,p99_us,p999_us,max_us\n");
+    else if (strcmp(o->format, "json") == 0)
+        fprintf(o->out, "[");
+}
+
+static void print_footer( const options * o ) {
+    if (strcmp(o->format, "json") == 0)
+        fprintf(o->out, "\n]\n");
+}
+
+/* Prints the measures of one kind of operation of a run,
+ * or of all of them if op is "TOTAL".
+ */
+static void print_row( const options * o, const bench * b, double elapsed,
+        const char * op, const histogram * h ) {
+    static bool first = true;
+    double mean = h->count > 0 ? h->sum / 1e3 / h->count : 0;
+
+    if (strcmp(o->format, "csv") == 0)
+        fprintf(o->out, "%s,%s,%ld,%d,%d,%.3f,%s,%ld,%ld,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                b->w->name, dist_names[b->dist], b->records, b->value_size, o->threads,
+                elapsed, op, h->count, h->missed, h->count / elapsed, mean,
+                hist_percentile(h, 0.5) / 1e3, hist_percentile(h, 0.99) / 1e3,
+                hist_percentile(h, 0.999) / 1e3, h->max / 1e3);
+    else if (strcmp(o->format, "json") == 0)
+        fprintf(o->out, "%s\n  {\"workload\": \"%s\", \"distribution\": \"%s\", "
+                "\"records\": %ld, \"value_size\": %d, \"threads\": %d, "
+                "\"seconds\": %.3f, \"op\": \"%s\", \"count\": %ld, \"missed\": %ld, "
+                "\"ops_per_sec\": %.1f, \"mean_us\": %.3f, \"p50_us\": %.3f, "
+                "\"p99_us\": %.3f, \"p999_us\": %.3f, \"max_us\": %.3f}",
+                first ? "" : ",", b->w->name, dist_names[b->dist], b->records,
+                b->value_size, o->threads, elapsed, op, h->count, h->missed,
+                h->count / elapsed, mean, hist_percentile(h, 0.5) / 1e3,
+                hist_percentile(h, 0.99) / 1e3, hist_percentile(h, 0.999) / 1e3,
+                h->max / 1e3);
+    else
+        fprintf(o->out, "%-18s %10ld %8ld %11.0f %9.2f %9.2f %9.2f %9.2f %10.2f\n",
+                op, h->count, h->missed, h->count / elapsed, mean,
+                hist_percentile(h, 0.5) / 1e3, hist_percentile(h, 0.99) / 1e3,
+                hist_percentile(h, 0.999) / 1e3, h->max / 1e3);
+    first = false;
+}
+
+
+// RUN
+
+/* Runs a workload on the table with every thread and reports it.
+ */
+static void run( const options * o, bench * b, const workload * w ) {
+    worker * workers;
+    histogram * total;
+    int64_t start;
+    double elapsed;
+    int i, op;
+
+    b->w = w;
+    b->dist = o->dist >= 0 && w != &load_workload ? o->dist : w->dist;
+    b->seconds = w == &load_workload ? 0 : o->seconds;
+    b->max_ops = w == &load_workload ? 0 : o->ops;
+
+    workers = (worker *) calloc(o->threads, sizeof(worker));
+    total = (histogram *) calloc(1, sizeof(histogram));
+    if (workers == NULL || total == NULL) {
+        perror("Benchmark threads.");
+        exit(EXIT_FAILURE);
+    }
+    pthread_barrier_init(&b->start, NULL, o->threads + 1);
+    for (i = 0; i < o->threads; i++) {
+        workers[i].b = b;
+        workers[i].random = fnv_hash(o->seed * 1000003 + i) | 1;
+        memset(workers[i].value, 'x', b->value_size);
+        workers[i].value[b->value_size] = '\0';
+        if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+            perror("Benchmark threads.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_barrier_wait(&b->start);
+    start = now_ns();
+    for (i = 0; i < o->threads; i++)
+        pthread_join(workers[i].thread, NULL);
+    elapsed = (now_ns() - start) / 1e9;
+    pthread_barrier_destroy(&b->start);
+
+    if (strcmp(o->format, "text") == 0)
+        fprintf(o->out, "\nWorkload %s, %s: %ld records of %d bytes, %d threads, %.2f s\n"
+                "%-18s %10s %8s %11s %9s %9s %9s %9s %10s\n",
+                w->name, dist_names[b->dist], b->records, b->value_size, o->threads,
+                elapsed, "op", "count", "missed", "ops/s", "mean us", "p50 us",
+                "p99 us", "p999 us", "max us");
+    for (op = 0; op < NUM_OPS; op++) {
+        for (i = 1; i < o->threads; i++)
+            hist_merge(&workers[0].hist[op], &workers[i].hist[op]);
+        if (workers[0].hist[op].count == 0)
+            continue;
+        print_row(o, b, elapsed, op_names[op], &workers[0].hist[op]);
+        hist_merge(total, &workers[0].hist[op]);
+    }
+    print_row(o, b, elapsed, "TOTAL", total);
+    fflush(o->out);
+
+    free(total);
+    free(workers);
+}
+
+static void usage( const char * name ) {
+    printf("usage: %s [-w workloads] [-d zipfian|uniform|latest]\n"
+            "\t[-n records] [-v value bytes] [-t threads] [-s seconds]\n"
+            "\t[-c operations] [-b frames] [-p page size] [-m io mode]\n"
+            "\t[-D durability] [-S seed] [-f text|csv|json] [-o output] [file]\n"
+            "\t-w  workloads to run in turn after the load, of A to F (ABCDEF)\n"
+            "\t-d  distribution of the keys of every workload (as YCSB has it)\n"
+            "\t-n  records loaded (100000)\n"
+            "\t-v  bytes of each value, below %d (100)\n"
+            "\t-t  threads (1)\n"
+            "\t-s  seconds of each workload, 0 for no limit (10)\n"
+            "\t-c  operations of each thread per workload, 0 for no limit (0)\n"
+            "\t-b  frames of the buffer pool (%d)\n"
+            "\t-p  page size of the table (%d)\n"
+            "\t-m  io mode of the table, as open_table takes it (%d)\n"
+            "\t-D  durability of the table, as open_table takes it (%d)\n"
+            "\t-S  seed of the random numbers (1)\n"
+            "\t-f  format of the results (text)\n"
+            "\t-o  file the results are written to (standard output)\n"
+            "\tfile  data file of the table, removed after the run (ycsb.db)\n",
+            name, MAX_VALUE_SIZE, DEFAULT_BUF_NUM, PAGE_SIZE, IO_BUFFERED,
+            DURABILITY_NONE);
+}
+
+int main( int argc, char ** argv ) {
+    options o = { "ABCDEF", -1, 100000, 100, 1, 10, 0, DEFAULT_BUF_NUM, PAGE_SIZE,
+        IO_BUFFERED, DURABILITY_NONE, 1, "text", stdout, "ycsb.db" };
+    bench b;
+    const char * p;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "w:d:n:v:t:s:c:b:p:m:D:S:f:o:h")) != -1) {
+        switch (c) {
+        case 'w': o.workloads = optarg; break;
+        case 'd':
+            for (o.dist = 2; o.dist >= 0 && strcmp(optarg, dist_names[o.dist]) != 0; o.dist--)
+                ;
+            if (o.dist < 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n': o.records = atoll(optarg); break;
+        case 'v': o.value_size = atoi(optarg); break;
+        case 't': o.threads = atoi(optarg); break;
+        case 's': o.seconds = atof(optarg); break;
+        case 'c': o.ops = atoll(optarg); break;
+        case 'b': o.frames = atoi(optarg); break;
+        case 'p': o.page_size = atoi(optarg); break;
+        case 'm': o.io_mode = atoi(optarg); break;
+        case 'D': o.durability = atoi(optarg); break;
+        case 'S': o.seed = strtoull(optarg, NULL, 10); break;
+        case 'f': o.format = optarg; break;
+        case 'o':
+            if ((o.out = fopen(optarg, "w")) == NULL) {
+                perror("Benchmark output.");
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind < argc)
+        o.path = argv[optind];
+    for (p = o.workloads; *p != '\0' && *p >= 'A' && *p <= 'F'; p++)
+        ;
+    if (*p != '\0' || o.records <= 0 || o.value_size <= 0 ||
+            o.value_size >= MAX_VALUE_SIZE || o.threads <= 0 ||
+            (o.seconds <= 0 && o.ops <= 0) || (strcmp(o.format, "text") != 0 &&
+                strcmp(o.format, "csv") != 0 && strcmp(o.format, "json") != 0)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    remove_table(o.path);
+    memset(&b, 0, sizeof(b));
+    b.table_id = open_table((char *)o.path, o.frames, o.durability, o.io_mode, o.page_size, KEY_INT64);
+    if (b.table_id < 0) {
+        perror("Benchmark open.");
+        return EXIT_FAILURE;
+    }
+    b.records = o.records;
+    b.value_size = o.value_size;
+    zipf_init(&b.zipf, o.records);
+
+    print_header(&o);
+    run(&o, &b, &load_workload);
+    for (p = o.workloads; *p != '\0'; p++)
+        for (i = 0; i < (int)(sizeof(workloads) / sizeof(workloads[0])); i++)
+            if (workloads[i].name[0] == *p)
+                run(&o, &b, &workloads[i]);
+    print_footer(&o);
+
+    close_table(b.table_id);
+    remove_table(o.path);
+    if (o.out != stdout)
+        fclose(o.out);
+    return EXIT_SUCCESS;
+}
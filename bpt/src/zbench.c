@@ -0,0 +1,247 @@
+/*
+ *  zbench.c
+ *
+ *  Weighs the CPU cost of the compressed page store against the I/O it
+ *  saves.  A table of records with repetitive text values is bulk
+ *  loaded with and without IO_COMPRESS.  For each, the space taken on
+ *  disk is measured, and then a full scan of the table run from a cold
+ *  buffer pool, with the files dropped from the page cache, reports
+ *  its time, its CPU time and the bytes it read.  The leaves of the
+ *  uncompressed table are also compressed and decompressed in memory
+ *  to time the codec alone.
+ *
+ *  usage: zbench [records [file]]
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <time.h>
+#include "bpt.h"
+#include "lz.h"
+
+// Number of times the codec is timed over the leaves.
+#define CODEC_ROUNDS 5
+
+static double now( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_now( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char * path_with( const char * path, const char * suffix ) {
+    static char buf[4096];
+    snprintf(buf, sizeof(buf), "%s%s", path, suffix);
+    return buf;
+}
+
+static void remove_table( const char * path ) {
+    unlink(path);
+    unlink(path_with(path, WAL_SUFFIX));
+    unlink(path_with(path, ZSTORE_SUFFIX));
+    unlink(path_with(path, SPACE_SUFFIX));
+}
+
+/* Returns the bytes a file takes on disk, 0 if it does not exist.
+ * With drop set, the file is also dropped from the page cache.
+ */
+static int64_t disk_bytes( const char * path, bool drop ) {
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return 0;
+    fstat(fd, &st);
+    if (drop)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    return (int64_t)st.st_blocks * 512;
+}
+
+/* Fills records with keys 0 to n - 1 and values like the rows of
+ * a user table: a few fields of text that change from row to row.
+ */
+static void make_records( record * records, int64_t n ) {
+    static const char * cities[] = { "Seoul", "Busan", "Incheon", "Daegu" };
+    static const char * plans[] = { "free", "basic", "premium" };
+    int64_t i;
+
+    for (i = 0; i < n; i++) {
+        records[i].key = i;
+        snprintf(records[i].value, VALUE_SIZE,
+                "{\"id\":%ld,\"name\":\"user%06ld\",\"city\":\"%s\","
+                "\"plan\":\"%s\",\"status\":\"active\",\"visits\":%ld}",
+                i, i, cities[i % 4], plans[i % 3], i % 1000);
+    }
+}
+
+/* Type of the measures of one table.
+ */
+typedef struct bench_result {
+    const char * name;
+    int64_t disk;
+    double load;
+    double scan;
+    double cpu;
+    int64_t read_bytes;
+} bench_result;
+
+/* Loads the records into a new table and scans it cold.
+ */
+static void run( bench_result * r, const char * path, int io_mode,
+        record * records, int64_t n ) {
+    int64_t count = 0;
+    bpt_key keys[256];
+    double start;
+    char * values[256];
+    bpt_cursor * cursor;
+    int table_id, k;
+
+    remove_table(path);
+    start = now();
+    table_id = open_table((char *)path, 0, DURABILITY_NONE, io_mode, 0, KEY_INT64);
+    if (table_id < 0 || bulk_load(table_id, records, n, DEFAULT_FILL_FACTOR) != n ||
+            close_table(table_id) != 0) {
+        perror("Benchmark load.");
+        exit(EXIT_FAILURE);
+    }
+    r->load = now() - start;
+
+    r->disk = disk_bytes(path, true) + disk_bytes(path_with(path, ZSTORE_SUFFIX), true);
+    table_id = open_table((char *)path, MIN_BUF_NUM(PAGE_SIZE), DURABILITY_NONE, io_mode, 0, KEY_INT64);
+    if (table_id < 0) {
+        perror("Benchmark open.");
+        exit(EXIT_FAILURE);
+    }
+    start = now();
+    r->cpu = cpu_now();
+    cursor = bpt_cursor_open(table_id, BPT_KEY_MIN);
+    while ((k = bpt_cursor_next(cursor, keys, values, 256)) > 0)
+        count += k;
+    bpt_cursor_close(cursor);
+    r->scan = now() - start;
+    r->cpu = cpu_now() - r->cpu;
+    r->read_bytes = get_table(table_id)->pool->read_bytes;
+    close_table(table_id);
+
+    if (count != n) {
+        printf("%s: scanned %ld records of %ld\n", r->name, count, n);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Times the codec over the leaves of the uncompressed table.
+ */
+static void run_codec( const char * path ) {
+    char * pages, * block, * out;
+    int64_t num_pages, num_leaves = 0, i, stored = 0, sectors = 0;
+    double start, compress, decompress;
+    struct stat st;
+    int fd, r, * lengths;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+        perror("Benchmark file.");
+        exit(EXIT_FAILURE);
+    }
+    num_pages = st.st_size / PAGE_SIZE;
+    pages = (char *) malloc((size_t)num_pages * PAGE_SIZE);
+    block = (char *) malloc((size_t)num_pages * PAGE_SIZE);
+    out = (char *) malloc(PAGE_SIZE);
+    lengths = (int *) malloc(num_pages * sizeof(int));
+    if (pages == NULL || block == NULL || out == NULL || lengths == NULL) {
+        perror("Benchmark pages.");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 1; i < num_pages; i++) {
+        if (pread(fd, pages + num_leaves * PAGE_SIZE, PAGE_SIZE, i * PAGE_SIZE) != PAGE_SIZE)
+            break;
+        if (((node_header_t *)(pages + num_leaves * PAGE_SIZE))->is_leaf &&
+                ((node_header_t *)(pages + num_leaves * PAGE_SIZE))->num_keys > 0)
+            num_leaves++;
+    }
+    close(fd);
+    if (num_leaves == 0)
+        return;
+
+    start = now();
+    for (r = 0; r < CODEC_ROUNDS; r++)
+        for (i = 0; i < num_leaves; i++)
+            lz_compress(pages + i * PAGE_SIZE, PAGE_SIZE, block + i * PAGE_SIZE,
+                    PAGE_SIZE - ZSTORE_SECTOR);
+    compress = (now() - start) / (CODEC_ROUNDS * num_leaves);
+
+    for (i = 0; i < num_leaves; i++) {
+        lengths[i] = lz_compress(pages + i * PAGE_SIZE, PAGE_SIZE, block + i * PAGE_SIZE,
+                PAGE_SIZE - ZSTORE_SECTOR);
+        if (lengths[i] > 0) {
+            stored++;
+            sectors += (lengths[i] + ZSTORE_SECTOR - 1) / ZSTORE_SECTOR;
+        }
+    }
+
+    start = now();
+    for (r = 0; r < CODEC_ROUNDS; r++)
+        for (i = 0; i < num_leaves; i++) {
+            if (lengths[i] > 0 && lz_decompress(block + i * PAGE_SIZE, lengths[i],
+                        out, PAGE_SIZE) != PAGE_SIZE) {
+                printf("Leaf %ld does not decompress.\n", i);
+                exit(EXIT_FAILURE);
+            }
+        }
+    decompress = (now() - start) / (CODEC_ROUNDS * num_leaves);
+
+    printf("%ld leaves, %ld stored compressed in %.2f sectors each (%.1fx)\n",
+            num_leaves, stored, stored > 0 ? (double)sectors / stored : 0.0,
+            stored > 0 ? (double)stored * PAGE_SIZE / (sectors * ZSTORE_SECTOR) : 1.0);
+    printf("compress %.2f us/leaf (%.0f MB/s), decompress %.2f us/leaf (%.0f MB/s)\n",
+            compress * 1e6, PAGE_SIZE / compress / 1e6,
+            decompress * 1e6, PAGE_SIZE / decompress / 1e6);
+    if (stored > 0)
+        printf("a leaf read costs %.2f us of CPU to save %.0f bytes of I/O\n",
+                decompress * 1e6, PAGE_SIZE - (double)sectors / stored * ZSTORE_SECTOR);
+
+    free(lengths);
+    free(out);
+    free(block);
+    free(pages);
+}
+
+int main( int argc, char ** argv ) {
+    int64_t n = argc > 1 ? atoll(argv[1]) : 1000000;
+    const char * path = argc > 2 ? argv[2] : "zbench.db";
+    bench_result results[2] = { { .name = "plain" }, { .name = "compressed" } };
+    record * records;
+    int i;
+
+    if (n <= 0) {
+        printf("usage: %s [records [file]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    records = (record *) malloc(n * sizeof(record));
+    if (records == NULL) {
+        perror("Benchmark records.");
+        return EXIT_FAILURE;
+    }
+    make_records(records, n);
+
+    printf("%ld records, cold scans with %d frames\n", n, MIN_BUF_NUM(PAGE_SIZE));
+    run(&results[0], path, IO_BUFFERED, records, n);
+    run_codec(path);
+    run(&results[1], path, IO_BUFFERED | IO_COMPRESS, records, n);
+
+    printf("\n%-12s %10s %10s %10s %10s %10s\n", "mode", "disk MB", "load s",
+            "scan s", "scan cpu s", "read MB");
+    for (i = 0; i < 2; i++)
+        printf("%-12s %10.1f %10.2f %10.3f %10.3f %10.1f\n", results[i].name,
+                results[i].disk / 1e6, results[i].load, results[i].scan,
+                results[i].cpu, results[i].read_bytes / 1e6);
+
+    remove_table(path);
+    free(records);
+    return EXIT_SUCCESS;
+}
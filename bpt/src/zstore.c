@@ -0,0 +1,548 @@
+/*
+ *  zstore.c
+ *
+ *  Compressed page store of the disk-based B+ tree.
+ *  Pages that compress by at least a sector are written to the store
+ *  of the data file instead of their place in it, which becomes a
+ *  hole: in practice the leaves, whose values are mostly text.  The
+ *  page translation map finds the block of each page in the store.
+ *  The store is made durable by zstore_sync at checkpoints.  Between
+ *  two syncs, the sectors of a rewritten page are freed at once and
+ *  may be reused; after a crash, the map of the last sync may then
+ *  point at another block, but such a page has changed since that
+ *  checkpoint, so the log replays a whole image of it.  A block that
+ *  cannot be decompressed reads as zeros.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "zstore.h"
+#include "lz.h"
+#include "wal.h"
+
+// UTILITIES
+
+static int64_t entry_sector( uint64_t e ) {
+    return (int64_t)(e >> 16);
+}
+
+static int entry_length( uint64_t e ) {
+    return (int)(e & 0xffff);
+}
+
+static int64_t sectors_for( int64_t len ) {
+    return (len + ZSTORE_SECTOR - 1) / ZSTORE_SECTOR;
+}
+
+static int pread_all( int fd, char * buf, size_t len, int64_t offset ) {
+    ssize_t n;
+    size_t done = 0;
+
+    while (done < len) {
+        n = pread(fd, buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+static int pwrite_all( int fd, const char * buf, size_t len, int64_t offset ) {
+    ssize_t n;
+    size_t done = 0;
+
+    while (done < len) {
+        n = pwrite(fd, buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+static bool is_used( zstore * zs, int64_t s ) {
+    return zs->used[s >> 6] >> (s & 63) & 1;
+}
+
+/* Makes room in the bitmap for num_sectors sectors.
+ */
+static void grow_bitmap( zstore * zs, int64_t num_sectors ) {
+    int64_t words = (num_sectors + 63) / 64, size;
+
+    if (words <= zs->used_words)
+        return;
+    size = zs->used_words * 2 > words ? zs->used_words * 2 : words;
+    zs->used = (uint64_t *) realloc(zs->used, size * sizeof(uint64_t));
+    if (zs->used == NULL) {
+        perror("Store bitmap.");
+        exit(EXIT_FAILURE);
+    }
+    memset(zs->used + zs->used_words, 0, (size - zs->used_words) * sizeof(uint64_t));
+    zs->used_words = size;
+}
+
+/* Makes room in the map for num_entries pages.
+ */
+static void grow_map( zstore * zs, int64_t num_entries ) {
+    int64_t size;
+
+    if (num_entries <= zs->map_size)
+        return;
+    size = zs->map_size * 2 > num_entries ? zs->map_size * 2 : num_entries;
+    zs->map = (uint64_t *) realloc(zs->map, size * sizeof(uint64_t));
+    if (zs->map == NULL) {
+        perror("Page translation map.");
+        exit(EXIT_FAILURE);
+    }
+    memset(zs->map + zs->map_size, 0, (size - zs->map_size) * sizeof(uint64_t));
+    zs->map_size = size;
+}
+
+static void mark( zstore * zs, int64_t start, int64_t n, bool used ) {
+    int64_t s;
+
+    for (s = start; s < start + n; s++) {
+        if (used)
+            zs->used[s >> 6] |= (uint64_t)1 << (s & 63);
+        else
+            zs->used[s >> 6] &= ~((uint64_t)1 << (s & 63));
+    }
+    zs->free_sectors += used ? -n : n;
+}
+
+/* Finds n free sectors in a row between sectors from and to.
+ * Returns the first of them, or -1 if there are none.
+ */
+static int64_t find_run( zstore * zs, int64_t from, int64_t to, int64_t n ) {
+    int64_t s, run = 0;
+
+    for (s = from; s < to; s++) {
+        if ((s & 63) == 0 && s + 64 <= to && zs->used[s >> 6] == UINT64_MAX) {
+            run = 0;
+            s += 63;
+            continue;
+        }
+        if (is_used(zs, s))
+            run = 0;
+        else if (++run == n)
+            return s - n + 1;
+    }
+    return -1;
+}
+
+/* Allocates n sectors in a row, by next fit from the last run
+ * allocated, or at the end of the store.  Called with the lock held.
+ */
+static int64_t alloc_run( zstore * zs, int64_t n ) {
+    int64_t s = -1, wrap;
+
+    if (zs->free_sectors >= n) {
+        s = find_run(zs, zs->hint, zs->num_sectors, n);
+        wrap = zs->hint + n - 1 < zs->num_sectors ? zs->hint + n - 1 : zs->num_sectors;
+        if (s < 0)
+            s = find_run(zs, 1, wrap, n);
+    }
+    if (s < 0) {
+        s = zs->num_sectors;
+        grow_bitmap(zs, s + n);
+        zs->num_sectors = s + n;
+        zs->free_sectors += n;
+    }
+    mark(zs, s, n, true);
+    zs->hint = s + n;
+    return s;
+}
+
+static uint64_t lookup( zstore * zs, int64_t page ) {
+    int64_t i = page / zs->page_size;
+    uint64_t e = 0;
+
+    pthread_mutex_lock(&zs->lock);
+    if (i < zs->map_size)
+        e = zs->map[i];
+    pthread_mutex_unlock(&zs->lock);
+    return e;
+}
+
+/* Compresses a page into block.  Returns the length of the block,
+ * or 0 if the page is to stay in the data file: the header page,
+ * which tells an existing data file from a new one, and any page
+ * that would not save a sector.
+ */
+static int compress_page( zstore * zs, int64_t page, const char * image, char * block ) {
+    if (page == 0)
+        return 0;
+    return lz_compress(image, zs->page_size, block, zs->page_size - ZSTORE_SECTOR);
+}
+
+/* Records a page in the map as a block of len bytes, freeing the
+ * sectors of its previous block, or as kept in the data file if
+ * len is 0.  Returns the first sector of the block.
+ */
+static int64_t place( zstore * zs, int64_t page, int len ) {
+    int64_t i = page / zs->page_size, start = 0;
+    uint64_t old;
+
+    pthread_mutex_lock(&zs->lock);
+    if (i >= zs->map_size && len == 0) {
+        pthread_mutex_unlock(&zs->lock);
+        return 0;
+    }
+    grow_map(zs, i + 1);
+    old = zs->map[i];
+    if (old != 0)
+        mark(zs, entry_sector(old), sectors_for(entry_length(old)), false);
+    if (len > 0)
+        start = alloc_run(zs, sectors_for(len));
+    zs->map[i] = len > 0 ? (uint64_t)start << 16 | len : 0;
+    if (old != 0 || len > 0)
+        zs->map_dirty = true;
+    pthread_mutex_unlock(&zs->lock);
+
+    // The copy in the data file is stale once the page is in the store.
+    if (old == 0 && len > 0)
+        fallocate(zs->data_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                page, zs->page_size);
+    return start;
+}
+
+static void decompress_page( zstore * zs, const char * block, int len, char * out ) {
+    if (lz_decompress(block, len, out, zs->page_size) != zs->page_size)
+        memset(out, 0, zs->page_size);
+}
+
+/* Reads the superblock and the map of an existing store.
+ * A store that was never synced has no superblock yet.
+ * Returns false if either is damaged.
+ */
+static bool load( zstore * zs, int64_t size ) {
+    char sector[ZSTORE_SECTOR];
+    zstore_super super;
+    int64_t i;
+
+    if (size < ZSTORE_SECTOR || pread_all(zs->fd, sector, ZSTORE_SECTOR, 0) != 0)
+        return true;
+    memcpy(&super, sector, sizeof(super));
+    if (super.magic == 0)
+        return true;
+    if (super.magic != ZSTORE_MAGIC || super.page_size != (uint32_t)zs->page_size ||
+            super.checksum != wal_checksum(sector + sizeof(uint32_t),
+                sizeof(super) - sizeof(uint32_t)))
+        return false;
+
+    grow_map(zs, super.map_entries);
+    if (super.map_entries > 0 &&
+            (pread_all(zs->fd, (char *)zs->map, super.map_entries * sizeof(uint64_t),
+                        super.map_start * ZSTORE_SECTOR) != 0 ||
+             wal_checksum((char *)zs->map, super.map_entries * sizeof(uint64_t)) !=
+                super.map_checksum))
+        return false;
+
+    zs->map_start[0] = super.map_start;
+    zs->map_sectors[0] = sectors_for(super.map_entries * sizeof(uint64_t));
+    if (zs->map_start[0] + zs->map_sectors[0] > zs->num_sectors)
+        return false;
+    mark(zs, zs->map_start[0], zs->map_sectors[0], true);
+    for (i = 0; i < (int64_t)super.map_entries; i++) {
+        if (zs->map[i] == 0)
+            continue;
+        if (entry_sector(zs->map[i]) + sectors_for(entry_length(zs->map[i])) > zs->num_sectors)
+            return false;
+        mark(zs, entry_sector(zs->map[i]), sectors_for(entry_length(zs->map[i])), true);
+    }
+    return true;
+}
+
+// COMPRESSED PAGE STORE
+
+/* Opens the store of a data file, creating it if needed.
+ * Returns NULL if the store cannot be opened or is damaged.
+ */
+zstore * zstore_open( const char * path, int data_fd, int page_size ) {
+    struct stat st;
+    zstore * zs;
+
+    zs = (zstore *) calloc(1, sizeof(zstore));
+    if (zs == NULL) {
+        perror("Page store creation.");
+        exit(EXIT_FAILURE);
+    }
+    zs->data_fd = data_fd;
+    zs->page_size = page_size;
+    pthread_mutex_init(&zs->lock, NULL);
+
+    zs->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (zs->fd < 0 || fstat(zs->fd, &st) != 0) {
+        zstore_close(zs);
+        return NULL;
+    }
+
+    // Sector 0 is the superblock.
+    zs->num_sectors = sectors_for(st.st_size) > 1 ? sectors_for(st.st_size) : 1;
+    grow_bitmap(zs, zs->num_sectors);
+    zs->free_sectors = zs->num_sectors;
+    mark(zs, 0, 1, true);
+    zs->hint = 1;
+
+    if (!load(zs, st.st_size)) {
+        zstore_close(zs);
+        return NULL;
+    }
+    return zs;
+}
+
+
+/* Closes the store.  Changes since the last sync are not kept.
+ */
+int zstore_close( zstore * zs ) {
+    int result = 0;
+
+    if (zs == NULL)
+        return 0;
+    if (zs->fd >= 0 && close(zs->fd) != 0)
+        result = -1;
+    pthread_mutex_destroy(&zs->lock);
+    free(zs->used);
+    free(zs->map);
+    free(zs);
+    return result;
+}
+
+
+/* Reads a page kept in the store into out.
+ * Returns the number of bytes read from the store, or 0 if the
+ * page is kept in the data file.
+ */
+int zstore_read( zstore * zs, int64_t page, char * out ) {
+    uint64_t e = lookup(zs, page);
+    char * block;
+
+    if (e == 0)
+        return 0;
+    block = (char *) malloc(entry_length(e));
+    if (block == NULL) {
+        perror("Page block.");
+        exit(EXIT_FAILURE);
+    }
+    if (pread_all(zs->fd, block, entry_length(e), entry_sector(e) * ZSTORE_SECTOR) != 0)
+        memset(out, 0, zs->page_size);
+    else
+        decompress_page(zs, block, entry_length(e), out);
+    free(block);
+    return entry_length(e);
+}
+
+
+/* Reads the pages of a list that are kept in the store as one batch
+ * through an I/O context, setting found for each of them.
+ * Returns the number of bytes read from the store.
+ */
+int64_t zstore_read_batch( zstore * zs, aio * ctx, const int64_t pages[],
+        char * const out[], int num_pages, bool found[] ) {
+    aio_req * reqs;
+    int * which;
+    char * blocks;
+    uint64_t e;
+    int64_t total = 0;
+    int i, n = 0;
+
+    reqs = (aio_req *) malloc(num_pages * sizeof(aio_req));
+    which = (int *) malloc(num_pages * sizeof(int));
+    if (reqs == NULL || which == NULL) {
+        perror("Store read batch.");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < num_pages; i++) {
+        e = lookup(zs, pages[i]);
+        found[i] = e != 0;
+        if (e == 0)
+            continue;
+        reqs[n].offset = entry_sector(e) * ZSTORE_SECTOR;
+        reqs[n].len = entry_length(e);
+        which[n++] = i;
+        total += entry_length(e);
+    }
+
+    blocks = (char *) malloc(total > 0 ? total : 1);
+    if (blocks == NULL) {
+        perror("Store read batch.");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0, total = 0; i < n; i++) {
+        reqs[i].buf = blocks + total;
+        total += reqs[i].len;
+    }
+
+    // A block that cannot be read in the batch is read again alone.
+    if (aio_submit(ctx, zs->fd, AIO_READ, reqs, n) != 0)
+        for (i = 0; i < n; i++)
+            zstore_read(zs, pages[which[i]], out[which[i]]);
+    else
+        for (i = 0; i < n; i++)
+            decompress_page(zs, reqs[i].buf, reqs[i].len, out[which[i]]);
+
+    free(blocks);
+    free(which);
+    free(reqs);
+    return total;
+}
+
+
+/* Keeps a page in the store if that saves a sector, and takes it
+ * out of the store otherwise.
+ * Returns 1 if the page is kept in the store, 0 if the caller must
+ * write it to the data file, or -1 on error.
+ */
+int zstore_write( zstore * zs, int64_t page, const char * image ) {
+    char * block;
+    int64_t start;
+    int len, result;
+
+    block = (char *) malloc(zs->page_size);
+    if (block == NULL) {
+        perror("Page block.");
+        exit(EXIT_FAILURE);
+    }
+    len = compress_page(zs, page, image, block);
+    start = place(zs, page, len);
+    result = len > 0;
+    if (len > 0 && pwrite_all(zs->fd, block, len, start * ZSTORE_SECTOR) != 0)
+        result = -1;
+    free(block);
+    return result;
+}
+
+
+/* Drops a page cut off the end of the data file from the store,
+ * freeing the sectors of its block.
+ * Returns the bytes of the sectors freed, or 0 if the page is kept
+ * in the data file.
+ */
+int64_t zstore_drop( zstore * zs, int64_t page ) {
+    int64_t i = page / zs->page_size, n = 0;
+
+    pthread_mutex_lock(&zs->lock);
+    if (i < zs->map_size && zs->map[i] != 0) {
+        n = sectors_for(entry_length(zs->map[i]));
+        mark(zs, entry_sector(zs->map[i]), n, false);
+        zs->map[i] = 0;
+        zs->map_dirty = true;
+    }
+    pthread_mutex_unlock(&zs->lock);
+    return n * ZSTORE_SECTOR;
+}
+
+
+/* Writes the pages of a list as zstore_write does, in batches
+ * through an I/O context, setting stored for the pages kept in
+ * the store.  Returns 0, or -1 if a block could not be written.
+ */
+int zstore_write_batch( zstore * zs, aio * ctx, const int64_t pages[],
+        char * const images[], int num_pages, bool stored[] ) {
+    aio_req reqs[ZSTORE_BATCH];
+    char * blocks, * block;
+    int64_t start;
+    int i, j, n, len, result = 0;
+
+    blocks = (char *) malloc((size_t)ZSTORE_BATCH * zs->page_size);
+    if (blocks == NULL) {
+        perror("Store write batch.");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < num_pages; i += ZSTORE_BATCH) {
+        for (j = i, n = 0; j < num_pages && j < i + ZSTORE_BATCH; j++) {
+            block = blocks + (size_t)(j - i) * zs->page_size;
+            len = compress_page(zs, pages[j], images[j], block);
+            start = place(zs, pages[j], len);
+            stored[j] = len > 0;
+            if (len == 0)
+                continue;
+            reqs[n].buf = block;
+            reqs[n].offset = start * ZSTORE_SECTOR;
+            reqs[n].len = len;
+            n++;
+        }
+        if (aio_submit(ctx, zs->fd, AIO_WRITE, reqs, n) != 0)
+            result = -1;
+    }
+
+    free(blocks);
+    return result;
+}
+
+
+/* Makes the store durable.  The map is written to the run the
+ * superblock does not point at and synced with the blocks, then the
+ * superblock is pointed at it and synced, so a crash leaves either
+ * the old map or the new one.
+ * No page may be written meanwhile.  Returns 0, or -1 on error.
+ */
+int zstore_sync( zstore * zs ) {
+    char sector[ZSTORE_SECTOR];
+    zstore_super super;
+    int64_t entries, n = 0;
+    char * map = NULL;
+    int slot, result = 0;
+
+    pthread_mutex_lock(&zs->lock);
+    if (!zs->map_dirty) {
+        pthread_mutex_unlock(&zs->lock);
+        return 0;
+    }
+    // Pages after the last one in the store need no entries.
+    for (entries = zs->map_size; entries > 0 && zs->map[entries - 1] == 0; entries--)
+        ;
+    slot = 1 - zs->map_slot;
+    if (entries > 0) {
+        n = sectors_for(entries * sizeof(uint64_t));
+        if (zs->map_sectors[slot] < n) {
+            mark(zs, zs->map_start[slot], zs->map_sectors[slot], false);
+            zs->map_sectors[slot] = n + n / 2;
+            zs->map_start[slot] = alloc_run(zs, zs->map_sectors[slot]);
+        }
+        map = (char *) malloc(entries * sizeof(uint64_t));
+        if (map == NULL) {
+            perror("Page translation map.");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(map, zs->map, entries * sizeof(uint64_t));
+    }
+    zs->map_dirty = false;
+    pthread_mutex_unlock(&zs->lock);
+
+    memset(&super, 0, sizeof(super));
+    super.magic = ZSTORE_MAGIC;
+    super.page_size = zs->page_size;
+    super.map_start = zs->map_start[slot];
+    super.map_entries = entries;
+    super.map_checksum = wal_checksum(map, entries * sizeof(uint64_t));
+    super.checksum = wal_checksum((char *)&super + sizeof(uint32_t),
+            sizeof(super) - sizeof(uint32_t));
+    memset(sector, 0, sizeof(sector));
+    memcpy(sector, &super, sizeof(super));
+
+    if ((n > 0 && pwrite_all(zs->fd, map, entries * sizeof(uint64_t),
+                    zs->map_start[slot] * ZSTORE_SECTOR) != 0) ||
+            fdatasync(zs->fd) != 0 ||
+            pwrite_all(zs->fd, sector, ZSTORE_SECTOR, 0) != 0 ||
+            fdatasync(zs->fd) != 0)
+        result = -1;
+    free(map);
+
+    pthread_mutex_lock(&zs->lock);
+    if (result == 0)
+        zs->map_slot = slot;
+    else
+        zs->map_dirty = true;
+    pthread_mutex_unlock(&zs->lock);
+
+    return result;
+}